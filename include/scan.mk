@@ -10,6 +10,9 @@ SCAN_DIR ?= package
 TARGET_STAMP:=$(TMP_DIR)/info/.files-$(SCAN_TARGET).stamp
 FILELIST:=$(TMP_DIR)/info/.files-$(SCAN_TARGET)-$(SCAN_COOKIE)
 OVERRIDELIST:=$(TMP_DIR)/info/.overrides-$(SCAN_TARGET)-$(SCAN_COOKIE)
+SCAN_CACHE_DIR ?= $(TMP_DIR)/info/.cache-$(SCAN_TARGET)
+SCAN_CACHE_DAYS ?= 30
+SCAN_CACHE_STAT:=$(TMP_DIR)/info/.cachestat-$(SCAN_TARGET)-$(SCAN_COOKIE)
 
 export ORIG_PATH:=$(if $(ORIG_PATH),$(ORIG_PATH),$(PATH))
 export PATH:=$(STAGING_DIR_HOST)/bin:$(PATH)
@@ -27,6 +30,15 @@ ifneq ($(call feedname,$(SCAN_DIR)),)
 endif
 endif
 
+# Dump results are cached by content: the key covers the package Makefile,
+# its own SCAN_DEPS, the *.mk files next to it, the files it includes by a
+# relative path and everything a dump can include from the top level,
+# i.e. rules.mk, include/*.mk, the generic kernel version files and the
+# shared SCAN_DEPS. This is a superset of the include closure of any single
+# package, so a changed line in any of them invalidates the cache.
+SCAN_GLOBAL_DEPS:=$(sort $(wildcard $(TOPDIR)/rules.mk $(TOPDIR)/include/*.mk $(TOPDIR)/target/linux/generic/kernel-* $(filter /%,$(SCAN_DEPS))))
+SCAN_GLOBAL_HASH:=$(shell cd $(TOPDIR) && $(MKHASH) -n md5 $(patsubst $(TOPDIR)/%,%,$(SCAN_GLOBAL_DEPS)) /dev/null | $(MKHASH) md5)
+
 ifeq ($(IS_TTY),1)
   ifneq ($(strip $(NO_COLOR)),1)
     define progress
@@ -45,20 +57,38 @@ endif
 
 define PackageDir
   $(TMP_DIR)/.$(SCAN_TARGET): $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1)
-  $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1): $(SCAN_DIR)/$(2)/Makefile $(foreach DEP,$(DEPS_$(SCAN_DIR)/$(2)/Makefile) $(SCAN_DEPS),$(wildcard $(if $(filter /%,$(DEP)),$(DEP),$(SCAN_DIR)/$(2)/$(DEP))))
-	{ \
-		$$(call progress,Collecting $(SCAN_NAME) info: $(SCAN_DIR)/$(2)) \
-		echo Source-Makefile: $(SCAN_DIR)/$(2)/Makefile; \
-		$(if $(3),echo Override: $(3),true); \
-		$(if $(findstring c,$(OPENWRT_VERBOSE)),$(MAKE),$(NO_TRACE_MAKE) --no-print-dir) -r DUMP=1 FEED="$(call feedname,$(2))" -C $(SCAN_DIR)/$(2) $(SCAN_MAKEOPTS) \
-			$(if $(findstring c,$(OPENWRT_VERBOSE)),,2>/dev/null) || { \
-			mkdir -p "$(TOPDIR)/logs/$(SCAN_DIR)/$(2)"; \
-			$(NO_TRACE_MAKE) --no-print-dir -r DUMP=1 FEED="$(call feedname,$(2))" -C $(SCAN_DIR)/$(2) $(SCAN_MAKEOPTS) > $(TOPDIR)/logs/$(SCAN_DIR)/$(2)/dump.txt 2>&1; \
-			$$(call progress,ERROR: please fix $(SCAN_DIR)/$(2)/Makefile - see logs/$(SCAN_DIR)/$(2)/dump.txt for details\n) \
-			rm -f $$@; \
+  $(TMP_DIR)/info/.$(SCAN_TARGET)-$(1): $(SCAN_DIR)/$(2)/Makefile $(foreach DEP,$(DEPS_$(SCAN_DIR)/$(2)/Makefile) $(SCAN_DEPS) *.mk,$(wildcard $(if $(filter /%,$(DEP)),$(DEP),$(SCAN_DIR)/$(2)/$(DEP))))
+	mkdir -p $(SCAN_CACHE_DIR)
+	key=$$$$( { \
+		echo "$(SCAN_GLOBAL_HASH) $(SCAN_DIR)/$(2) $(3) $(SCAN_MAKEOPTS)"; \
+		$(MKHASH) -n md5 $$(filter-out $(SCAN_GLOBAL_DEPS),$$^); \
+	} | $(MKHASH) md5); \
+	if [ -n "$$$$key" -a -f "$(SCAN_CACHE_DIR)/$$$$key" ]; then \
+		cp "$(SCAN_CACHE_DIR)/$$$$key" $$@.tmp; \
+		touch "$(SCAN_CACHE_DIR)/$$$$key"; \
+		echo hit >> $(SCAN_CACHE_STAT); \
+	else \
+		failed=; \
+		{ \
+			$$(call progress,Collecting $(SCAN_NAME) info: $(SCAN_DIR)/$(2)) \
+			echo Source-Makefile: $(SCAN_DIR)/$(2)/Makefile; \
+			$(if $(3),echo Override: $(3),true); \
+			$(if $(findstring c,$(OPENWRT_VERBOSE)),$(MAKE),$(NO_TRACE_MAKE) --no-print-dir) -r DUMP=1 FEED="$(call feedname,$(2))" -C $(SCAN_DIR)/$(2) $(SCAN_MAKEOPTS) \
+				$(if $(findstring c,$(OPENWRT_VERBOSE)),,2>/dev/null) || { \
+				failed=1; \
+				mkdir -p "$(TOPDIR)/logs/$(SCAN_DIR)/$(2)"; \
+				$(NO_TRACE_MAKE) --no-print-dir -r DUMP=1 FEED="$(call feedname,$(2))" -C $(SCAN_DIR)/$(2) $(SCAN_MAKEOPTS) > $(TOPDIR)/logs/$(SCAN_DIR)/$(2)/dump.txt 2>&1; \
+				$$(call progress,ERROR: please fix $(SCAN_DIR)/$(2)/Makefile - see logs/$(SCAN_DIR)/$(2)/dump.txt for details\n) \
+				rm -f $$@; \
+			}; \
+			echo; \
+		} > $$@.tmp; \
+		[ -n "$$$$failed" -o -z "$$$$key" ] || { \
+			cp $$@.tmp "$(SCAN_CACHE_DIR)/.$$$$key" && \
+			mv "$(SCAN_CACHE_DIR)/.$$$$key" "$(SCAN_CACHE_DIR)/$$$$key"; \
 		}; \
-		echo; \
-	} > $$@.tmp
+		echo miss >> $(SCAN_CACHE_STAT); \
+	fi
 	mv $$@.tmp $$@
 endef
 
@@ -79,6 +109,7 @@ $(FILELIST): $(OVERRIDELIST)
 $(TMP_DIR)/info/.files-$(SCAN_TARGET).mk: $(FILELIST)
 	( \
 		cat $< | awk '{print "$(SCAN_DIR)/" $$0 "/Makefile" }' | xargs grep -HE '^ *SCAN_DEPS *= *' | awk -F: '{ gsub(/^.*DEPS *= */, "", $$2); print "DEPS_" $$1 "=" $$2 }'; \
+		cat $< | awk '{print "$(SCAN_DIR)/" $$0 "/Makefile" }' | xargs grep -HE '^ *-?s?include ' | awk -F: '{ n = split($$2, w, " "); for (i = 2; i <= n; i++) if (w[i] !~ /\$$/) print "DEPS_" $$1 "+=" w[i] }'; \
 		awk -F/ -v deps="$$DEPS" -v of="$(OVERRIDELIST)" ' \
 		BEGIN { \
 			while (getline < (of)) \
@@ -114,9 +145,13 @@ $(TARGET_STAMP)::
 $(TMP_DIR)/.$(SCAN_TARGET): $(TARGET_STAMP)
 	$(call progress,Collecting $(SCAN_NAME) info: merging...)
 	-cat $(FILELIST) | awk '{gsub(/\//, "_", $$0);print "$(TMP_DIR)/info/.$(SCAN_TARGET)-" $$0}' | xargs cat > $@ 2>/dev/null
+	-find $(SCAN_CACHE_DIR) -type f -mtime +$(SCAN_CACHE_DAYS) -delete 2>/dev/null
 	$(call progress,Collecting $(SCAN_NAME) info: done)
 	echo
+	-[ ! -f $(SCAN_CACHE_STAT) ] || { \
+		echo "Collecting $(SCAN_NAME) info: $$(grep -c hit $(SCAN_CACHE_STAT)) cached, $$(grep -c miss $(SCAN_CACHE_STAT)) scanned" >&2; \
+		rm -f $(SCAN_CACHE_STAT); \
+	}
 
 FORCE:
 .PHONY: FORCE
-.NOTPARALLEL:
@@ -32,6 +32,9 @@
 
 #define BH_SKB_SIZE	2048
 
+/* poll interval (ms) used while no button is pressed or debouncing */
+#define POLL_IDLE_INTERVAL	100
+
 #define DRV_NAME	"gpio-keys"
 #define PFX	DRV_NAME ": "
 
@@ -250,10 +253,10 @@ static int gpio_button_get_value(struct gpio_keys_button_data *bdata)
 	return val;
 }
 
-static void gpio_keys_handle_button(struct gpio_keys_button_data *bdata)
+static void gpio_keys_handle_state(struct gpio_keys_button_data *bdata,
+				   int state)
 {
 	unsigned int type = bdata->b->type ?: EV_KEY;
-	int state = gpio_button_get_value(bdata);
 	unsigned long seen = jiffies;
 
 	pr_debug(PFX "event type=%u, code=%u, pressed=%d\n",
@@ -296,20 +299,42 @@ set_state:
 	bdata->count = 0;
 }
 
+static void gpio_keys_handle_button(struct gpio_keys_button_data *bdata)
+{
+	gpio_keys_handle_state(bdata, gpio_button_get_value(bdata));
+}
+
+/* a pressed key or a pending state change needs fast polling */
+static bool gpio_keys_button_active(struct gpio_keys_button_data *bdata)
+{
+	unsigned int type = bdata->b->type ?: EV_KEY;
+
+	return bdata->count > 0 || (type == EV_KEY && bdata->last_state == 1);
+}
+
 struct gpio_keys_button_dev {
 	int polled;
 	struct delayed_work work;
+	unsigned int poll_idle;
+
+	/* polled buttons, sampled with a single array read */
+	int ngpios;
+	struct gpio_desc **gpiods;
+	struct gpio_keys_button_data **gpio_data;
+	unsigned long *values;
 
 	struct device *dev;
 	struct gpio_keys_platform_data *pdata;
 	struct gpio_keys_button_data data[];
 };
 
-static void gpio_keys_polled_queue_work(struct gpio_keys_button_dev *bdev)
+static void gpio_keys_polled_queue_work(struct gpio_keys_button_dev *bdev,
+					bool active)
 {
 	struct gpio_keys_platform_data *pdata = bdev->pdata;
-	unsigned long delay = msecs_to_jiffies(pdata->poll_interval);
+	unsigned long delay;
 
+	delay = msecs_to_jiffies(active ? pdata->poll_interval : bdev->poll_idle);
 	if (delay >= HZ)
 		delay = round_jiffies_relative(delay);
 	schedule_delayed_work(&bdev->work, delay);
@@ -319,15 +344,29 @@ static void gpio_keys_polled_poll(struct work_struct *work)
 {
 	struct gpio_keys_button_dev *bdev =
 		container_of(work, struct gpio_keys_button_dev, work.work);
-	int i;
+	bool active = false;
+	int i, ret;
+
+	/*
+	 * gpiolib batches the read into one get_multiple call per chip,
+	 * which saves a bus transaction per button on i2c/spi expanders.
+	 */
+	ret = gpiod_get_array_value_cansleep(bdev->ngpios, bdev->gpiods, NULL,
+					     bdev->values);
+	if (ret)
+		dev_warn_ratelimited(bdev->dev, "failed to read gpios: %d\n", ret);
 
-	for (i = 0; i < bdev->pdata->nbuttons; i++) {
-		struct gpio_keys_button_data *bdata = &bdev->data[i];
+	for (i = 0; i < bdev->ngpios; i++) {
+		struct gpio_keys_button_data *bdata = bdev->gpio_data[i];
 
-		if (bdata->gpiod)
+		if (ret)
 			gpio_keys_handle_button(bdata);
+		else
+			gpio_keys_handle_state(bdata, test_bit(i, bdev->values));
+
+		active |= gpio_keys_button_active(bdata);
 	}
-	gpio_keys_polled_queue_work(bdev);
+	gpio_keys_polled_queue_work(bdev, active);
 }
 
 static void gpio_keys_polled_close(struct gpio_keys_button_dev *bdev)
@@ -353,6 +392,15 @@ static irqreturn_t button_handle_irq(int irq, void *_bdata)
 	struct gpio_keys_button_data *bdata =
 		(struct gpio_keys_button_data *) _bdata;
 
+	/*
+	 * With hardware debounce the line is already stable, read it from
+	 * the irq thread instead of deferring to the workqueue.
+	 */
+	if (!bdata->software_debounce && bdata->gpiod) {
+		gpio_keys_handle_button(bdata);
+		return IRQ_HANDLED;
+	}
+
 	mod_delayed_work(system_wq, &bdata->work,
 			 msecs_to_jiffies(bdata->software_debounce));
 
@@ -613,8 +661,12 @@ static int gpio_keys_probe(struct platform_device *pdev)
 			bdata->irq = button->irq;
 		}
 
-		schedule_delayed_work(&bdata->work,
-				      msecs_to_jiffies(bdata->software_debounce));
+		/* initial state, before the irq thread can race with it */
+		if (!bdata->software_debounce && bdata->gpiod)
+			gpio_keys_handle_button(bdata);
+		else
+			schedule_delayed_work(&bdata->work,
+					      msecs_to_jiffies(bdata->software_debounce));
 
 		ret = devm_request_threaded_irq(&pdev->dev,
 			bdata->irq, NULL, button_handle_irq,
@@ -637,7 +689,8 @@ static int gpio_keys_polled_probe(struct platform_device *pdev)
 {
 	struct gpio_keys_platform_data *pdata;
 	struct gpio_keys_button_dev *bdev;
-	int ret;
+	struct device *dev = &pdev->dev;
+	int ret, i;
 
 	ret = gpio_keys_button_probe(pdev, &bdev, 1);
 	if (ret)
@@ -646,10 +699,31 @@ static int gpio_keys_polled_probe(struct platform_device *pdev)
 	INIT_DELAYED_WORK(&bdev->work, gpio_keys_polled_poll);
 
 	pdata = bdev->pdata;
+	bdev->poll_idle = max_t(unsigned int, pdata->poll_interval,
+				POLL_IDLE_INTERVAL);
+
+	bdev->gpiods = devm_kcalloc(dev, pdata->nbuttons,
+				    sizeof(*bdev->gpiods), GFP_KERNEL);
+	bdev->gpio_data = devm_kcalloc(dev, pdata->nbuttons,
+				       sizeof(*bdev->gpio_data), GFP_KERNEL);
+	bdev->values = devm_bitmap_zalloc(dev, pdata->nbuttons, GFP_KERNEL);
+	if (!bdev->gpiods || !bdev->gpio_data || !bdev->values)
+		return -ENOMEM;
+
+	for (i = 0; i < pdata->nbuttons; i++) {
+		struct gpio_keys_button_data *bdata = &bdev->data[i];
+
+		if (!bdata->gpiod)
+			continue;
+
+		bdev->gpiods[bdev->ngpios] = bdata->gpiod;
+		bdev->gpio_data[bdev->ngpios++] = bdata;
+	}
+
 	if (pdata->enable)
 		pdata->enable(bdev->dev);
 
-	gpio_keys_polled_queue_work(bdev);
+	gpio_keys_polled_queue_work(bdev, true);
 
 	return ret;
 }
@@ -8,6 +8,10 @@
  * is transferred as 3'b110 and a zero pulse is 3'b100. For this driver to
  * work properly, the SPI frequency should be 2.105MHz~2.85MHz and it needs
  * to transfer all the bytes continuously.
+ *
+ * Brightness changes only update the frame buffer. The whole chain is sent
+ * with spi_async() from a timer, at most max_fps times per second, so many
+ * LEDs changing at once result in a single transfer.
  */
 
 #include <linux/led-class-multicolor.h>
@@ -16,7 +20,9 @@
 #include <linux/of_device.h>
 #include <linux/property.h>
 #include <linux/spi/spi.h>
-#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/hrtimer.h>
+#include <linux/wait.h>
 #include <linux/version.h>
 
 #define WS2812B_BYTES_PER_COLOR 3
@@ -24,6 +30,10 @@
 /* A continuous 0 for 50us+ as the 'reset' signal */
 #define WS2812B_RESET_LEN 18
 
+static unsigned int max_fps = 60;
+module_param(max_fps, uint, 0644);
+MODULE_PARM_DESC(max_fps, "Maximum frames per second sent to the LED chain (0 = no limit)");
+
 struct ws2812b_led {
 	struct led_classdev_mc mc_cdev;
 	struct mc_subled subled[WS2812B_NUM_COLORS];
@@ -33,10 +43,23 @@ struct ws2812b_led {
 struct ws2812b_priv {
 	struct led_classdev ldev;
 	struct spi_device *spi;
-	struct mutex mutex;
+	spinlock_t lock;
 	int num_leds;
 	size_t data_len;
 	u8 *data_buf;
+
+	/* frame in flight, data_buf keeps taking updates meanwhile */
+	u8 *tx_buf;
+	struct spi_transfer xfer;
+	struct spi_message msg;
+	struct hrtimer timer;
+	wait_queue_head_t wq;
+	ktime_t last_tx;
+	bool dirty;
+	bool scheduled;
+	bool busy;
+	bool stopping;
+
 	struct ws2812b_led leds[];
 };
 
@@ -79,26 +102,104 @@ static void ws2812b_set_byte(struct ws2812b_priv *priv, size_t offset, u8 val)
 	p[2] = l3b[val & 0x7]; /* Bit 2-0 */
 }
 
-static int ws2812b_set(struct led_classdev *cdev,
-		       enum led_brightness brightness)
+/* Arm the timer for the next frame slot, called with priv->lock held */
+static void ws2812b_schedule(struct ws2812b_priv *priv)
+{
+	unsigned int fps = READ_ONCE(max_fps);
+	s64 period = fps ? NSEC_PER_SEC / fps : 0;
+	s64 delay;
+
+	if (priv->busy || priv->scheduled || priv->stopping)
+		return;
+
+	delay = period - ktime_to_ns(ktime_sub(ktime_get(), priv->last_tx));
+	priv->scheduled = true;
+	hrtimer_start(&priv->timer, ns_to_ktime(max_t(s64, delay, 0)),
+		      HRTIMER_MODE_REL_SOFT);
+}
+
+static void ws2812b_complete(void *context)
+{
+	struct ws2812b_priv *priv = context;
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	priv->busy = false;
+	if (priv->dirty)
+		ws2812b_schedule(priv);
+	/* under the lock, ws2812b_stop() may free priv once it sees !busy */
+	wake_up(&priv->wq);
+	spin_unlock_irqrestore(&priv->lock, flags);
+}
+
+static enum hrtimer_restart ws2812b_timer(struct hrtimer *timer)
+{
+	struct ws2812b_priv *priv =
+		container_of(timer, struct ws2812b_priv, timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	priv->scheduled = false;
+	if (!priv->dirty || priv->busy) {
+		spin_unlock_irqrestore(&priv->lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	memcpy(priv->tx_buf, priv->data_buf, priv->data_len);
+	priv->dirty = false;
+	priv->busy = true;
+	priv->last_tx = ktime_get();
+	spin_unlock_irqrestore(&priv->lock, flags);
+
+	if (spi_async(priv->spi, &priv->msg)) {
+		spin_lock_irqsave(&priv->lock, flags);
+		priv->busy = false;
+		wake_up(&priv->wq);
+		spin_unlock_irqrestore(&priv->lock, flags);
+	}
+
+	return HRTIMER_NORESTART;
+}
+
+static void ws2812b_set(struct led_classdev *cdev,
+			enum led_brightness brightness)
 {
 	struct led_classdev_mc *mc_cdev = lcdev_to_mccdev(cdev);
 	struct ws2812b_led *led =
 		container_of(mc_cdev, struct ws2812b_led, mc_cdev);
 	struct ws2812b_priv *priv = dev_get_drvdata(cdev->dev->parent);
-	int ret;
+	unsigned long flags;
 	int i;
 
 	led_mc_calc_color_components(mc_cdev, brightness);
 
-	mutex_lock(&priv->mutex);
+	spin_lock_irqsave(&priv->lock, flags);
 	for (i = 0; i < WS2812B_NUM_COLORS; i++)
 		ws2812b_set_byte(priv, led->cascade * WS2812B_NUM_COLORS + i,
 				 led->subled[i].brightness);
-	ret = spi_write(priv->spi, priv->data_buf, priv->data_len);
-	mutex_unlock(&priv->mutex);
+	priv->dirty = true;
+	ws2812b_schedule(priv);
+	spin_unlock_irqrestore(&priv->lock, flags);
+}
+
+/* Runs after the LEDs are unregistered, sends out their final state */
+static void ws2812b_stop(void *data)
+{
+	struct ws2812b_priv *priv = data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	priv->stopping = true;
+	spin_unlock_irqrestore(&priv->lock, flags);
+
+	hrtimer_cancel(&priv->timer);
 
-	return ret;
+	spin_lock_irq(&priv->lock);
+	wait_event_lock_irq(priv->wq, !priv->busy, priv->lock);
+	spin_unlock_irq(&priv->lock);
+
+	if (priv->dirty)
+		spi_write(priv->spi, priv->data_buf, priv->data_len);
 }
 
 static int ws2812b_probe(struct spi_device *spi)
@@ -119,17 +220,37 @@ static int ws2812b_probe(struct spi_device *spi)
 	priv->data_buf = devm_kzalloc(dev, priv->data_len, GFP_KERNEL);
 	if (!priv->data_buf)
 		return -ENOMEM;
+	priv->tx_buf = devm_kzalloc(dev, priv->data_len, GFP_KERNEL);
+	if (!priv->tx_buf)
+		return -ENOMEM;
 
 	for (i = 0; i < num_leds * WS2812B_NUM_COLORS; i++)
 		ws2812b_set_byte(priv, i, 0);
 
-	ret = devm_mutex_init(dev, &priv->mutex);
-	if (ret)
-		return ret;
+	spin_lock_init(&priv->lock);
+	init_waitqueue_head(&priv->wq);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+	hrtimer_setup(&priv->timer, ws2812b_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_REL_SOFT);
+#else
+	hrtimer_init(&priv->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	priv->timer.function = ws2812b_timer;
+#endif
+
+	priv->xfer.tx_buf = priv->tx_buf;
+	priv->xfer.len = priv->data_len;
+	spi_message_init_with_transfers(&priv->msg, &priv->xfer, 1);
+	priv->msg.complete = ws2812b_complete;
+	priv->msg.context = priv;
 
 	priv->num_leds = num_leds;
 	priv->spi = spi;
 
+	/* registered before the LEDs so that it runs after they are gone */
+	ret = devm_add_action_or_reset(dev, ws2812b_stop, priv);
+	if (ret)
+		return ret;
+
 	device_for_each_child_node_scoped(dev, led_node) {
 		struct led_init_data init_data = {
 			.fwnode = fwnode_handle_get(led_node),
@@ -163,7 +284,7 @@ static int ws2812b_probe(struct spi_device *spi)
 			priv->leds[cur_led].subled;
 		priv->leds[cur_led].mc_cdev.num_colors = WS2812B_NUM_COLORS;
 		priv->leds[cur_led].mc_cdev.led_cdev.max_brightness = 255;
-		priv->leds[cur_led].mc_cdev.led_cdev.brightness_set_blocking = ws2812b_set;
+		priv->leds[cur_led].mc_cdev.led_cdev.brightness_set = ws2812b_set;
 
 		for (i = 0; i < WS2812B_NUM_COLORS; i++) {
 			priv->leds[cur_led].subled[i].color_index = color_idx[i];
@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * trelay-xdp.c: XDP fast path for the Trivial Ethernet Relay
+ *
+ * Redirects frames between the two devices of a relay before an skb is
+ * allocated. EAPOL frames and frames for which no peer is configured are
+ * passed up the stack, where the trelay rx handler deals with them.
+ */
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+struct trelay_xdp_stats {
+	__u64 packets;
+	__u64 bytes;
+};
+
+/* ingress ifindex -> peer ifindex */
+struct {
+	__uint(type, BPF_MAP_TYPE_DEVMAP_HASH);
+	__uint(max_entries, 2);
+	__type(key, __u32);
+	__type(value, __u32);
+} peers SEC(".maps");
+
+/* ingress ifindex -> redirected frames */
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+	__uint(max_entries, 2);
+	__type(key, __u32);
+	__type(value, struct trelay_xdp_stats);
+} stats SEC(".maps");
+
+SEC("xdp")
+int trelay_xdp(struct xdp_md *ctx)
+{
+	void *data = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+	struct ethhdr *eth = data;
+	struct trelay_xdp_stats *st;
+	__u32 ifindex = ctx->ingress_ifindex;
+	long ret;
+
+	if ((void *)(eth + 1) > data_end)
+		return XDP_PASS;
+
+	if (eth->h_proto == bpf_htons(ETH_P_PAE))
+		return XDP_PASS;
+
+	ret = bpf_redirect_map(&peers, ifindex, XDP_PASS);
+	if (ret != XDP_REDIRECT)
+		return ret;
+
+	st = bpf_map_lookup_elem(&stats, &ifindex);
+	if (!st) {
+		struct trelay_xdp_stats init = {};
+
+		bpf_map_update_elem(&stats, &ifindex, &init, BPF_NOEXIST);
+		st = bpf_map_lookup_elem(&stats, &ifindex);
+		if (!st)
+			return ret;
+	}
+
+	st->packets++;
+	st->bytes += data_end - data;
+
+	return ret;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -15,10 +15,13 @@
  */
 #include <linux/module.h>
 #include <linux/list.h>
+#include <linux/kobject.h>
 #include <linux/mutex.h>
 #include <linux/netdevice.h>
 #include <linux/rtnetlink.h>
 #include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/u64_stats_sync.h>
 
 #define trelay_log(loglevel, tr, fmt, ...) \
 	printk(loglevel "trelay: %s <-> %s: " fmt "\n", \
@@ -27,9 +30,23 @@
 static LIST_HEAD(trelay_devs);
 static struct dentry *debugfs_dir;
 
+struct trelay_pcpu_stats {
+	u64_stats_t packets;
+	u64_stats_t bytes;
+	u64_stats_t dropped;
+	struct u64_stats_sync syncp;
+};
+
+/* one direction of the relay: frames received on dev are sent out on peer */
+struct trelay_port {
+	struct net_device *dev, *peer;
+	struct trelay_pcpu_stats __percpu *stats;
+};
+
 struct trelay {
 	struct list_head list;
 	struct net_device *dev1, *dev2;
+	struct trelay_port port[2];
 	struct dentry *debugfs;
 	int to_remove;
 	char name[];
@@ -37,30 +54,117 @@ struct trelay {
 
 static rx_handler_result_t trelay_handle_frame(struct sk_buff **pskb)
 {
-	struct net_device *dev;
+	struct trelay_pcpu_stats *stats;
+	struct trelay_port *port;
 	struct sk_buff *skb = *pskb;
+	unsigned int len;
+	int ret;
 
-	dev = rcu_dereference(skb->dev->rx_handler_data);
-	if (!dev)
+	port = rcu_dereference(skb->dev->rx_handler_data);
+	if (!port)
 		return RX_HANDLER_PASS;
 
 	if (skb->protocol == htons(ETH_P_PAE))
 		return RX_HANDLER_PASS;
 
 	skb_push(skb, ETH_HLEN);
-	skb->dev = dev;
+	skb->dev = port->peer;
 	skb_forward_csum(skb);
-	dev_queue_xmit(skb);
+	len = skb->len;
+
+	/*
+	 * The rx queue recorded by the driver is left in place, so that
+	 * skb_tx_hash() keeps the flow on the matching tx queue of the peer
+	 * instead of rehashing it.
+	 */
+	ret = dev_queue_xmit(skb);
+
+	stats = this_cpu_ptr(port->stats);
+	u64_stats_update_begin(&stats->syncp);
+	if (net_xmit_eval(ret)) {
+		u64_stats_inc(&stats->dropped);
+	} else {
+		u64_stats_inc(&stats->packets);
+		u64_stats_add(&stats->bytes, len);
+	}
+	u64_stats_update_end(&stats->syncp);
 
 	return RX_HANDLER_CONSUMED;
 }
 
+static void trelay_port_stats(struct trelay_port *port, u64 *packets,
+			      u64 *bytes, u64 *dropped)
+{
+	int cpu;
+
+	*packets = *bytes = *dropped = 0;
+	for_each_possible_cpu(cpu) {
+		struct trelay_pcpu_stats *stats = per_cpu_ptr(port->stats, cpu);
+		unsigned int start;
+		u64 p, b, d;
+
+		do {
+			start = u64_stats_fetch_begin(&stats->syncp);
+			p = u64_stats_read(&stats->packets);
+			b = u64_stats_read(&stats->bytes);
+			d = u64_stats_read(&stats->dropped);
+		} while (u64_stats_fetch_retry(&stats->syncp, start));
+
+		*packets += p;
+		*bytes += b;
+		*dropped += d;
+	}
+}
+
+static int trelay_stats_show(struct seq_file *s, void *unused)
+{
+	struct trelay *tr = s->private;
+	u64 packets, bytes, dropped;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tr->port); i++) {
+		struct trelay_port *port = &tr->port[i];
+
+		trelay_port_stats(port, &packets, &bytes, &dropped);
+		seq_printf(s, "%s -> %s: packets %llu bytes %llu dropped %llu\n",
+			   port->dev->name, port->peer->name,
+			   packets, bytes, dropped);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(trelay_stats);
+
+static void trelay_free(struct trelay *tr)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(tr->port); i++)
+		free_percpu(tr->port[i].stats);
+
+	kfree(tr);
+}
+
 static int trelay_open(struct inode *inode, struct file *file)
 {
 	file->private_data = inode->i_private;
 	return 0;
 }
 
+/*
+ * An XDP program attached by trelay-xdp keeps redirecting between the two
+ * devices after the relay is gone. Let the hotplug handler detach it.
+ */
+static void trelay_notify_remove(struct trelay *tr)
+{
+	char dev1[IFNAMSIZ + 12], dev2[IFNAMSIZ + 12];
+	char *envp[] = { dev1, dev2, NULL };
+
+	snprintf(dev1, sizeof(dev1), "TRELAY_DEV1=%s", tr->dev1->name);
+	snprintf(dev2, sizeof(dev2), "TRELAY_DEV2=%s", tr->dev2->name);
+	kobject_uevent_env(&tr->dev1->dev.kobj, KOBJ_CHANGE, envp);
+}
+
 static int trelay_do_remove(struct trelay *tr)
 {
 	list_del(&tr->list);
@@ -69,6 +173,8 @@ static int trelay_do_remove(struct trelay *tr)
 	 * to prevent dangling pointer in file->private_data */
 	debugfs_remove_recursive(tr->debugfs);
 
+	trelay_notify_remove(tr);
+
 	dev_put(tr->dev1);
 	dev_put(tr->dev2);
 
@@ -77,7 +183,7 @@ static int trelay_do_remove(struct trelay *tr)
 
 	trelay_log(KERN_INFO, tr, "stopped");
 
-	kfree(tr);
+	trelay_free(tr);
 
 	return 0;
 }
@@ -150,12 +256,20 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 {
 	struct net_device *dev1, *dev2;
 	struct trelay *tr, *tr1;
-	int ret;
+	int i, ret;
 
 	tr = kzalloc(struct_size(tr, name, strlen(name) + 1), GFP_KERNEL);
 	if (!tr)
 		return -ENOMEM;
 
+	for (i = 0; i < ARRAY_SIZE(tr->port); i++) {
+		tr->port[i].stats = netdev_alloc_pcpu_stats(struct trelay_pcpu_stats);
+		if (!tr->port[i].stats) {
+			trelay_free(tr);
+			return -ENOMEM;
+		}
+	}
+
 	rtnl_lock();
 	rcu_read_lock();
 
@@ -171,11 +285,16 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 	if (!dev1 || !dev2)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, dev2);
+	tr->port[0].dev = dev1;
+	tr->port[0].peer = dev2;
+	tr->port[1].dev = dev2;
+	tr->port[1].peer = dev1;
+
+	ret = netdev_rx_handler_register(dev1, trelay_handle_frame, &tr->port[0]);
 	if (ret < 0)
 		goto out;
 
-	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, dev1);
+	ret = netdev_rx_handler_register(dev2, trelay_handle_frame, &tr->port[1]);
 	if (ret < 0) {
 		netdev_rx_handler_unregister(dev1);
 		goto out;
@@ -193,13 +312,14 @@ static int trelay_do_add(char *name, char *devn1, char *devn2)
 
 	tr->debugfs = debugfs_create_dir(name, debugfs_dir);
 	debugfs_create_file("remove", S_IWUSR, tr->debugfs, tr, &fops_remove);
+	debugfs_create_file("stats", S_IRUSR, tr->debugfs, tr, &trelay_stats_fops);
 	ret = 0;
 
 out:
 	rcu_read_unlock();
 	rtnl_unlock();
 	if (ret < 0)
-		kfree(tr);
+		trelay_free(tr);
 
 	return ret;
 }
@@ -20,11 +20,14 @@
 #include <stdio.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#include <unistd.h>
 #include <libubus.h>
 #include <libubox/utils.h>
+#include <libubox/blobmsg_json.h>
 
 
 struct blob_attr *dump = NULL;
+static struct blob_buf b;
 
 enum {
 	DUMP_ATTR_INTERFACE,
@@ -187,230 +190,540 @@ static char *const token[] = {
 };
 
 
-int main(int argc, char *argv[])
+struct map_rule {
+	struct map_rule *next;
+	const char *str;
+	const char *iface;
+
+	bool lw4o6;
+	bool fmr;
+	bool need_pd;
+	int ealen;
+	int addr4len;
+	int prefix4len;
+	int prefix6len;
+	int pdlen;
+	int offset;
+	int psidlen;
+	int psid;
+	uint16_t psid16;
+	struct in_addr ipv4prefix;
+	struct in_addr ipv4addr;
+	struct in6_addr ipv6addr;
+	struct in6_addr ipv6prefix;
+	struct in6_addr pd;
+	const char *dmr;
+	const char *br;
+};
+
+/*
+ * Binary trie over the MAP rule IPv6 prefixes. A delegated prefix is matched
+ * against all rules by walking its bits once, instead of comparing it with
+ * every rule.
+ */
+struct rule_node {
+	struct rule_node *child[2];
+	struct map_rule *rules;
+};
+
+static struct rule_node rule_root;
+
+static int addr_bit(const struct in6_addr *addr, int bit)
 {
-	int status = 0;
-	const char *iface = argv[1];
+	return (addr->s6_addr[bit / 8] >> (7 - bit % 8)) & 1;
+}
 
-	const char *legacy_env = getenv("LEGACY");
-	bool legacy = legacy_env && atoi(legacy_env);
+static void rule_trie_add(struct map_rule *rule)
+{
+	struct rule_node *node = &rule_root;
 
+	for (int i = 0; i < rule->prefix6len; ++i) {
+		struct rule_node **child = &node->child[addr_bit(&rule->ipv6prefix, i)];
 
-	if (argc < 3) {
-		fprintf(stderr, "Usage: %s <interface|*> <rule1> [rule2] [...]\n", argv[0]);
-		return 1;
-	}
+		if (!*child)
+			*child = calloc(1, sizeof(**child));
+		if (!*child)
+			return;
 
-	uint32_t network_interface;
-	struct ubus_context *ubus = ubus_connect(NULL);
-	if (ubus) {
-		ubus_lookup_id(ubus, "network.interface", &network_interface);
-		ubus_invoke(ubus, network_interface, "dump", NULL, handle_dump, NULL, 5000);
+		node = *child;
 	}
 
-	int rulecnt = 0;
-	for (int i = 2; i < argc; ++i) {
-		bool lw4o6 = false;
-		bool fmr = false;
-		int ealen = -1;
-		int addr4len = 32;
-		int prefix4len = 32;
-		int prefix6len = -1;
-		int pdlen = -1;
-		struct in_addr ipv4prefix = {INADDR_ANY};
-		struct in_addr ipv4addr = {INADDR_ANY};
-		struct in6_addr ipv6addr = IN6ADDR_ANY_INIT;
-		struct in6_addr ipv6prefix = IN6ADDR_ANY_INIT;
-		struct in6_addr pd = IN6ADDR_ANY_INIT;
-		int offset = -1;
-		int psidlen = -1;
-		int psid = -1;
-		uint16_t psid16 = 0;
-		const char *dmr = NULL;
-		const char *br = NULL;
-
-		for (char *rule = strdup(argv[i]); *rule; ) {
-			char *value;
-			int intval;
-			int idx = getsubopt(&rule, token, &value);
-			errno = 0;
-
-			if (idx == OPT_TYPE) {
-				lw4o6 = (value && !strcmp(value, "lw4o6"));
-			} else if (idx == OPT_FMR) {
-				fmr = true;
-			} else if (idx == OPT_EALEN && (intval = strtoul(value, NULL, 0)) <= 48 && !errno) {
-				ealen = intval;
-			} else if (idx == OPT_PREFIX4LEN && (intval = strtoul(value, NULL, 0)) <= 32 && !errno) {
-				prefix4len = intval;
-			} else if (idx == OPT_PREFIX6LEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
-				prefix6len = intval;
-			} else if (idx == OPT_IPV4PREFIX && inet_pton(AF_INET, value, &ipv4prefix) == 1) {
-				// dummy
-			} else if (idx == OPT_IPV6PREFIX && inet_pton(AF_INET6, value, &ipv6prefix) == 1) {
-				// dummy
-			} else if (idx == OPT_PD && inet_pton(AF_INET6, value, &pd) == 1) {
-				// dummy
-			} else if (idx == OPT_OFFSET && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
-				offset = intval;
-			} else if (idx == OPT_PSIDLEN && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
-				psidlen = intval;
-			} else if (idx == OPT_PDLEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
-				pdlen = intval;
-			} else if (idx == OPT_PSID && (intval = strtoul(value, NULL, 0)) <= 65535 && !errno) {
-				psid = intval;
-			} else if (idx == OPT_DMR) {
-				dmr = value;
-			} else if (idx == OPT_BR) {
-				br = value;
-			} else {
-				if (idx == -1 || idx >= OPT_MAX)
-					fprintf(stderr, "Skipped invalid option: %s\n", value);
-				else
-					fprintf(stderr, "Skipped invalid value %s for option %s\n",
-							value, token[idx]);
+	rule->next = node->rules;
+	node->rules = rule;
+}
+
+/* Assign a delegated prefix to all rules covering it */
+static void rule_trie_match(const struct in6_addr *prefix, int mask, const char *iface)
+{
+	struct rule_node *node = &rule_root;
+
+	for (int i = 0; node; ++i) {
+		for (struct map_rule *rule = node->rules; rule; rule = rule->next) {
+			// first interface with a match wins, longest prefix inside it
+			if (rule->iface && rule->iface != iface)
+				continue;
+
+			if (rule->pdlen < mask) {
+				bmemcpy(&rule->pd, prefix, mask);
+				rule->pdlen = mask;
+				rule->iface = iface;
 			}
 		}
 
-		if (offset < 0)
-			offset = (lw4o6) ? 0 : (legacy) ? 4 : 6;
+		if (i >= mask)
+			break;
 
-		// LW4over6 doesn't have an EALEN and has no psid-autodetect
-		if (lw4o6) {
-			if (psidlen < 0)
-				psidlen = 0;
+		node = node->child[addr_bit(prefix, i)];
+	}
+}
 
-			ealen = psidlen;
-		}
+static void match_prefixes(struct blob_attr *cur, const char *iface)
+{
+	struct blob_attr *d;
+	unsigned drem;
 
-		// Find PD
-		if (pdlen < 0) {
-			struct blob_attr *c;
-			unsigned rem;
-			blobmsg_for_each_attr(c, dump, rem) {
-				struct blob_attr *tb[IFACE_ATTR_MAX];
-				blobmsg_parse(iface_attrs, IFACE_ATTR_MAX, tb, blobmsg_data(c), blobmsg_data_len(c));
+	if (!cur || blobmsg_type(cur) != BLOBMSG_TYPE_ARRAY || !blobmsg_check_attr(cur, false))
+		return;
 
-				if (!tb[IFACE_ATTR_INTERFACE] || (strcmp(argv[1], "*") && strcmp(argv[1],
-						blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]))))
-					continue;
+	blobmsg_for_each_attr(d, cur, drem) {
+		struct blob_attr *ptb[PREFIX_ATTR_MAX];
+		blobmsg_parse(prefix_attrs, PREFIX_ATTR_MAX, ptb,
+				blobmsg_data(d), blobmsg_data_len(d));
 
-				match_prefix(&pdlen, &pd, tb[IFACE_ATTR_PREFIX], &ipv6prefix, prefix6len, lw4o6);
+		if (!ptb[PREFIX_ATTR_ADDRESS] || !ptb[PREFIX_ATTR_MASK])
+			continue;
 
-				if (lw4o6)
-					match_prefix(&pdlen, &pd, tb[IFACE_ATTR_ADDRESS], &ipv6prefix, prefix6len, lw4o6);
+		struct in6_addr prefix = IN6ADDR_ANY_INIT;
+		int mask = blobmsg_get_u32(ptb[PREFIX_ATTR_MASK]);
+		if (mask > 128 || inet_pton(AF_INET6,
+				blobmsg_get_string(ptb[PREFIX_ATTR_ADDRESS]), &prefix) != 1)
+			continue;
 
-				if (pdlen >= 0) {
-					iface = blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]);
-					break;
-				}
-			}
-		}
+		rule_trie_match(&prefix, mask, iface);
+	}
+}
 
-		if (ealen < 0 && pdlen >= 0)
-			ealen = pdlen - prefix6len;
+static void find_pd(struct map_rule *rules, int rulecnt, const char *filter)
+{
+	struct blob_attr *c;
+	unsigned rem;
 
-		if (psidlen <= 0) {
-			psidlen = ealen - (32 - prefix4len);
-			if (psidlen < 0)
-				psidlen = 0;
+	for (int i = 0; i < rulecnt; ++i)
+		if (rules[i].need_pd && !rules[i].lw4o6 && rules[i].prefix6len >= 0)
+			rule_trie_add(&rules[i]);
 
-			psid = -1;
-		}
+	blobmsg_for_each_attr(c, dump, rem) {
+		struct blob_attr *tb[IFACE_ATTR_MAX];
+		blobmsg_parse(iface_attrs, IFACE_ATTR_MAX, tb, blobmsg_data(c), blobmsg_data_len(c));
 
-		if (prefix4len < 0 || prefix6len < 0 || ealen < 0 || psidlen > 16 || ealen < psidlen) {
-			fprintf(stderr, "Skipping invalid or incomplete rule: %s\n", argv[i]);
-			status = 1;
+		if (!tb[IFACE_ATTR_INTERFACE] || (strcmp(filter, "*") && strcmp(filter,
+				blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]))))
 			continue;
+
+		const char *iface = blobmsg_get_string(tb[IFACE_ATTR_INTERFACE]);
+		match_prefixes(tb[IFACE_ATTR_PREFIX], iface);
+
+		// lw4o6 also matches addresses and shorter prefixes, check these one by one
+		for (int i = 0; i < rulecnt; ++i) {
+			struct map_rule *rule = &rules[i];
+
+			if (!rule->need_pd || !rule->lw4o6 || rule->pdlen >= 0)
+				continue;
+
+			match_prefix(&rule->pdlen, &rule->pd, tb[IFACE_ATTR_PREFIX],
+					&rule->ipv6prefix, rule->prefix6len, true);
+			match_prefix(&rule->pdlen, &rule->pd, tb[IFACE_ATTR_ADDRESS],
+					&rule->ipv6prefix, rule->prefix6len, true);
+
+			if (rule->pdlen >= 0)
+				rule->iface = iface;
 		}
+	}
+}
 
-		if (psid < 0 && psidlen >= 0 && pdlen >= 0) {
-			bmemcpys64(&psid16, &pd, prefix6len + ealen - psidlen, psidlen);
-			psid = be16_to_cpu(psid16);
+static void parse_rule(struct map_rule *rule, const char *str, bool legacy)
+{
+	*rule = (struct map_rule) {
+		.str = str,
+		.ealen = -1,
+		.addr4len = 32,
+		.prefix4len = 32,
+		.prefix6len = -1,
+		.pdlen = -1,
+		.offset = -1,
+		.psidlen = -1,
+		.psid = -1,
+		.ipv4prefix = {INADDR_ANY},
+		.ipv4addr = {INADDR_ANY},
+		.ipv6addr = IN6ADDR_ANY_INIT,
+		.ipv6prefix = IN6ADDR_ANY_INIT,
+		.pd = IN6ADDR_ANY_INIT,
+	};
+
+	for (char *opts = strdup(str); opts && *opts; ) {
+		char *value;
+		int intval;
+		int idx = getsubopt(&opts, token, &value);
+		errno = 0;
+
+		if (idx == OPT_TYPE) {
+			rule->lw4o6 = (value && !strcmp(value, "lw4o6"));
+		} else if (idx == OPT_FMR) {
+			rule->fmr = true;
+		} else if (idx == OPT_EALEN && (intval = strtoul(value, NULL, 0)) <= 48 && !errno) {
+			rule->ealen = intval;
+		} else if (idx == OPT_PREFIX4LEN && (intval = strtoul(value, NULL, 0)) <= 32 && !errno) {
+			rule->prefix4len = intval;
+		} else if (idx == OPT_PREFIX6LEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
+			rule->prefix6len = intval;
+		} else if (idx == OPT_IPV4PREFIX && inet_pton(AF_INET, value, &rule->ipv4prefix) == 1) {
+			// dummy
+		} else if (idx == OPT_IPV6PREFIX && inet_pton(AF_INET6, value, &rule->ipv6prefix) == 1) {
+			// dummy
+		} else if (idx == OPT_PD && inet_pton(AF_INET6, value, &rule->pd) == 1) {
+			// dummy
+		} else if (idx == OPT_OFFSET && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
+			rule->offset = intval;
+		} else if (idx == OPT_PSIDLEN && (intval = strtoul(value, NULL, 0)) <= 16 && !errno) {
+			rule->psidlen = intval;
+		} else if (idx == OPT_PDLEN && (intval = strtoul(value, NULL, 0)) <= 128 && !errno) {
+			rule->pdlen = intval;
+		} else if (idx == OPT_PSID && (intval = strtoul(value, NULL, 0)) <= 65535 && !errno) {
+			rule->psid = intval;
+		} else if (idx == OPT_DMR) {
+			rule->dmr = value;
+		} else if (idx == OPT_BR) {
+			rule->br = value;
+		} else {
+			if (idx == -1 || idx >= OPT_MAX)
+				fprintf(stderr, "Skipped invalid option: %s\n", value);
+			else
+				fprintf(stderr, "Skipped invalid value %s for option %s\n",
+						value, token[idx]);
 		}
+	}
+
+	if (rule->offset < 0)
+		rule->offset = (rule->lw4o6) ? 0 : (legacy) ? 4 : 6;
+
+	// LW4over6 doesn't have an EALEN and has no psid-autodetect
+	if (rule->lw4o6) {
+		if (rule->psidlen < 0)
+			rule->psidlen = 0;
+
+		rule->ealen = rule->psidlen;
+	}
+
+	rule->need_pd = rule->pdlen < 0;
+}
+
+static bool calc_rule(struct map_rule *rule, bool legacy)
+{
+	if (rule->ealen < 0 && rule->pdlen >= 0)
+		rule->ealen = rule->pdlen - rule->prefix6len;
+
+	if (rule->psidlen <= 0) {
+		rule->psidlen = rule->ealen - (32 - rule->prefix4len);
+		if (rule->psidlen < 0)
+			rule->psidlen = 0;
+
+		rule->psid = -1;
+	}
+
+	if (rule->prefix4len < 0 || rule->prefix6len < 0 || rule->ealen < 0 || rule->ealen > 48 ||
+			rule->psidlen > 16 || rule->ealen < rule->psidlen) {
+		fprintf(stderr, "Skipping invalid or incomplete rule: %s\n", rule->str);
+		return false;
+	}
+
+	if (rule->psid < 0 && rule->psidlen >= 0 && rule->pdlen >= 0) {
+		bmemcpys64(&rule->psid16, &rule->pd,
+				rule->prefix6len + rule->ealen - rule->psidlen, rule->psidlen);
+		rule->psid = be16_to_cpu(rule->psid16);
+	}
 
-		if (psidlen > 0) {
-			psid = psid >> (16 - psidlen);
-			psid16 = cpu_to_be16(psid);
-			psid = psid << (16 - psidlen);
+	if (rule->psidlen > 0) {
+		rule->psid = rule->psid >> (16 - rule->psidlen);
+		rule->psid16 = cpu_to_be16(rule->psid);
+		rule->psid = rule->psid << (16 - rule->psidlen);
+	}
+
+	if (rule->pdlen >= 0 || rule->ealen == rule->psidlen) {
+		bmemcpys64(&rule->ipv4addr, &rule->pd, rule->prefix6len,
+				rule->ealen - rule->psidlen);
+		rule->ipv4addr.s_addr = htonl(ntohl(rule->ipv4addr.s_addr) >> rule->prefix4len);
+		bmemcpy(&rule->ipv4addr, &rule->ipv4prefix, rule->prefix4len);
+
+		if (rule->prefix4len + rule->ealen < 32)
+			rule->addr4len = rule->prefix4len + rule->ealen;
+	}
+
+	if (rule->pdlen < 0 && !rule->fmr) {
+		fprintf(stderr, "Skipping non-FMR without matching PD: %s\n", rule->str);
+		return false;
+	} else if (rule->pdlen >= 0) {
+		size_t v4offset = (legacy) ? 9 : 10;
+		memcpy(&rule->ipv6addr.s6_addr[v4offset], &rule->ipv4addr, 4);
+		memcpy(&rule->ipv6addr.s6_addr[v4offset + 4], &rule->psid16, 2);
+		bmemcpy(&rule->ipv6addr, &rule->pd, rule->pdlen);
+	}
+
+	return true;
+}
+
+static bool rule_portset(const struct map_rule *rule, int k, int *start, int *end)
+{
+	*start = (k << (16 - rule->offset)) | (rule->psid >> rule->offset);
+	*end = *start + (1 << (16 - rule->offset - rule->psidlen)) - 1;
+
+	if (*start == 0)
+		*start = 1;
+
+	return *start <= *end;
+}
+
+static void print_rule(const struct map_rule *rule, int idx)
+{
+	char ipv4addrbuf[INET_ADDRSTRLEN];
+	char ipv4prefixbuf[INET_ADDRSTRLEN];
+	char ipv6prefixbuf[INET6_ADDRSTRLEN];
+	char ipv6addrbuf[INET6_ADDRSTRLEN];
+	char pdbuf[INET6_ADDRSTRLEN];
+
+	inet_ntop(AF_INET, &rule->ipv4addr, ipv4addrbuf, sizeof(ipv4addrbuf));
+	inet_ntop(AF_INET, &rule->ipv4prefix, ipv4prefixbuf, sizeof(ipv4prefixbuf));
+	inet_ntop(AF_INET6, &rule->ipv6prefix, ipv6prefixbuf, sizeof(ipv6prefixbuf));
+	inet_ntop(AF_INET6, &rule->ipv6addr, ipv6addrbuf, sizeof(ipv6addrbuf));
+	inet_ntop(AF_INET6, &rule->pd, pdbuf, sizeof(pdbuf));
+
+	printf("RULE_%d_FMR=%d\n", idx, rule->fmr);
+	printf("RULE_%d_EALEN=%d\n", idx, rule->ealen);
+	printf("RULE_%d_PSIDLEN=%d\n", idx, rule->psidlen);
+	printf("RULE_%d_OFFSET=%d\n", idx, rule->offset);
+	printf("RULE_%d_PREFIX4LEN=%d\n", idx, rule->prefix4len);
+	printf("RULE_%d_PREFIX6LEN=%d\n", idx, rule->prefix6len);
+	printf("RULE_%d_IPV4PREFIX=%s\n", idx, ipv4prefixbuf);
+	printf("RULE_%d_IPV6PREFIX=%s\n", idx, ipv6prefixbuf);
+
+	if (rule->pdlen >= 0) {
+		printf("RULE_%d_IPV6PD=%s\n", idx, pdbuf);
+		printf("RULE_%d_PD6LEN=%d\n", idx, rule->pdlen);
+		printf("RULE_%d_PD6IFACE=%s\n", idx, rule->iface);
+		printf("RULE_%d_IPV6ADDR=%s\n", idx, ipv6addrbuf);
+		printf("RULE_BMR=%d\n", idx);
+	}
+
+	if (rule->ipv4addr.s_addr) {
+		printf("RULE_%d_IPV4ADDR=%s\n", idx, ipv4addrbuf);
+		printf("RULE_%d_ADDR4LEN=%d\n", idx, rule->addr4len);
+	}
+
+
+	if (rule->psidlen > 0 && rule->psid >= 0) {
+		printf("RULE_%d_PORTSETS='", idx);
+		for (int k = (rule->offset) ? 1 : 0; k < (1 << rule->offset); ++k) {
+			int start, end;
+
+			if (rule_portset(rule, k, &start, &end))
+				printf("%d-%d ", start, end);
 		}
+		printf("'\n");
+	}
+
+	if (rule->dmr)
+		printf("RULE_%d_DMR=%s\n", idx, rule->dmr);
+
+	if (rule->br)
+		printf("RULE_%d_BR=%s\n", idx, rule->br);
+}
+
+static void add_addr(const char *name, int af, const void *addr)
+{
+	char *buf = blobmsg_alloc_string_buffer(&b, name, INET6_ADDRSTRLEN);
+
+	inet_ntop(af, addr, buf, INET6_ADDRSTRLEN);
+	blobmsg_add_string_buffer(&b);
+}
+
+static void add_rule_json(const struct map_rule *rule)
+{
+	void *t = blobmsg_open_table(&b, NULL);
+
+	blobmsg_add_string(&b, "rule", rule->str);
+	blobmsg_add_u8(&b, "fmr", rule->fmr);
+	blobmsg_add_u32(&b, "ealen", rule->ealen);
+	blobmsg_add_u32(&b, "psidlen", rule->psidlen);
+	blobmsg_add_u32(&b, "offset", rule->offset);
+	blobmsg_add_u32(&b, "prefix4len", rule->prefix4len);
+	blobmsg_add_u32(&b, "prefix6len", rule->prefix6len);
+	add_addr("ipv4prefix", AF_INET, &rule->ipv4prefix);
+	add_addr("ipv6prefix", AF_INET6, &rule->ipv6prefix);
+
+	if (rule->pdlen >= 0) {
+		add_addr("ipv6pd", AF_INET6, &rule->pd);
+		blobmsg_add_u32(&b, "pd6len", rule->pdlen);
+		blobmsg_add_string(&b, "pd6iface", rule->iface);
+		add_addr("ipv6addr", AF_INET6, &rule->ipv6addr);
+	}
+
+	if (rule->ipv4addr.s_addr) {
+		add_addr("ipv4addr", AF_INET, &rule->ipv4addr);
+		blobmsg_add_u32(&b, "addr4len", rule->addr4len);
+	}
+
+	if (rule->psidlen > 0 && rule->psid >= 0) {
+		blobmsg_add_u32(&b, "psid", rule->psid >> (16 - rule->psidlen));
 
-		if (pdlen >= 0 || ealen == psidlen) {
-			bmemcpys64(&ipv4addr, &pd, prefix6len, ealen - psidlen);
-			ipv4addr.s_addr = htonl(ntohl(ipv4addr.s_addr) >> prefix4len);
-			bmemcpy(&ipv4addr, &ipv4prefix, prefix4len);
+		void *a = blobmsg_open_array(&b, "portsets");
+		for (int k = (rule->offset) ? 1 : 0; k < (1 << rule->offset); ++k) {
+			int start, end;
 
-			if (prefix4len + ealen < 32)
-				addr4len = prefix4len + ealen;
+			if (rule_portset(rule, k, &start, &end))
+				blobmsg_printf(&b, NULL, "%d-%d", start, end);
 		}
+		blobmsg_close_array(&b, a);
+	}
 
-		if (pdlen < 0 && !fmr) {
-			fprintf(stderr, "Skipping non-FMR without matching PD: %s\n", argv[i]);
-			status = 1;
+	if (rule->dmr)
+		blobmsg_add_string(&b, "dmr", rule->dmr);
+
+	if (rule->br)
+		blobmsg_add_string(&b, "br", rule->br);
+
+	blobmsg_close_table(&b, t);
+}
+
+static int add_rule(struct map_rule **rules, int *rulecnt, const char *str, bool legacy)
+{
+	struct map_rule *new_rules = realloc(*rules, (*rulecnt + 1) * sizeof(**rules));
+
+	if (!new_rules)
+		return -1;
+
+	*rules = new_rules;
+	parse_rule(&new_rules[(*rulecnt)++], str, legacy);
+
+	return 0;
+}
+
+/* Batch mode: one rule per line, e.g. a full set of BMRs/FMRs from DHCPv6 */
+static int read_rules(struct map_rule **rules, int *rulecnt, FILE *f, bool legacy)
+{
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t n;
+
+	while ((n = getline(&line, &len, f)) >= 0) {
+		while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r' || line[n - 1] == ' '))
+			line[--n] = 0;
+
+		if (!n || line[0] == '#')
 			continue;
-		} else if (pdlen >= 0) {
-			size_t v4offset = (legacy) ? 9 : 10;
-			memcpy(&ipv6addr.s6_addr[v4offset], &ipv4addr, 4);
-			memcpy(&ipv6addr.s6_addr[v4offset + 4], &psid16, 2);
-			bmemcpy(&ipv6addr, &pd, pdlen);
-		}
 
-		++rulecnt;
-		char ipv4addrbuf[INET_ADDRSTRLEN];
-		char ipv4prefixbuf[INET_ADDRSTRLEN];
-		char ipv6prefixbuf[INET6_ADDRSTRLEN];
-		char ipv6addrbuf[INET6_ADDRSTRLEN];
-		char pdbuf[INET6_ADDRSTRLEN];
-
-		inet_ntop(AF_INET, &ipv4addr, ipv4addrbuf, sizeof(ipv4addrbuf));
-		inet_ntop(AF_INET, &ipv4prefix, ipv4prefixbuf, sizeof(ipv4prefixbuf));
-		inet_ntop(AF_INET6, &ipv6prefix, ipv6prefixbuf, sizeof(ipv6prefixbuf));
-		inet_ntop(AF_INET6, &ipv6addr, ipv6addrbuf, sizeof(ipv6addrbuf));
-		inet_ntop(AF_INET6, &pd, pdbuf, sizeof(pdbuf));
-
-		printf("RULE_%d_FMR=%d\n", rulecnt, fmr);
-		printf("RULE_%d_EALEN=%d\n", rulecnt, ealen);
-		printf("RULE_%d_PSIDLEN=%d\n", rulecnt, psidlen);
-		printf("RULE_%d_OFFSET=%d\n", rulecnt, offset);
-		printf("RULE_%d_PREFIX4LEN=%d\n", rulecnt, prefix4len);
-		printf("RULE_%d_PREFIX6LEN=%d\n", rulecnt, prefix6len);
-		printf("RULE_%d_IPV4PREFIX=%s\n", rulecnt, ipv4prefixbuf);
-		printf("RULE_%d_IPV6PREFIX=%s\n", rulecnt, ipv6prefixbuf);
-
-		if (pdlen >= 0) {
-			printf("RULE_%d_IPV6PD=%s\n", rulecnt, pdbuf);
-			printf("RULE_%d_PD6LEN=%d\n", rulecnt, pdlen);
-			printf("RULE_%d_PD6IFACE=%s\n", rulecnt, iface);
-			printf("RULE_%d_IPV6ADDR=%s\n", rulecnt, ipv6addrbuf);
-			printf("RULE_BMR=%d\n", rulecnt);
+		if (add_rule(rules, rulecnt, strdup(line), legacy))
+			return -1;
+	}
+
+	free(line);
+	return 0;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-j] <interface|*> <rule1|-> [rule2] [...]\n"
+			"\t-j\tOutput rules as JSON\n"
+			"\t-\tRead rules from stdin, one per line\n", prog);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int status = 0;
+	bool json = false;
+	int ch;
+
+	const char *legacy_env = getenv("LEGACY");
+	bool legacy = legacy_env && atoi(legacy_env);
+
+	while ((ch = getopt(argc, argv, "j")) != -1) {
+		switch (ch) {
+		case 'j':
+			json = true;
+			break;
+		default:
+			return usage(argv[0]);
 		}
+	}
+
+	if (argc - optind < 2)
+		return usage(argv[0]);
+
+	const char *filter = argv[optind];
+	struct map_rule *rules = NULL;
+	int nrules = 0;
+
+	for (int i = optind + 1; i < argc; ++i) {
+		int ret = strcmp(argv[i], "-") ?
+			add_rule(&rules, &nrules, argv[i], legacy) :
+			read_rules(&rules, &nrules, stdin, legacy);
 
-		if (ipv4addr.s_addr) {
-			printf("RULE_%d_IPV4ADDR=%s\n", rulecnt, ipv4addrbuf);
-			printf("RULE_%d_ADDR4LEN=%d\n", rulecnt, addr4len);
+		if (ret) {
+			fprintf(stderr, "Failed to read rules: %s\n", strerror(errno));
+			return 1;
 		}
+	}
 
+	uint32_t network_interface;
+	struct ubus_context *ubus = ubus_connect(NULL);
+	if (ubus) {
+		ubus_lookup_id(ubus, "network.interface", &network_interface);
+		ubus_invoke(ubus, network_interface, "dump", NULL, handle_dump, NULL, 5000);
+	}
 
-		if (psidlen > 0 && psid >= 0) {
-			printf("RULE_%d_PORTSETS='", rulecnt);
-			for (int k = (offset) ? 1 : 0; k < (1 << offset); ++k) {
-				int start = (k << (16 - offset)) | (psid >> offset);
-				int end = start + (1 << (16 - offset - psidlen)) - 1;
+	// the interface dump is walked once for all rules that need a PD
+	find_pd(rules, nrules, filter);
 
-				if (start == 0)
-					start = 1;
+	void *a = NULL;
+	int rulecnt = 0;
+	int bmr = 0;
 
-				if (start <= end)
-					printf("%d-%d ", start, end);
-			}
-			printf("'\n");
+	if (json) {
+		blob_buf_init(&b, 0);
+		a = blobmsg_open_array(&b, "rules");
+	}
+
+	for (int i = 0; i < nrules; ++i) {
+		struct map_rule *rule = &rules[i];
+
+		if (!rule->iface)
+			rule->iface = filter;
+
+		if (!calc_rule(rule, legacy)) {
+			status = 1;
+			continue;
 		}
 
-		if (dmr)
-			printf("RULE_%d_DMR=%s\n", rulecnt, dmr);
+		++rulecnt;
+		if (rule->pdlen >= 0)
+			bmr = rulecnt;
+
+		if (json)
+			add_rule_json(rule);
+		else
+			print_rule(rule, rulecnt);
+	}
+
+	if (json) {
+		blobmsg_close_array(&b, a);
+		if (bmr)
+			blobmsg_add_u32(&b, "bmr", bmr);
+
+		char *str = blobmsg_format_json(b.head, true);
+		if (str)
+			printf("%s\n", str);
 
-		if (br)
-			printf("RULE_%d_BR=%s\n", rulecnt, br);
+		free(str);
+		return status;
 	}
 
 	printf("RULE_COUNT=%d\n", rulecnt);
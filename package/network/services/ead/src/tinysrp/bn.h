@@ -74,7 +74,7 @@ extern "C" {
 #undef BN_SQR_COMBA
 #undef BN_RECURSION
 #undef RECP_MUL_MOD
-#undef MONT_MUL_MOD
+#define MONT_MUL_MOD
 
 #if defined(SIZEOF_LONG_LONG) && SIZEOF_LONG_LONG == 8
 # if SIZEOF_LONG == 4
@@ -0,0 +1,331 @@
+/* crypto/bn/bn_mont.c */
+/*
+ * Word based Montgomery arithmetic and fixed window modular exponentiation.
+ *
+ * All operands are kept at the word size of the modulus, the final
+ * subtraction of the reduction is done with a mask and the exponent is
+ * processed in windows of fixed size, with the table entry read by a full
+ * scan.  The sequence of operations and memory accesses only depends on the
+ * sizes of the operands, not on the secret exponent.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bn_lcl.h"
+
+#define MONT_MAX_WINDOW	6
+
+void BN_MONT_CTX_init(BN_MONT_CTX *ctx)
+	{
+	ctx->ri=0;
+	BN_init(&(ctx->RR));
+	BN_init(&(ctx->N));
+	BN_init(&(ctx->Ni));
+	ctx->n0=0;
+	ctx->flags=0;
+	}
+
+BN_MONT_CTX *BN_MONT_CTX_new(void)
+	{
+	BN_MONT_CTX *ret;
+
+	if ((ret=(BN_MONT_CTX *)malloc(sizeof(BN_MONT_CTX))) == NULL)
+		return(NULL);
+
+	BN_MONT_CTX_init(ret);
+	ret->flags=BN_FLG_MALLOCED;
+	return(ret);
+	}
+
+void BN_MONT_CTX_free(BN_MONT_CTX *mont)
+	{
+	if(mont == NULL)
+	    return;
+
+	BN_free(&(mont->RR));
+	BN_free(&(mont->N));
+	BN_free(&(mont->Ni));
+	if (mont->flags & BN_FLG_MALLOCED)
+		free(mont);
+	}
+
+/* -N^-1 mod 2^BN_BITS2, each Newton step doubles the number of valid bits */
+static BN_ULONG bn_mont_n0(BN_ULONG n)
+	{
+	BN_ULONG inv=n;	/* n*n == 1 mod 8 for odd n */
+	int i;
+
+	for (i=3; i<BN_BITS2; i<<=1)
+		inv=(inv*(2-n*inv))&BN_MASK2;
+
+	return((0-inv)&BN_MASK2);
+	}
+
+int BN_MONT_CTX_set(BN_MONT_CTX *mont, const BIGNUM *mod, BN_CTX *ctx)
+	{
+	if (!BN_is_odd(mod))
+		return(0);
+
+	if (BN_copy(&(mont->N),mod) == NULL)
+		return(0);
+
+	mont->N.neg=0;
+	mont->ri=mod->top*BN_BITS2;
+	mont->n0=bn_mont_n0(mod->d[0]);
+
+	/* setup RR for conversions */
+	if (!BN_one(&(mont->RR))) return(0);
+	if (!BN_lshift(&(mont->RR),&(mont->RR),mont->ri*2)) return(0);
+	if (!BN_mod(&(mont->RR),&(mont->RR),&(mont->N),ctx)) return(0);
+
+	return(1);
+	}
+
+/* rp = ap - bp, returns the borrow */
+static BN_ULONG bn_mont_sub_words(BN_ULONG *rp, const BN_ULONG *ap,
+	const BN_ULONG *bp, int num)
+	{
+	BN_ULONG t1,t2,c=0;
+	int i;
+
+	for (i=0; i<num; i++)
+		{
+		t1=ap[i];
+		t2=bp[i];
+		rp[i]=(t1-t2-c)&BN_MASK2;
+		c=(t1 < t2) | ((t1 == t2) & c);
+		}
+
+	return(c);
+	}
+
+/*
+ * Reduce the 2*num word value in tp (which must be < N*R) into rp,
+ * tp is clobbered.
+ */
+static void bn_mont_reduce(BN_ULONG *rp, BN_ULONG *tp, const BN_MONT_CTX *mont)
+	{
+	BN_ULONG *np=mont->N.d;
+	BN_ULONG v,x,carry=0,c1,c2,mask;
+	int num=mont->N.top;
+	int i;
+
+	for (i=0; i<num; i++)
+		{
+		v=bn_mul_add_words(&(tp[i]),np,num,(tp[i]*mont->n0)&BN_MASK2);
+		v=(v+carry)&BN_MASK2;
+		c1=(v < carry);
+		x=(tp[i+num]+v)&BN_MASK2;
+		c2=(x < v);
+		tp[i+num]=x;
+		carry=c1|c2;
+		}
+
+	/* the result is < 2N, subtract N unless that borrows past carry */
+	v=bn_mont_sub_words(rp,&(tp[num]),np,num);
+	mask=0-(v&(carry^1));
+	for (i=0; i<num; i++)
+		rp[i]=(tp[i+num]&mask)|(rp[i]&~mask);
+	}
+
+/* rp = ap*bp*R^-1 mod N, tp needs room for 2*num words */
+static void bn_mont_mul_words(BN_ULONG *rp, BN_ULONG *ap, BN_ULONG *bp,
+	BN_ULONG *tp, const BN_MONT_CTX *mont)
+	{
+	int num=mont->N.top;
+	int i;
+
+	memset(tp,0,2*num*sizeof(BN_ULONG));
+	for (i=0; i<num; i++)
+		tp[i+num]=bn_mul_add_words(&(tp[i]),bp,num,ap[i]);
+
+	bn_mont_reduce(rp,tp,mont);
+	}
+
+/* copy a into num words, zero padded */
+static int bn_mont_load(BN_ULONG *rp, const BIGNUM *a, int num)
+	{
+	if (a->top > num)
+		return(0);
+
+	memset(rp,0,num*sizeof(BN_ULONG));
+	if (a->top > 0)
+		memcpy(rp,a->d,a->top*sizeof(BN_ULONG));
+
+	return(1);
+	}
+
+static int bn_mont_store(BIGNUM *r, const BN_ULONG *ap, int num)
+	{
+	if (bn_wexpand(r,num) == NULL)
+		return(0);
+
+	memcpy(r->d,ap,num*sizeof(BN_ULONG));
+	r->top=num;
+	r->neg=0;
+	bn_fix_top(r);
+
+	return(1);
+	}
+
+int BN_mod_mul_montgomery(BIGNUM *r, BIGNUM *a, BIGNUM *b,
+			  BN_MONT_CTX *mont, BN_CTX *ctx)
+	{
+	BN_ULONG *buf;
+	int num=mont->N.top;
+	int ret=0;
+
+	if ((buf=malloc(4*num*sizeof(BN_ULONG))) == NULL)
+		return(0);
+
+	if (!bn_mont_load(buf,a,num) || !bn_mont_load(&(buf[num]),b,num))
+		goto err;
+
+	bn_mont_mul_words(buf,buf,&(buf[num]),&(buf[2*num]),mont);
+	ret=bn_mont_store(r,buf,num);
+err:
+	free(buf);
+	return(ret);
+	}
+
+int BN_from_montgomery(BIGNUM *ret, BIGNUM *a, BN_MONT_CTX *mont,
+	     BN_CTX *ctx)
+	{
+	BN_ULONG *buf;
+	int num=mont->N.top;
+	int retn=0;
+
+	if ((buf=malloc(3*num*sizeof(BN_ULONG))) == NULL)
+		return(0);
+
+	if (!bn_mont_load(&(buf[num]),a,2*num))
+		goto err;
+
+	bn_mont_reduce(buf,&(buf[num]),mont);
+	retn=bn_mont_store(ret,buf,num);
+err:
+	free(buf);
+	return(retn);
+	}
+
+/* copy table entry idx into rp, touching every entry */
+static void bn_mont_gather(BN_ULONG *rp, const BN_ULONG *table, int num,
+	int entries, int idx)
+	{
+	BN_ULONG mask;
+	int i,j;
+
+	memset(rp,0,num*sizeof(BN_ULONG));
+	for (j=0; j<entries; j++)
+		{
+		mask=0-(BN_ULONG)(((unsigned int)(j^idx)-1)>>(sizeof(unsigned int)*8-1));
+		for (i=0; i<num; i++)
+			rp[i]|=table[j*num+i]&mask;
+		}
+	}
+
+int BN_mod_exp_mont(BIGNUM *rr, BIGNUM *a, const BIGNUM *p,
+		    const BIGNUM *m, BN_CTX *ctx, BN_MONT_CTX *in_mont)
+	{
+	int i,j,bits,ret=0,window,wvalue,entries=0,nwin,num;
+	BN_ULONG *buf=NULL,*table,*r,*t,*one,*tmp;
+	BN_MONT_CTX *mont=NULL;
+	BIGNUM *aa;
+
+	bn_check_top(a);
+	bn_check_top(p);
+	bn_check_top(m);
+
+	if (!BN_is_odd(m))
+		return(0);
+
+	/* only the word length of the exponent is visible */
+	bits=p->top*BN_BITS2;
+	if (bits == 0)
+		return(BN_one(rr));
+
+	BN_CTX_start(ctx);
+	if ((aa=BN_CTX_get(ctx)) == NULL) goto err;
+
+	if (in_mont != NULL)
+		mont=in_mont;
+	else
+		{
+		if ((mont=BN_MONT_CTX_new()) == NULL) goto err;
+		if (!BN_MONT_CTX_set(mont,m,ctx)) goto err;
+		}
+	num=mont->N.top;
+
+	window=BN_window_bits_for_exponent_size(bits);
+	if (window > MONT_MAX_WINDOW)
+		window=MONT_MAX_WINDOW;
+	entries=1<<window;
+
+	buf=malloc((entries+5)*num*sizeof(BN_ULONG));
+	if (buf == NULL) goto err;
+
+	table=buf;
+	r= &(buf[entries*num]);
+	t= &(r[num]);
+	one= &(t[num]);
+	tmp= &(one[num]);	/* 2*num words */
+
+	if (a->neg || BN_ucmp(a,m) >= 0)
+		{
+		if (!BN_mod(aa,a,m,ctx)) goto err;
+		}
+	else if (BN_copy(aa,a) == NULL) goto err;
+
+	/* table[i] = a^i in Montgomery form, table[0] = R mod N */
+	memset(one,0,num*sizeof(BN_ULONG));
+	one[0]=1;
+	if (!bn_mont_load(t,&(mont->RR),num)) goto err;
+	bn_mont_mul_words(&(table[0]),one,t,tmp,mont);
+	if (!bn_mont_load(r,aa,num)) goto err;
+	bn_mont_mul_words(&(table[num]),r,t,tmp,mont);
+	for (i=2; i<entries; i++)
+		bn_mont_mul_words(&(table[i*num]),&(table[(i-1)*num]),
+			&(table[num]),tmp,mont);
+
+	nwin=(bits+window-1)/window;
+	for (j=nwin-1; j>=0; j--)
+		{
+		wvalue=0;
+		for (i=window-1; i>=0; i--)
+			{
+			int bit=j*window+i;
+
+			wvalue<<=1;
+			if (bit < bits)
+				wvalue|=(p->d[bit/BN_BITS2]>>(bit%BN_BITS2))&1;
+			}
+
+		if (j == nwin-1)
+			{
+			bn_mont_gather(r,table,num,entries,wvalue);
+			continue;
+			}
+
+		for (i=0; i<window; i++)
+			bn_mont_mul_words(r,r,r,tmp,mont);
+
+		bn_mont_gather(t,table,num,entries,wvalue);
+		bn_mont_mul_words(r,r,t,tmp,mont);
+		}
+
+	/* convert back */
+	bn_mont_mul_words(r,r,one,tmp,mont);
+	if (!bn_mont_store(rr,r,num)) goto err;
+	ret=1;
+err:
+	if (buf != NULL)
+		{
+		memset(buf,0,(entries+5)*num*sizeof(BN_ULONG));
+		free(buf);
+		}
+	if ((in_mont == NULL) && (mont != NULL))
+		BN_MONT_CTX_free(mont);
+	BN_CTX_end(ctx);
+	return(ret);
+	}
@@ -0,0 +1,143 @@
+/*
+ * SRP handshake benchmark: runs complete client/server handshakes in one
+ * process for every precompiled group and reports the time per handshake.
+ *
+ * usage: srpbench [count]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "t_defines.h"
+#include "t_pwd.h"
+#include "t_sha.h"
+#include "t_client.h"
+#include "t_server.h"
+
+#define BENCH_USER	"root"
+#define BENCH_PASS	"benchmark"
+
+static double
+elapsed(struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1e3 +
+         (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* v = g^x mod n, x = H(s, H(user ':' pass)), as done by ead */
+static void
+make_verifier(struct t_pwent *tpe, struct t_confent *tce)
+{
+  unsigned char dig[SHA_DIGESTSIZE];
+  BigInteger x, v, n, g;
+  SHA1_CTX ctxt;
+
+  SHA1Init(&ctxt);
+  SHA1Update(&ctxt, (unsigned char *) BENCH_USER, strlen(BENCH_USER));
+  SHA1Update(&ctxt, (unsigned char *) ":", 1);
+  SHA1Update(&ctxt, (unsigned char *) BENCH_PASS, strlen(BENCH_PASS));
+  SHA1Final(dig, &ctxt);
+
+  SHA1Init(&ctxt);
+  SHA1Update(&ctxt, tpe->salt.data, tpe->salt.len);
+  SHA1Update(&ctxt, dig, sizeof(dig));
+  SHA1Final(dig, &ctxt);
+
+  n = BigIntegerFromBytes(tce->modulus.data, tce->modulus.len);
+  g = BigIntegerFromBytes(tce->generator.data, tce->generator.len);
+  x = BigIntegerFromBytes(dig, sizeof(dig));
+  v = BigIntegerFromInt(0);
+
+  BigIntegerModExp(v, g, x, n);
+  tpe->password.len = BigIntegerToBytes(v, tpe->password.data);
+
+  BigIntegerFree(v);
+  BigIntegerFree(x);
+  BigIntegerFree(g);
+  BigIntegerFree(n);
+}
+
+static int
+handshake(int index)
+{
+  unsigned char pwbuf[MAXPARAMLEN], saltbuf[SALTLEN];
+  unsigned char *skey_c, *skey_s;
+  struct t_pwent tpe = {
+    .name = BENCH_USER,
+    .index = index,
+    .password.data = pwbuf,
+    .salt.data = saltbuf,
+    .salt.len = SALTLEN,
+  };
+  struct t_preconf *tcp;
+  struct t_confent *tce;
+  struct t_client *tc;
+  struct t_server *ts;
+  struct t_num *A, *B;
+  int ret = -1;
+
+  tce = gettcid(index);
+  tcp = t_getpreparam(index - 1);
+  t_random(saltbuf, SALTLEN);
+  saltbuf[0] |= 1;
+  make_verifier(&tpe, tce);
+
+  ts = t_serveropenraw(&tpe, tce);
+  tc = t_clientopen(BENCH_USER, &tcp->modulus, &tcp->generator, &tpe.salt);
+  if (!ts || !tc)
+    goto out;
+
+  A = t_clientgenexp(tc);
+  B = t_servergenexp(ts);
+  t_clientpasswd(tc, BENCH_PASS);
+  skey_c = t_clientgetkey(tc, B);
+  skey_s = t_servergetkey(ts, A);
+  if (!skey_c || !skey_s || memcmp(skey_c, skey_s, SESSION_KEY_LEN) != 0)
+    goto out;
+
+  if (t_serververify(ts, t_clientresponse(tc)) != 0 ||
+      t_clientverify(tc, t_serverresponse(ts)) != 0)
+    goto out;
+
+  ret = 0;
+
+out:
+  if (tc)
+    t_clientclose(tc);
+  if (ts)
+    t_serverclose(ts);
+  return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+  struct timespec start;
+  int count = 10;
+  int i, j;
+
+  if (argc > 1)
+    count = atoi(argv[1]);
+  if (count < 1)
+    count = 1;
+
+  for (i = 1; i <= t_getprecount(); i++) {
+    int bits = t_getpreparam(i - 1)->modulus.len * 8;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (j = 0; j < count; j++) {
+      if (handshake(i) != 0) {
+        fprintf(stderr, "group %d: handshake failed\n", i);
+        return 1;
+      }
+    }
+    printf("group %d (%4d bit): %8.2f ms per handshake\n",
+           i, bits, elapsed(&start) / count);
+  }
+
+  return 0;
+}
@@ -146,12 +146,43 @@ BigIntegerModMul(r, m1, m2, modulus)
   BN_CTX_free(ctx);
 }
 
+/* All SRP exponentiations use the same group modulus, keep its
+ * Montgomery context instead of setting it up on every call */
+static BN_MONT_CTX *
+ModExpMont(m, ctx)
+     BigInteger m;
+     BN_CTX * ctx;
+{
+  static BN_MONT_CTX * mont = NULL;
+
+  if (!BN_is_odd(m))
+    return NULL;
+
+  if (mont && BN_cmp(&mont->N, m) == 0)
+    return mont;
+
+  if (!mont && (mont = BN_MONT_CTX_new()) == NULL)
+    return NULL;
+
+  if (!BN_MONT_CTX_set(mont, m, ctx)) {
+    BN_MONT_CTX_free(mont);
+    mont = NULL;
+  }
+
+  return mont;
+}
+
 void
 BigIntegerModExp(r, b, e, m)
      BigInteger r, b, e, m;
 {
   BN_CTX * ctx = BN_CTX_new();
-  BN_mod_exp(r, b, e, m, ctx);
+  BN_MONT_CTX * mont = ModExpMont(m, ctx);
+
+  if (mont)
+    BN_mod_exp_mont(r, b, e, m, ctx, mont);
+  else
+    BN_mod_exp(r, b, e, m, ctx);
   BN_CTX_free(ctx);
 }
 
@@ -161,12 +192,10 @@ BigIntegerModExpInt(r, b, e, m)
      unsigned int e;
      BigInteger m;
 {
-  BN_CTX * ctx = BN_CTX_new();
   BIGNUM * p = BN_new();
   BN_set_word(p, e);
-  BN_mod_exp(r, b, p, m, ctx);
+  BigIntegerModExp(r, b, p, m);
   BN_free(p);
-  BN_CTX_free(ctx);
 }
 
 void
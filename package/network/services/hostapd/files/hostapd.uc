@@ -1460,6 +1460,32 @@ let main_obj = {
 			return ret;
 		}
 	},
+	psk_set: {
+		args: {
+			iface: "",
+			stations: {},
+			flush: true,
+		},
+		call: function(req) {
+			let ifname = req.args.iface;
+			let found = false;
+
+			if (!ifname)
+				return libubus.STATUS_INVALID_ARGUMENT;
+
+			for (let phy, bss_list in hostapd.bss) {
+				let bss = bss_list[ifname];
+				if (!bss)
+					continue;
+
+				if (bss.psk_set(req.args.stations, req.args.flush) == null)
+					return libubus.STATUS_UNKNOWN_ERROR;
+				found = true;
+			}
+
+			return found ? 0 : libubus.STATUS_NOT_FOUND;
+		}
+	},
 	status: {
 		args: {},
 		call: function(req) {
@@ -26,6 +26,13 @@
 #include "hw_features.h"
 #include "base64.h"
 
+#ifdef CONFIG_DRIVER_NL80211
+#include <net/if.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/ctrl.h>
+#include "drivers/nl80211_copy.h"
+#endif
+
 static struct ubus_context *ctx;
 static struct blob_buf b;
 static int ctx_ref;
@@ -40,6 +47,17 @@ struct ubus_banned_client {
 	u8 addr[ETH_ALEN];
 };
 
+#define UBUS_VERDICT_MAX		4096
+#define UBUS_VERDICT_GC_INTERVAL	10
+
+struct ubus_verdict {
+	struct avl_node avl;
+	u8 addr[ETH_ALEN];
+	u64 last_probe;
+	u64 expire[HOSTAPD_UBUS_TYPE_MAX];
+	int status[HOSTAPD_UBUS_TYPE_MAX];
+};
+
 static void ubus_reconnect_timeout(void *eloop_data, void *user_ctx)
 {
 	if (ubus_reconnect(ctx, NULL)) {
@@ -77,6 +95,8 @@ static void hostapd_ubus_ref_inc(void)
 	ctx_ref++;
 }
 
+static void hostapd_sta_dump_free(void);
+
 static void hostapd_ubus_ref_dec(void)
 {
 	ctx_ref--;
@@ -89,6 +109,7 @@ static void hostapd_ubus_ref_dec(void)
 	uloop_fd_delete(&ctx->sock);
 	ubus_free(ctx);
 	ctx = NULL;
+	hostapd_sta_dump_free();
 }
 
 void hostapd_ubus_add_iface(struct hostapd_iface *iface)
@@ -119,6 +140,16 @@ static void hostapd_notify_ubus(struct ubus_object *obj, char *bssname, char *ev
 	free(event_type);
 }
 
+static void
+blobmsg_add_macaddr(struct blob_buf *buf, const char *name, const u8 *addr)
+{
+	char *s;
+
+	s = blobmsg_alloc_string_buffer(buf, name, 20);
+	sprintf(s, MACSTR, MAC2STR(addr));
+	blobmsg_add_string_buffer(buf);
+}
+
 static void
 hostapd_bss_del_ban(void *eloop_data, void *user_ctx)
 {
@@ -157,6 +188,111 @@ hostapd_bss_ban_client(struct hostapd_data *hapd, u8 *addr, int time)
 	eloop_register_timeout(0, time * 1000, hostapd_bss_del_ban, ban, hapd);
 }
 
+static u64 hostapd_ubus_time_ms(void)
+{
+	struct os_reltime now;
+
+	os_get_reltime(&now);
+
+	return (u64) now.sec * 1000 + now.usec / 1000;
+}
+
+static bool
+hostapd_bss_verdict_stale(struct hostapd_data *hapd, struct ubus_verdict *v,
+			  u64 now)
+{
+	int i;
+
+	for (i = 0; i < HOSTAPD_UBUS_TYPE_MAX; i++)
+		if (v->expire[i] > now)
+			return false;
+
+	return v->last_probe + hapd->ubus.probe_interval <= now;
+}
+
+static void
+hostapd_bss_verdict_del(struct hostapd_data *hapd, struct ubus_verdict *v)
+{
+	avl_delete(&hapd->ubus.verdicts, &v->avl);
+	hapd->ubus.n_verdicts--;
+	free(v);
+}
+
+static void
+hostapd_bss_verdict_gc(void *eloop_data, void *user_ctx)
+{
+	struct hostapd_data *hapd = eloop_data;
+	struct ubus_verdict *v, *tmp;
+	u64 now = hostapd_ubus_time_ms();
+
+	avl_for_each_element_safe(&hapd->ubus.verdicts, v, avl, tmp)
+		if (hostapd_bss_verdict_stale(hapd, v, now))
+			hostapd_bss_verdict_del(hapd, v);
+
+	if (!avl_is_empty(&hapd->ubus.verdicts))
+		eloop_register_timeout(UBUS_VERDICT_GC_INTERVAL, 0,
+				       hostapd_bss_verdict_gc, hapd, NULL);
+}
+
+static void
+hostapd_bss_verdict_flush(struct hostapd_data *hapd)
+{
+	struct ubus_verdict *v, *tmp;
+
+	eloop_cancel_timeout(hostapd_bss_verdict_gc, hapd, NULL);
+	avl_for_each_element_safe(&hapd->ubus.verdicts, v, avl, tmp)
+		hostapd_bss_verdict_del(hapd, v);
+}
+
+static struct ubus_verdict *
+hostapd_bss_verdict_get(struct hostapd_data *hapd, const u8 *addr, bool create)
+{
+	struct ubus_verdict *v;
+
+	v = avl_find_element(&hapd->ubus.verdicts, addr, v, avl);
+	if (v || !create || hapd->ubus.n_verdicts >= UBUS_VERDICT_MAX)
+		return v;
+
+	v = os_zalloc(sizeof(*v));
+	if (!v)
+		return NULL;
+
+	memcpy(v->addr, addr, sizeof(v->addr));
+	v->avl.key = v->addr;
+	avl_insert(&hapd->ubus.verdicts, &v->avl);
+	hapd->ubus.n_verdicts++;
+
+	if (!eloop_is_timeout_registered(hostapd_bss_verdict_gc, hapd, NULL))
+		eloop_register_timeout(UBUS_VERDICT_GC_INTERVAL, 0,
+				       hostapd_bss_verdict_gc, hapd, NULL);
+
+	return v;
+}
+
+static void
+hostapd_bss_verdict_set(struct hostapd_data *hapd, const u8 *addr, int type,
+			int status, int ttl)
+{
+	struct ubus_verdict *v;
+	u64 expire = 0;
+	int i;
+
+	v = hostapd_bss_verdict_get(hapd, addr, ttl > 0);
+	if (!v)
+		return;
+
+	if (ttl > 0)
+		expire = hostapd_ubus_time_ms() + ttl;
+
+	for (i = 0; i < HOSTAPD_UBUS_TYPE_MAX; i++) {
+		if (type >= 0 && i != type)
+			continue;
+
+		v->status[i] = status;
+		v->expire[i] = expire;
+	}
+}
+
 static int
 hostapd_bss_reload(struct ubus_context *ctx, struct ubus_object *obj,
 		   struct ubus_request_data *req, const char *method,
@@ -236,14 +372,401 @@ hostapd_parse_capab_blobmsg(struct sta_info *sta)
 	blobmsg_close_table(&b, v);
 }
 
+struct ubus_sta_data {
+	u8 addr[ETH_ALEN];
+	struct hostap_sta_driver_data data;
+};
+
+struct ubus_sta_dump {
+	struct ubus_sta_data *sta;
+	int n_sta;
+};
+
+static int ubus_sta_data_cmp(const void *a, const void *b)
+{
+	return memcmp(a, b, ETH_ALEN);
+}
+
+#ifdef CONFIG_DRIVER_NL80211
+static struct nl_sock *sta_dump_sock;
+static int sta_dump_family;
+static bool sta_dump_unavailable;
+
+static int
+hostapd_sta_dump_cb(struct nl_msg *msg, void *arg)
+{
+	static struct nla_policy sta_policy[NL80211_STA_INFO_MAX + 1] = {
+		[NL80211_STA_INFO_RX_BYTES] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_TX_BYTES] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_RX_BYTES64] = { .type = NLA_U64 },
+		[NL80211_STA_INFO_TX_BYTES64] = { .type = NLA_U64 },
+		[NL80211_STA_INFO_RX_PACKETS] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_TX_PACKETS] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_RX_DURATION] = { .type = NLA_U64 },
+		[NL80211_STA_INFO_TX_DURATION] = { .type = NLA_U64 },
+		[NL80211_STA_INFO_SIGNAL] = { .type = NLA_U8 },
+		[NL80211_STA_INFO_SIGNAL_AVG] = { .type = NLA_U8 },
+		[NL80211_STA_INFO_ACK_SIGNAL] = { .type = NLA_U8 },
+		[NL80211_STA_INFO_ACK_SIGNAL_AVG] = { .type = NLA_U8 },
+		[NL80211_STA_INFO_INACTIVE_TIME] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_CONNECTED_TIME] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_TX_FAILED] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_TX_RETRIES] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_RX_DROP_MISC] = { .type = NLA_U64 },
+		[NL80211_STA_INFO_EXPECTED_THROUGHPUT] = { .type = NLA_U32 },
+		[NL80211_STA_INFO_TX_BITRATE] = { .type = NLA_NESTED },
+		[NL80211_STA_INFO_RX_BITRATE] = { .type = NLA_NESTED },
+	};
+	static struct nla_policy rate_policy[NL80211_RATE_INFO_MAX + 1] = {
+		[NL80211_RATE_INFO_BITRATE] = { .type = NLA_U16 },
+		[NL80211_RATE_INFO_BITRATE32] = { .type = NLA_U32 },
+	};
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct nlattr *stats[NL80211_STA_INFO_MAX + 1];
+	struct nlattr *rate[NL80211_RATE_INFO_MAX + 1];
+	struct ubus_sta_dump *dump = arg;
+	struct hostap_sta_driver_data *data;
+	struct ubus_sta_data *sta;
+	static const int rate_attr[2] = {
+		NL80211_STA_INFO_RX_BITRATE, NL80211_STA_INFO_TX_BITRATE
+	};
+	unsigned long rates[2] = {};
+	int i;
+
+	nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		  genlmsg_attrlen(gnlh, 0), NULL);
+	if (!tb[NL80211_ATTR_MAC] || !tb[NL80211_ATTR_STA_INFO] ||
+	    nla_parse_nested(stats, NL80211_STA_INFO_MAX,
+			     tb[NL80211_ATTR_STA_INFO], sta_policy))
+		return NL_SKIP;
+
+	sta = os_realloc_array(dump->sta, dump->n_sta + 1, sizeof(*sta));
+	if (!sta)
+		return NL_SKIP;
+
+	dump->sta = sta;
+	sta += dump->n_sta++;
+	memset(sta, 0, sizeof(*sta));
+	memcpy(sta->addr, nla_data(tb[NL80211_ATTR_MAC]), ETH_ALEN);
+	data = &sta->data;
+
+	if (stats[NL80211_STA_INFO_RX_BYTES64] &&
+	    stats[NL80211_STA_INFO_TX_BYTES64])
+		data->bytes_64bit = 1;
+	if (stats[NL80211_STA_INFO_RX_BYTES64])
+		data->rx_bytes = nla_get_u64(stats[NL80211_STA_INFO_RX_BYTES64]);
+	else if (stats[NL80211_STA_INFO_RX_BYTES])
+		data->rx_bytes = nla_get_u32(stats[NL80211_STA_INFO_RX_BYTES]);
+	if (stats[NL80211_STA_INFO_TX_BYTES64])
+		data->tx_bytes = nla_get_u64(stats[NL80211_STA_INFO_TX_BYTES64]);
+	else if (stats[NL80211_STA_INFO_TX_BYTES])
+		data->tx_bytes = nla_get_u32(stats[NL80211_STA_INFO_TX_BYTES]);
+	if (stats[NL80211_STA_INFO_RX_PACKETS])
+		data->rx_packets = nla_get_u32(stats[NL80211_STA_INFO_RX_PACKETS]);
+	if (stats[NL80211_STA_INFO_TX_PACKETS])
+		data->tx_packets = nla_get_u32(stats[NL80211_STA_INFO_TX_PACKETS]);
+	if (stats[NL80211_STA_INFO_RX_DURATION])
+		data->rx_airtime = nla_get_u64(stats[NL80211_STA_INFO_RX_DURATION]);
+	if (stats[NL80211_STA_INFO_TX_DURATION])
+		data->tx_airtime = nla_get_u64(stats[NL80211_STA_INFO_TX_DURATION]);
+	if (stats[NL80211_STA_INFO_SIGNAL])
+		data->signal = (s8) nla_get_u8(stats[NL80211_STA_INFO_SIGNAL]);
+	if (stats[NL80211_STA_INFO_SIGNAL_AVG])
+		data->avg_signal = (s8) nla_get_u8(stats[NL80211_STA_INFO_SIGNAL_AVG]);
+	if (stats[NL80211_STA_INFO_ACK_SIGNAL]) {
+		data->last_ack_rssi = (s8) nla_get_u8(stats[NL80211_STA_INFO_ACK_SIGNAL]);
+		data->flags |= STA_DRV_DATA_LAST_ACK_RSSI;
+	}
+	if (stats[NL80211_STA_INFO_ACK_SIGNAL_AVG])
+		data->avg_ack_signal = (s8) nla_get_u8(stats[NL80211_STA_INFO_ACK_SIGNAL_AVG]);
+	if (stats[NL80211_STA_INFO_INACTIVE_TIME])
+		data->inactive_msec = nla_get_u32(stats[NL80211_STA_INFO_INACTIVE_TIME]);
+	if (stats[NL80211_STA_INFO_CONNECTED_TIME])
+		data->connected_sec = nla_get_u32(stats[NL80211_STA_INFO_CONNECTED_TIME]);
+	if (stats[NL80211_STA_INFO_TX_FAILED])
+		data->tx_retry_failed = nla_get_u32(stats[NL80211_STA_INFO_TX_FAILED]);
+	if (stats[NL80211_STA_INFO_TX_RETRIES])
+		data->tx_retry_count = nla_get_u32(stats[NL80211_STA_INFO_TX_RETRIES]);
+	if (stats[NL80211_STA_INFO_RX_DROP_MISC])
+		data->rx_drop_misc = nla_get_u64(stats[NL80211_STA_INFO_RX_DROP_MISC]);
+	if (stats[NL80211_STA_INFO_EXPECTED_THROUGHPUT])
+		data->expected_throughput = nla_get_u32(stats[NL80211_STA_INFO_EXPECTED_THROUGHPUT]);
+
+	/* Rates in units of 100 kbit/s, as returned by the driver ops */
+	for (i = 0; i < ARRAY_SIZE(rate_attr); i++) {
+		if (!stats[rate_attr[i]] ||
+		    nla_parse_nested(rate, NL80211_RATE_INFO_MAX,
+				     stats[rate_attr[i]], rate_policy))
+			continue;
+
+		if (rate[NL80211_RATE_INFO_BITRATE32])
+			rates[i] = nla_get_u32(rate[NL80211_RATE_INFO_BITRATE32]);
+		else if (rate[NL80211_RATE_INFO_BITRATE])
+			rates[i] = nla_get_u16(rate[NL80211_RATE_INFO_BITRATE]);
+	}
+	data->current_rx_rate = rates[0];
+	data->current_tx_rate = rates[1];
+
+	return NL_SKIP;
+}
+
+static int
+hostapd_sta_dump_finish(struct nl_msg *msg, void *arg)
+{
+	int *ret = arg;
+
+	*ret = 0;
+	return NL_STOP;
+}
+
+static int
+hostapd_sta_dump_error(struct sockaddr_nl *nla, struct nlmsgerr *err, void *arg)
+{
+	int *ret = arg;
+
+	*ret = err->error;
+	return NL_STOP;
+}
+
+static void
+hostapd_sta_dump_free(void)
+{
+	if (!sta_dump_sock)
+		return;
+
+	nl_socket_free(sta_dump_sock);
+	sta_dump_sock = NULL;
+}
+
+/*
+ * Fetch the driver data of all stations on the interface with a single
+ * nl80211 station dump instead of one request per station. Returns an
+ * error if the BSS is not driven by nl80211, the caller then falls back
+ * to hostapd_drv_read_sta_data() for each station.
+ */
+static int
+hostapd_sta_dump(struct hostapd_data *hapd, struct ubus_sta_dump *dump)
+{
+	struct nl_msg *msg;
+	struct nl_cb *cb;
+	int ifindex, ret = -1;
+
+	if (sta_dump_unavailable || !hapd->driver || !hapd->driver->name ||
+	    strcmp(hapd->driver->name, "nl80211") != 0)
+		return -1;
+
+	ifindex = if_nametoindex(hapd->conf->iface);
+	if (!ifindex)
+		return -1;
+
+	if (!sta_dump_sock) {
+		sta_dump_sock = nl_socket_alloc();
+		if (!sta_dump_sock)
+			return -1;
+
+		if (genl_connect(sta_dump_sock) ||
+		    (sta_dump_family = genl_ctrl_resolve(sta_dump_sock, "nl80211")) < 0) {
+			hostapd_sta_dump_free();
+			sta_dump_unavailable = true;
+			return -1;
+		}
+	}
+
+	msg = nlmsg_alloc();
+	cb = nl_cb_alloc(NL_CB_DEFAULT);
+	if (!msg || !cb)
+		goto out;
+
+	if (!genlmsg_put(msg, 0, 0, sta_dump_family, 0, NLM_F_DUMP,
+			 NL80211_CMD_GET_STATION, 0) ||
+	    nla_put_u32(msg, NL80211_ATTR_IFINDEX, ifindex) ||
+	    nl_send_auto_complete(sta_dump_sock, msg) < 0)
+		goto out;
+
+	ret = 1;
+	nl_cb_set(cb, NL_CB_VALID, NL_CB_CUSTOM, hostapd_sta_dump_cb, dump);
+	nl_cb_set(cb, NL_CB_FINISH, NL_CB_CUSTOM, hostapd_sta_dump_finish, &ret);
+	nl_cb_err(cb, NL_CB_CUSTOM, hostapd_sta_dump_error, &ret);
+	while (ret > 0)
+		if (nl_recvmsgs(sta_dump_sock, cb) < 0)
+			ret = -1;
+
+out:
+	nl_cb_put(cb);
+	nlmsg_free(msg);
+
+	if (ret) {
+		/* drop the socket, it may still hold parts of the dump */
+		hostapd_sta_dump_free();
+		return ret;
+	}
+
+	qsort(dump->sta, dump->n_sta, sizeof(*dump->sta), ubus_sta_data_cmp);
+
+	return 0;
+}
+#else
+static void
+hostapd_sta_dump_free(void)
+{
+}
+
+static int
+hostapd_sta_dump(struct hostapd_data *hapd, struct ubus_sta_dump *dump)
+{
+	return -1;
+}
+#endif
+
+static int
+hostapd_sta_read_data(struct hostapd_data *hapd, struct ubus_sta_dump *dump,
+		      struct sta_info *sta, struct hostap_sta_driver_data *data)
+{
+	struct ubus_sta_data *entry = NULL;
+
+	if (dump->n_sta)
+		entry = bsearch(sta->addr, dump->sta, dump->n_sta,
+				sizeof(*dump->sta), ubus_sta_data_cmp);
+	if (entry) {
+		*data = entry->data;
+		return 0;
+	}
+
+	/* not part of the dump, e.g. stations on AP VLAN interfaces */
+	return hostapd_drv_read_sta_data(hapd, data, sta->addr);
+}
+
+struct ubus_client_sig {
+	u32 flags;
+	u16 aid;
+	int valid;
+	s8 signal;
+	unsigned long rx_packets, tx_packets;
+	unsigned long rx_rate, tx_rate;
+	unsigned long long rx_bytes, tx_bytes;
+	unsigned long long rx_airtime, tx_airtime;
+};
+
+/* Last reported state of a client, used for delta get_clients replies */
+struct ubus_client_state {
+	struct avl_node avl;
+	u8 addr[ETH_ALEN];
+	u32 gen;
+	bool removed;
+	bool seen;
+	struct ubus_client_sig sig;
+};
+
+/* number of get_clients generations a removed client is remembered */
+#define UBUS_CLIENTS_REMOVED_GENS	64
+
+enum {
+	CLIENT_FIELD_FLAGS,
+	CLIENT_FIELD_RRM,
+	CLIENT_FIELD_EXT_CAPA,
+	CLIENT_FIELD_AID,
+	CLIENT_FIELD_SIGNATURE,
+	CLIENT_FIELD_STATS,
+	CLIENT_FIELD_CAPABILITIES,
+	__CLIENT_FIELD_MAX
+};
+
+static const char * const client_fields[__CLIENT_FIELD_MAX] = {
+	[CLIENT_FIELD_FLAGS] = "flags",
+	[CLIENT_FIELD_RRM] = "rrm",
+	[CLIENT_FIELD_EXT_CAPA] = "extended_capabilities",
+	[CLIENT_FIELD_AID] = "aid",
+	[CLIENT_FIELD_SIGNATURE] = "signature",
+	[CLIENT_FIELD_STATS] = "stats",
+	[CLIENT_FIELD_CAPABILITIES] = "capabilities",
+};
+
+enum {
+	CLIENTS_SINCE,
+	CLIENTS_FIELDS,
+	__CLIENTS_MAX
+};
+
+static const struct blobmsg_policy clients_policy[__CLIENTS_MAX] = {
+	[CLIENTS_SINCE] = { "since", BLOBMSG_TYPE_INT32 },
+	[CLIENTS_FIELDS] = { "fields", BLOBMSG_TYPE_ARRAY },
+};
+
+static void
+hostapd_bss_clients_flush(struct hostapd_data *hapd)
+{
+	struct ubus_client_state *cs, *tmp;
+
+	avl_for_each_element_safe(&hapd->ubus.clients, cs, avl, tmp) {
+		avl_delete(&hapd->ubus.clients, &cs->avl);
+		free(cs);
+	}
+}
+
+/*
+ * Update the last reported state of a client. Returns the generation in
+ * which it last changed, which is gen if it changed now.
+ */
+static u32
+hostapd_bss_client_update(struct hostapd_data *hapd, struct sta_info *sta,
+			  struct hostap_sta_driver_data *data, bool valid,
+			  u32 gen)
+{
+	struct ubus_client_state *cs;
+	struct ubus_client_sig sig;
+
+	memset(&sig, 0, sizeof(sig));
+	sig.flags = sta->flags;
+	sig.aid = sta->aid;
+	sig.valid = valid;
+	if (valid) {
+		sig.signal = data->signal;
+		sig.rx_packets = data->rx_packets;
+		sig.tx_packets = data->tx_packets;
+		sig.rx_rate = data->current_rx_rate;
+		sig.tx_rate = data->current_tx_rate;
+		sig.rx_bytes = data->rx_bytes;
+		sig.tx_bytes = data->tx_bytes;
+		sig.rx_airtime = data->rx_airtime;
+		sig.tx_airtime = data->tx_airtime;
+	}
+
+	cs = avl_find_element(&hapd->ubus.clients, sta->addr, cs, avl);
+	if (!cs) {
+		cs = os_zalloc(sizeof(*cs));
+		if (!cs)
+			return gen;
+
+		memcpy(cs->addr, sta->addr, sizeof(cs->addr));
+		cs->avl.key = cs->addr;
+		avl_insert(&hapd->ubus.clients, &cs->avl);
+	} else if (!cs->removed && !memcmp(&cs->sig, &sig, sizeof(sig))) {
+		cs->seen = true;
+		return cs->gen;
+	}
+
+	cs->sig = sig;
+	cs->removed = false;
+	cs->seen = true;
+	cs->gen = gen;
+
+	return gen;
+}
+
 static int
 hostapd_bss_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
 			struct ubus_request_data *req, const char *method,
 			struct blob_attr *msg)
 {
 	struct hostapd_data *hapd = container_of(obj, struct hostapd_data, ubus.obj);
+	struct blob_attr *tb[__CLIENTS_MAX];
 	struct hostap_sta_driver_data sta_driver_data;
+	struct ubus_sta_dump dump = {};
+	struct ubus_client_state *cs, *tmp;
 	struct sta_info *sta;
+	u32 fields = ~0, since = 0, gen;
+	bool track, delta = false, changed = false;
 	void *list, *c;
 	char mac_buf[20];
 	static const struct {
@@ -263,46 +786,113 @@ hostapd_bss_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
 		{ "mfp", WLAN_STA_MFP },
 	};
 
+	blobmsg_parse(clients_policy, __CLIENTS_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (tb[CLIENTS_FIELDS]) {
+		struct blob_attr *cur;
+		size_t rem;
+		int i;
+
+		fields = 0;
+		blobmsg_for_each_attr(cur, tb[CLIENTS_FIELDS], rem) {
+			if (blobmsg_type(cur) != BLOBMSG_TYPE_STRING)
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			for (i = 0; i < __CLIENT_FIELD_MAX; i++)
+				if (!strcmp(blobmsg_get_string(cur), client_fields[i]))
+					break;
+
+			if (i == __CLIENT_FIELD_MAX)
+				return UBUS_STATUS_INVALID_ARGUMENT;
+
+			fields |= BIT(i);
+		}
+	}
+
+	/*
+	 * Changes are only tracked for callers passing "since". A delta reply
+	 * is possible as long as no client removed after the requested
+	 * generation has been forgotten yet, otherwise a full reply is sent.
+	 */
+	track = !!tb[CLIENTS_SINCE];
+	if (track) {
+		since = blobmsg_get_u32(tb[CLIENTS_SINCE]);
+		delta = since && since <= hapd->ubus.clients_gen &&
+			since >= hapd->ubus.clients_pruned_gen;
+	}
+
+	if ((track || (fields & BIT(CLIENT_FIELD_STATS))) &&
+	    hostapd_sta_dump(hapd, &dump) < 0)
+		dump.n_sta = 0;
+
+	gen = hapd->ubus.clients_gen + 1;
+	avl_for_each_element(&hapd->ubus.clients, cs, avl)
+		cs->seen = false;
+
 	blob_buf_init(&b, 0);
 	blobmsg_add_u32(&b, "freq", hapd->iface->freq);
 	list = blobmsg_open_table(&b, "clients");
 	for (sta = hapd->sta_list; sta; sta = sta->next) {
+		int valid = -1;
 		void *r;
 		int i;
 
+		/* Driver information */
+		if (track || (fields & BIT(CLIENT_FIELD_STATS)))
+			valid = hostapd_sta_read_data(hapd, &dump, sta, &sta_driver_data);
+
+		if (track) {
+			u32 sta_gen;
+
+			sta_gen = hostapd_bss_client_update(hapd, sta, &sta_driver_data,
+							    valid >= 0, gen);
+			if (sta_gen == gen)
+				changed = true;
+			else if (delta && sta_gen <= since)
+				continue;
+		}
+
 		sprintf(mac_buf, MACSTR, MAC2STR(sta->addr));
 		c = blobmsg_open_table(&b, mac_buf);
-		for (i = 0; i < ARRAY_SIZE(sta_flags); i++)
-			blobmsg_add_u8(&b, sta_flags[i].name,
-				       !!(sta->flags & sta_flags[i].flag));
+		if (fields & BIT(CLIENT_FIELD_FLAGS)) {
+			for (i = 0; i < ARRAY_SIZE(sta_flags); i++)
+				blobmsg_add_u8(&b, sta_flags[i].name,
+					       !!(sta->flags & sta_flags[i].flag));
 
 #ifdef CONFIG_MBO
-		blobmsg_add_u8(&b, "mbo", !!(sta->cell_capa));
+			blobmsg_add_u8(&b, "mbo", !!(sta->cell_capa));
 #endif
+		}
 
-		r = blobmsg_open_array(&b, "rrm");
-		for (i = 0; i < ARRAY_SIZE(sta->rrm_enabled_capa); i++)
-			blobmsg_add_u32(&b, "", sta->rrm_enabled_capa[i]);
-		blobmsg_close_array(&b, r);
+		if (fields & BIT(CLIENT_FIELD_RRM)) {
+			r = blobmsg_open_array(&b, "rrm");
+			for (i = 0; i < ARRAY_SIZE(sta->rrm_enabled_capa); i++)
+				blobmsg_add_u32(&b, "", sta->rrm_enabled_capa[i]);
+			blobmsg_close_array(&b, r);
+		}
 
-		r = blobmsg_open_array(&b, "extended_capabilities");
-		/* Check if client advertises extended capabilities */
-		if (sta->ext_capability && sta->ext_capability[0] > 0) {
-			for (i = 0; i < sta->ext_capability[0]; i++) {
-				blobmsg_add_u32(&b, "", sta->ext_capability[1 + i]);
+		if (fields & BIT(CLIENT_FIELD_EXT_CAPA)) {
+			r = blobmsg_open_array(&b, "extended_capabilities");
+			/* Check if client advertises extended capabilities */
+			if (sta->ext_capability && sta->ext_capability[0] > 0) {
+				for (i = 0; i < sta->ext_capability[0]; i++) {
+					blobmsg_add_u32(&b, "", sta->ext_capability[1 + i]);
+				}
 			}
+			blobmsg_close_array(&b, r);
 		}
-		blobmsg_close_array(&b, r);
 
-		blobmsg_add_u32(&b, "aid", sta->aid);
+		if (fields & BIT(CLIENT_FIELD_AID))
+			blobmsg_add_u32(&b, "aid", sta->aid);
 #ifdef CONFIG_TAXONOMY
-		r = blobmsg_alloc_string_buffer(&b, "signature", 1024);
-		if (retrieve_sta_taxonomy(hapd, sta, r, 1024) > 0)
-			blobmsg_add_string_buffer(&b);
+		if (fields & BIT(CLIENT_FIELD_SIGNATURE)) {
+			r = blobmsg_alloc_string_buffer(&b, "signature", 1024);
+			if (retrieve_sta_taxonomy(hapd, sta, r, 1024) > 0)
+				blobmsg_add_string_buffer(&b);
+		}
 #endif
 
-		/* Driver information */
-		if (hostapd_drv_read_sta_data(hapd, &sta_driver_data, sta->addr) >= 0) {
+		if ((fields & BIT(CLIENT_FIELD_STATS)) && valid >= 0) {
 			r = blobmsg_open_table(&b, "bytes");
 			blobmsg_add_u64(&b, "rx", sta_driver_data.rx_bytes);
 			blobmsg_add_u64(&b, "tx", sta_driver_data.tx_bytes);
@@ -323,11 +913,40 @@ hostapd_bss_get_clients(struct ubus_context *ctx, struct ubus_object *obj,
 			blobmsg_add_u32(&b, "signal", sta_driver_data.signal);
 		}
 
-		hostapd_parse_capab_blobmsg(sta);
+		if (fields & BIT(CLIENT_FIELD_CAPABILITIES))
+			hostapd_parse_capab_blobmsg(sta);
 
 		blobmsg_close_table(&b, c);
 	}
 	blobmsg_close_array(&b, list);
+	os_free(dump.sta);
+
+	if (track) {
+		list = blobmsg_open_array(&b, "removed");
+		avl_for_each_element_safe(&hapd->ubus.clients, cs, avl, tmp) {
+			if (!cs->removed && !cs->seen) {
+				cs->removed = true;
+				cs->gen = gen;
+				changed = true;
+			} else if (cs->removed &&
+				   cs->gen + UBUS_CLIENTS_REMOVED_GENS < gen) {
+				hapd->ubus.clients_pruned_gen = cs->gen;
+				avl_delete(&hapd->ubus.clients, &cs->avl);
+				free(cs);
+				continue;
+			}
+
+			if (cs->removed && delta && cs->gen > since)
+				blobmsg_add_macaddr(&b, NULL, cs->addr);
+		}
+		blobmsg_close_array(&b, list);
+
+		if (changed)
+			hapd->ubus.clients_gen = gen;
+		blobmsg_add_u32(&b, "generation", hapd->ubus.clients_gen);
+		blobmsg_add_u8(&b, "delta", delta);
+	}
+
 	ubus_send_reply(ctx, req, b.head);
 
 	return 0;
@@ -427,11 +1046,19 @@ hostapd_bss_get_status(struct ubus_context *ctx, struct ubus_object *obj,
 
 enum {
 	NOTIFY_RESPONSE,
+	NOTIFY_ASYNC,
+	NOTIFY_DEFER_UNKNOWN,
+	NOTIFY_VERDICT_TTL,
+	NOTIFY_PROBE_INTERVAL,
 	__NOTIFY_MAX
 };
 
 static const struct blobmsg_policy notify_policy[__NOTIFY_MAX] = {
 	[NOTIFY_RESPONSE] = { "notify_response", BLOBMSG_TYPE_INT32 },
+	[NOTIFY_ASYNC] = { "async", BLOBMSG_TYPE_BOOL },
+	[NOTIFY_DEFER_UNKNOWN] = { "defer_unknown", BLOBMSG_TYPE_BOOL },
+	[NOTIFY_VERDICT_TTL] = { "verdict_ttl", BLOBMSG_TYPE_INT32 },
+	[NOTIFY_PROBE_INTERVAL] = { "probe_interval", BLOBMSG_TYPE_INT32 },
 };
 
 static int
@@ -453,6 +1080,86 @@ hostapd_notify_response(struct ubus_context *ctx, struct ubus_object *obj,
 
 	hapd->ubus.notify_response = blobmsg_get_u32(tb[NOTIFY_RESPONSE]);
 
+	if (tb[NOTIFY_ASYNC])
+		hapd->ubus.notify_async = blobmsg_get_bool(tb[NOTIFY_ASYNC]);
+
+	if (tb[NOTIFY_DEFER_UNKNOWN])
+		hapd->ubus.defer_unknown = blobmsg_get_bool(tb[NOTIFY_DEFER_UNKNOWN]);
+
+	/* without responses no verdict will arrive for deferred clients */
+	if (!hapd->ubus.notify_response) {
+		hapd->ubus.notify_async = false;
+		hapd->ubus.defer_unknown = false;
+	}
+
+	if (tb[NOTIFY_VERDICT_TTL])
+		hapd->ubus.verdict_ttl = blobmsg_get_u32(tb[NOTIFY_VERDICT_TTL]);
+
+	if (tb[NOTIFY_PROBE_INTERVAL])
+		hapd->ubus.probe_interval = blobmsg_get_u32(tb[NOTIFY_PROBE_INTERVAL]);
+
+	if (hapd->ubus.verdict_ttl <= 0 && hapd->ubus.probe_interval <= 0)
+		hostapd_bss_verdict_flush(hapd);
+
+	return UBUS_STATUS_OK;
+}
+
+enum {
+	VERDICT_ADDR,
+	VERDICT_TYPE,
+	VERDICT_STATUS,
+	VERDICT_TTL,
+	__VERDICT_MAX
+};
+
+static const struct blobmsg_policy verdict_policy[__VERDICT_MAX] = {
+	[VERDICT_ADDR] = { "addr", BLOBMSG_TYPE_STRING },
+	[VERDICT_TYPE] = { "type", BLOBMSG_TYPE_STRING },
+	[VERDICT_STATUS] = { "status", BLOBMSG_TYPE_INT32 },
+	[VERDICT_TTL] = { "ttl", BLOBMSG_TYPE_INT32 },
+};
+
+static const char * const hostapd_ubus_event_types[HOSTAPD_UBUS_TYPE_MAX] = {
+	[HOSTAPD_UBUS_PROBE_REQ] = "probe",
+	[HOSTAPD_UBUS_AUTH_REQ] = "auth",
+	[HOSTAPD_UBUS_ASSOC_REQ] = "assoc",
+};
+
+static int
+hostapd_bss_set_verdict(struct ubus_context *ctx, struct ubus_object *obj,
+			struct ubus_request_data *req, const char *method,
+			struct blob_attr *msg)
+{
+	struct blob_attr *tb[__VERDICT_MAX];
+	struct hostapd_data *hapd = get_hapd_from_object(obj);
+	int type = -1, ttl = hapd->ubus.verdict_ttl;
+	u8 addr[ETH_ALEN];
+
+	blobmsg_parse(verdict_policy, __VERDICT_MAX, tb, blob_data(msg), blob_len(msg));
+
+	if (!tb[VERDICT_ADDR] || !tb[VERDICT_STATUS])
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	if (hwaddr_aton(blobmsg_data(tb[VERDICT_ADDR]), addr))
+		return UBUS_STATUS_INVALID_ARGUMENT;
+
+	if (tb[VERDICT_TYPE]) {
+		const char *name = blobmsg_get_string(tb[VERDICT_TYPE]);
+
+		for (type = 0; type < HOSTAPD_UBUS_TYPE_MAX; type++)
+			if (!strcmp(name, hostapd_ubus_event_types[type]))
+				break;
+
+		if (type == HOSTAPD_UBUS_TYPE_MAX)
+			return UBUS_STATUS_INVALID_ARGUMENT;
+	}
+
+	if (tb[VERDICT_TTL])
+		ttl = blobmsg_get_u32(tb[VERDICT_TTL]);
+
+	hostapd_bss_verdict_set(hapd, addr, type,
+				blobmsg_get_u32(tb[VERDICT_STATUS]), ttl);
+
 	return UBUS_STATUS_OK;
 }
 
@@ -519,16 +1226,6 @@ hostapd_bss_del_client(struct ubus_context *ctx, struct ubus_object *obj,
 	return 0;
 }
 
-static void
-blobmsg_add_macaddr(struct blob_buf *buf, const char *name, const u8 *addr)
-{
-	char *s;
-
-	s = blobmsg_alloc_string_buffer(buf, name, 20);
-	sprintf(s, MACSTR, MAC2STR(addr));
-	blobmsg_add_string_buffer(buf);
-}
-
 static int
 hostapd_bss_list_bans(struct ubus_context *ctx, struct ubus_object *obj,
 		      struct ubus_request_data *req, const char *method,
@@ -1646,7 +2343,7 @@ hostapd_bss_get_sta_ies(struct ubus_context *ctx, struct ubus_object *obj,
 
 static const struct ubus_method bss_methods[] = {
 	UBUS_METHOD_NOARG("reload", hostapd_bss_reload),
-	UBUS_METHOD_NOARG("get_clients", hostapd_bss_get_clients),
+	UBUS_METHOD("get_clients", hostapd_bss_get_clients, clients_policy),
 #ifdef CONFIG_TAXONOMY
 	UBUS_METHOD("get_sta_ies", hostapd_bss_get_sta_ies, addr_policy),
 #endif
@@ -1668,6 +2365,7 @@ static const struct ubus_method bss_methods[] = {
 #endif
 	UBUS_METHOD("set_vendor_elements", hostapd_vendor_elements, ve_policy),
 	UBUS_METHOD("notify_response", hostapd_notify_response, notify_policy),
+	UBUS_METHOD("set_verdict", hostapd_bss_set_verdict, verdict_policy),
 	UBUS_METHOD("bss_mgmt_enable", hostapd_bss_mgmt_enable, bss_mgmt_enable_policy),
 	UBUS_METHOD_NOARG("rrm_nr_get_own", hostapd_rrm_nr_get_own),
 	UBUS_METHOD_NOARG("rrm_nr_list", hostapd_rrm_nr_list),
@@ -1784,6 +2482,8 @@ void hostapd_ubus_add_bss(struct hostapd_data *hapd)
 		return;
 
 	avl_init(&hapd->ubus.banned, avl_compare_macaddr, false, NULL);
+	avl_init(&hapd->ubus.verdicts, avl_compare_macaddr, false, NULL);
+	avl_init(&hapd->ubus.clients, avl_compare_macaddr, false, NULL);
 	obj->name = name;
 	if (!strcmp(hapd->driver->name, "wired")) {
 		obj->type = &wired_object_type;
@@ -1814,6 +2514,8 @@ void hostapd_ubus_free_bss(struct hostapd_data *hapd)
 	if (obj->id) {
 		ubus_remove_object(ctx, obj);
 		hostapd_ubus_ref_dec();
+		hostapd_bss_verdict_flush(hapd);
+		hostapd_bss_clients_flush(hapd);
 	}
 
 	free(name);
@@ -1859,6 +2561,7 @@ void hostapd_ubus_remove_vlan(struct hostapd_data *hapd, struct hostapd_vlan *vl
 
 struct ubus_event_req {
 	struct ubus_notify_request nreq;
+	bool got_reply;
 	int resp;
 };
 
@@ -1867,6 +2570,7 @@ ubus_event_cb(struct ubus_notify_request *req, int idx, int ret)
 {
 	struct ubus_event_req *ureq = container_of(req, struct ubus_event_req, nreq);
 
+	ureq->got_reply = true;
 	ureq->resp = ret;
 }
 
@@ -1874,14 +2578,14 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 {
 	struct ubus_banned_client *ban;
 	const u8 bcast[ETH_ALEN] = { 0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
-	const char *types[HOSTAPD_UBUS_TYPE_MAX] = {
-		[HOSTAPD_UBUS_PROBE_REQ] = "probe",
-		[HOSTAPD_UBUS_AUTH_REQ] = "auth",
-		[HOSTAPD_UBUS_ASSOC_REQ] = "assoc",
-	};
 	const char *type = "mgmt";
 	struct ubus_event_req ureq = {};
+	struct ubus_verdict *v;
+	bool probe = req->type == HOSTAPD_UBUS_PROBE_REQ;
+	bool cached = false;
+	int status = WLAN_STATUS_SUCCESS;
 	const u8 *addr;
+	u64 now;
 
 	if (req->mgmt_frame)
 		addr = req->mgmt_frame->sa;
@@ -1899,8 +2603,30 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 	if (!hapd->ubus.obj.has_subscribers)
 		return WLAN_STATUS_SUCCESS;
 
-	if (req->type < ARRAY_SIZE(types))
-		type = types[req->type];
+	/*
+	 * Answer from the verdict cache where possible. In async mode the
+	 * event loop is never blocked on subscribers, unknown clients are
+	 * either accepted or deferred until a verdict has been set.
+	 */
+	now = hostapd_ubus_time_ms();
+	v = hostapd_bss_verdict_get(hapd, addr, probe && hapd->ubus.probe_interval > 0);
+	if (v && req->type < HOSTAPD_UBUS_TYPE_MAX && v->expire[req->type] > now) {
+		status = v->status[req->type];
+		cached = true;
+	} else if (hapd->ubus.notify_response && hapd->ubus.notify_async &&
+		   hapd->ubus.defer_unknown) {
+		status = WLAN_STATUS_AP_UNABLE_TO_HANDLE_NEW_STA;
+	}
+
+	if (probe && v && hapd->ubus.probe_interval > 0) {
+		if (v->last_probe && now - v->last_probe < hapd->ubus.probe_interval)
+			return status;
+
+		v->last_probe = now;
+	}
+
+	if (req->type < HOSTAPD_UBUS_TYPE_MAX)
+		type = hostapd_ubus_event_types[req->type];
 
 	blob_buf_init(&b, 0);
 	blobmsg_add_macaddr(&b, "address", addr);
@@ -1952,9 +2678,9 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 		}
 	}
 
-	if (!hapd->ubus.notify_response) {
+	if (!hapd->ubus.notify_response || hapd->ubus.notify_async || cached) {
 		ubus_notify(ctx, &hapd->ubus.obj, type, b.head, -1);
-		return WLAN_STATUS_SUCCESS;
+		return status;
 	}
 
 	if (ubus_notify_async(ctx, &hapd->ubus.obj, type, b.head, &ureq.nreq))
@@ -1963,6 +2689,12 @@ int hostapd_ubus_handle_event(struct hostapd_data *hapd, struct hostapd_ubus_req
 	ureq.nreq.status_cb = ubus_event_cb;
 	ubus_complete_request(ctx, &ureq.nreq.req, 100);
 
+	/* a timed out request is no verdict, don't cache it as accept */
+	if (ureq.got_reply && req->type < HOSTAPD_UBUS_TYPE_MAX &&
+	    hapd->ubus.verdict_ttl > 0)
+		hostapd_bss_verdict_set(hapd, addr, req->type, ureq.resp,
+					hapd->ubus.verdict_ttl);
+
 	if (ureq.resp)
 		return ureq.resp;
 
@@ -37,7 +37,16 @@ struct sta_info;
 struct hostapd_ubus_bss {
 	struct ubus_object obj;
 	struct avl_tree banned;
+	struct avl_tree verdicts;
+	int n_verdicts;
 	int notify_response;
+	bool notify_async;
+	bool defer_unknown;
+	int verdict_ttl; /* ms */
+	int probe_interval; /* ms */
+	struct avl_tree clients;
+	u32 clients_gen;
+	u32 clients_pruned_gen;
 };
 
 void hostapd_ubus_add_iface(struct hostapd_iface *iface);
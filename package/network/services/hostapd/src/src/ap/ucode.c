@@ -4,6 +4,7 @@
 #include "utils/common.h"
 #include "utils/ucode.h"
 #include "utils/base64.h"
+#include "utils/list.h"
 #include "sta_info.h"
 #include "beacon.h"
 #include "hw_features.h"
@@ -807,14 +808,288 @@ out:
 	return ret ? NULL : ucv_boolean_new(true);
 }
 
+/*
+ * Native per-BSS PSK store, filled in bulk from ucode via bss.psk_set().
+ * Lookups by station address happen at auth time without entering the VM;
+ * the "*" entry is used for stations without an entry of their own.
+ */
+struct hostapd_ucode_psk {
+	struct dl_list list;
+	u8 addr[ETH_ALEN];
+	bool force;
+	size_t n_psk;
+	struct hostapd_sta_wpa_psk_short psk[];
+};
+
+struct hostapd_ucode_psk_store {
+	struct dl_list *buckets;
+	unsigned int hash_bits;
+	unsigned int n_entries;
+	struct hostapd_ucode_psk *def;
+};
+
+#define HOSTAPD_UCODE_PSK_HASH_BITS	6
+
+static unsigned int
+hostapd_ucode_psk_hash(const struct hostapd_ucode_psk_store *store,
+		       const u8 *addr)
+{
+	u32 val = WPA_GET_BE32(addr + 2) ^ WPA_GET_BE16(addr);
+
+	return (val * 0x9e3779b1) >> (32 - store->hash_bits);
+}
+
+static int
+hostapd_ucode_psk_parse(uc_value_t *val, struct hostapd_sta_wpa_psk_short *p)
+{
+	const char *str = ucv_string_get(val);
+	size_t len;
+
+	if (!str)
+		return -1;
+
+	len = strlen(str);
+	if (len < 8 || len > 64)
+		return -1;
+
+	if (len == 64)
+		return hexstr2bin(str, p->psk, PMK_LEN);
+
+	p->is_passphrase = 1;
+	memcpy(p->passphrase, str, len + 1);
+
+	return 0;
+}
+
+static struct hostapd_ucode_psk *
+hostapd_ucode_psk_entry_new(uc_value_t *val)
+{
+	struct hostapd_ucode_psk *entry;
+	uc_value_t *list = val;
+	size_t i, len;
+
+	if (ucv_type(val) == UC_OBJECT)
+		list = ucv_object_get(val, "psk", NULL);
+	else if (ucv_type(val) != UC_ARRAY)
+		return NULL;
+
+	len = ucv_array_length(list);
+	entry = os_zalloc(sizeof(*entry) + len * sizeof(entry->psk[0]));
+	if (!entry)
+		return NULL;
+
+	for (i = 0; i < len; i++) {
+		struct hostapd_sta_wpa_psk_short *p = &entry->psk[entry->n_psk];
+
+		if (hostapd_ucode_psk_parse(ucv_array_get(list, i), p) < 0) {
+			memset(p, 0, sizeof(*p));
+			continue;
+		}
+
+		entry->n_psk++;
+	}
+
+	if (ucv_type(val) == UC_OBJECT)
+		entry->force = ucv_is_truish(ucv_object_get(val, "force_psk", NULL));
+
+	return entry;
+}
+
+static struct hostapd_ucode_psk *
+hostapd_ucode_psk_find(struct hostapd_ucode_psk_store *store, const u8 *addr)
+{
+	struct hostapd_ucode_psk *entry;
+	unsigned int hash;
+
+	if (!store->buckets)
+		return NULL;
+
+	hash = hostapd_ucode_psk_hash(store, addr);
+	dl_list_for_each(entry, &store->buckets[hash],
+			 struct hostapd_ucode_psk, list)
+		if (!os_memcmp(entry->addr, addr, ETH_ALEN))
+			return entry;
+
+	return NULL;
+}
+
+static int
+hostapd_ucode_psk_rehash(struct hostapd_ucode_psk_store *store,
+			 unsigned int bits)
+{
+	struct dl_list *old = store->buckets, *buckets;
+	unsigned int i, n_old = old ? 1U << store->hash_bits : 0;
+	struct hostapd_ucode_psk *entry, *tmp;
+
+	buckets = os_calloc(1U << bits, sizeof(*buckets));
+	if (!buckets)
+		return -1;
+
+	for (i = 0; i < (1U << bits); i++)
+		dl_list_init(&buckets[i]);
+
+	store->buckets = buckets;
+	store->hash_bits = bits;
+
+	for (i = 0; i < n_old; i++) {
+		dl_list_for_each_safe(entry, tmp, &old[i],
+				      struct hostapd_ucode_psk, list) {
+			dl_list_del(&entry->list);
+			dl_list_add(&buckets[hostapd_ucode_psk_hash(store, entry->addr)],
+				    &entry->list);
+		}
+	}
+	os_free(old);
+
+	return 0;
+}
+
+static void
+hostapd_ucode_psk_set(struct hostapd_ucode_psk_store *store, const u8 *addr,
+		      struct hostapd_ucode_psk *entry)
+{
+	struct hostapd_ucode_psk *prev;
+
+	prev = hostapd_ucode_psk_find(store, addr);
+	if (prev) {
+		dl_list_del(&prev->list);
+		store->n_entries--;
+		os_free(prev);
+	}
+
+	if (!entry)
+		return;
+
+	if (!store->buckets &&
+	    hostapd_ucode_psk_rehash(store, HOSTAPD_UCODE_PSK_HASH_BITS))
+		goto error;
+
+	/* keep the average chain length at two entries or less */
+	if (store->n_entries >= 2U << store->hash_bits &&
+	    store->hash_bits < 20)
+		hostapd_ucode_psk_rehash(store, store->hash_bits + 1);
+
+	memcpy(entry->addr, addr, ETH_ALEN);
+	dl_list_add(&store->buckets[hostapd_ucode_psk_hash(store, addr)],
+		    &entry->list);
+	store->n_entries++;
+	return;
+
+error:
+	os_free(entry);
+}
+
+static void
+hostapd_ucode_psk_flush(struct hostapd_ucode_psk_store *store)
+{
+	struct hostapd_ucode_psk *entry, *tmp;
+	unsigned int i;
+
+	for (i = 0; store->buckets && i < (1U << store->hash_bits); i++)
+		dl_list_for_each_safe(entry, tmp, &store->buckets[i],
+				      struct hostapd_ucode_psk, list)
+			os_free(entry);
+
+	os_free(store->buckets);
+	os_free(store->def);
+	memset(store, 0, sizeof(*store));
+}
+
+static void
+hostapd_ucode_psk_apply(struct sta_info *sta,
+			const struct hostapd_ucode_psk *entry)
+{
+	struct hostapd_sta_wpa_psk_short *p, **next;
+	size_t i;
+
+	next = &sta->psk;
+	hostapd_free_psk_list(*next);
+	*next = NULL;
+
+	for (i = 0; i < entry->n_psk; i++) {
+		p = os_memdup(&entry->psk[i], sizeof(*p));
+		if (!p)
+			break;
+
+		*next = p;
+		next = &p->next;
+	}
+
+	sta->use_sta_psk = entry->force;
+}
+
+static uc_value_t *
+uc_hostapd_bss_psk_set(uc_vm_t *vm, size_t nargs)
+{
+	struct hostapd_data *hapd = uc_fn_thisval("hostapd.bss");
+	uc_value_t *list = uc_fn_arg(0);
+	uc_value_t *flush = uc_fn_arg(1);
+	struct hostapd_ucode_psk_store *store;
+	u8 addr[ETH_ALEN];
+
+	if (!hapd || (list && ucv_type(list) != UC_OBJECT))
+		return NULL;
+
+	store = hapd->ucode.psk;
+	if (!store) {
+		store = os_zalloc(sizeof(*store));
+		if (!store)
+			return NULL;
+
+		hapd->ucode.psk = store;
+	}
+
+	if (ucv_is_truish(flush))
+		hostapd_ucode_psk_flush(store);
+
+	ucv_object_foreach(list, key, val) {
+		struct hostapd_ucode_psk *entry = NULL;
+		bool is_default = !strcmp(key, "*");
+
+		if (!is_default && hwaddr_aton(key, addr))
+			continue;
+
+		if (val) {
+			entry = hostapd_ucode_psk_entry_new(val);
+			if (!entry)
+				continue;
+		}
+
+		if (is_default) {
+			os_free(store->def);
+			store->def = entry;
+		} else {
+			hostapd_ucode_psk_set(store, addr, entry);
+		}
+	}
+
+	return ucv_int64_new(store->n_entries + !!store->def);
+}
+
 int hostapd_ucode_sta_auth(struct hostapd_data *hapd, struct sta_info *sta)
 {
+	struct hostapd_ucode_psk_store *store = hapd->ucode.psk;
+	struct hostapd_ucode_psk *entry = NULL, *def = NULL;
 	char addr[sizeof(MACSTR)];
 	uc_value_t *val, *cur;
 	int ret = 0;
 
-	if (wpa_ucode_call_prepare("sta_auth"))
+	if (store) {
+		entry = hostapd_ucode_psk_find(store, sta->addr);
+		def = store->def;
+	}
+
+	if (entry) {
+		hostapd_ucode_psk_apply(sta, entry);
 		return 0;
+	}
+
+	/* the "*" entry only applies if sta_auth does not provide PSKs */
+	if (wpa_ucode_call_prepare("sta_auth")) {
+		if (def)
+			hostapd_ucode_psk_apply(sta, def);
+		return 0;
+	}
 
 	uc_value_push(ucv_string_new(hapd->conf->iface));
 
@@ -833,34 +1108,28 @@ int hostapd_ucode_sta_auth(struct hostapd_data *hapd, struct sta_info *sta)
 		*next = NULL;
 
 		for (size_t i = 0; i < len; i++) {
-			uc_value_t *cur_psk;
-			const char *str;
-			size_t str_len;
-
-			cur_psk = ucv_array_get(cur, i);
-			str = ucv_string_get(cur_psk);
-			str_len = strlen(str);
-			if (!str || str_len < 8 || str_len > 64)
-				continue;
-
 			p = os_zalloc(sizeof(*p));
-			if (len == 64) {
-				if (hexstr2bin(str, p->psk, PMK_LEN) < 0) {
-					free(p);
-					continue;
-				}
-			} else {
-				p->is_passphrase = 1;
-				memcpy(p->passphrase, str, str_len + 1);
+			if (!p)
+				break;
+
+			if (hostapd_ucode_psk_parse(ucv_array_get(cur, i), p) < 0) {
+				os_free(p);
+				continue;
 			}
 
 			*next = p;
 			next = &p->next;
 		}
+
+		def = NULL;
 	}
 
-	cur = ucv_object_get(val, "force_psk", NULL);
-	sta->use_sta_psk = ucv_is_truish(cur);
+	if (def) {
+		hostapd_ucode_psk_apply(sta, def);
+	} else {
+		cur = ucv_object_get(val, "force_psk", NULL);
+		sta->use_sta_psk = ucv_is_truish(cur);
+	}
 
 	cur = ucv_object_get(val, "status", NULL);
 	if (ucv_type(cur) == UC_INTEGER)
@@ -1199,6 +1468,7 @@ int hostapd_ucode_init(struct hapd_interfaces *ifaces)
 		{ "set_config", uc_hostapd_bss_set_config },
 		{ "rename", uc_hostapd_bss_rename },
 		{ "delete", uc_hostapd_bss_delete },
+		{ "psk_set", uc_hostapd_bss_psk_set },
 #ifdef CONFIG_DPP
 		{ "dpp_send_action", uc_hostapd_bss_dpp_send_action },
 		{ "dpp_send_gas_resp", uc_hostapd_bss_dpp_send_gas_resp },
@@ -1270,6 +1540,12 @@ void hostapd_ucode_free_bss(struct hostapd_data *hapd)
 {
 	uc_value_t *val;
 
+	if (hapd->ucode.psk) {
+		hostapd_ucode_psk_flush(hapd->ucode.psk);
+		os_free(hapd->ucode.psk);
+		hapd->ucode.psk = NULL;
+	}
+
 	val = wpa_ucode_registry_remove(bss_registry, hapd->ucode.idx);
 	if (!val)
 		return;
@@ -4,10 +4,12 @@
 #include "utils/ucode.h"
 
 struct hostapd_data;
+struct hostapd_ucode_psk_store;
 
 struct hostapd_ucode_bss {
 #ifdef UCODE_SUPPORT
 	int idx;
+	struct hostapd_ucode_psk_store *psk;
 #endif
 };
 
@@ -14,6 +14,19 @@
 
 static uc_value_t *registry;
 static uc_vm_t vm;
+
+/*
+ * Slots released by wpa_ucode_registry_remove() are kept on a per-registry
+ * stack, so that adding an object does not need to scan the array for a
+ * hole. Only a handful of registries exist per process.
+ */
+#define WPA_UCODE_MAX_REGISTRIES	4
+
+static struct wpa_ucode_registry_slots {
+	uc_value_t *reg;
+	unsigned int *free;
+	unsigned int n_free, size;
+} reg_slots[WPA_UCODE_MAX_REGISTRIES];
 static struct udebug ud;
 static struct udebug_buf ud_log, ud_nl[3];
 static const struct udebug_buf_meta meta_log = {
@@ -435,14 +448,48 @@ uc_value_t *wpa_ucode_global_init(const char *name, uc_resource_type_t *global_t
 	return global;
 }
 
+static struct wpa_ucode_registry_slots *
+wpa_ucode_registry_slots(uc_value_t *reg, bool create)
+{
+	struct wpa_ucode_registry_slots *empty = NULL;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(reg_slots); i++) {
+		if (reg_slots[i].reg == reg)
+			return &reg_slots[i];
+		if (!reg_slots[i].reg && !empty)
+			empty = &reg_slots[i];
+	}
+
+	if (!create || !empty)
+		return NULL;
+
+	empty->reg = reg;
+	return empty;
+}
+
 int wpa_ucode_registry_add(uc_value_t *reg, uc_value_t *val)
 {
-	uc_value_t *data;
-	int i = 0;
+	struct wpa_ucode_registry_slots *slots;
+	unsigned int i;
+
+	slots = wpa_ucode_registry_slots(reg, false);
+	while (slots && slots->n_free) {
+		i = slots->free[--slots->n_free];
+		if (!ucv_array_get(reg, i))
+			goto out;
+	}
 
-	while (ucv_array_get(reg, i))
-		i++;
+	if (slots) {
+		/* all holes are tracked, append */
+		i = ucv_array_length(reg);
+	} else {
+		i = 0;
+		while (ucv_array_get(reg, i))
+			i++;
+	}
 
+out:
 	ucv_array_set(reg, i, ucv_get(val));
 
 	return i + 1;
@@ -456,6 +503,28 @@ uc_value_t *wpa_ucode_registry_get(uc_value_t *reg, int idx)
 	return ucv_array_get(reg, idx - 1);
 }
 
+static void wpa_ucode_registry_release(uc_value_t *reg, unsigned int slot)
+{
+	struct wpa_ucode_registry_slots *slots;
+	unsigned int *free_list;
+
+	slots = wpa_ucode_registry_slots(reg, true);
+	if (!slots)
+		return;
+
+	if (slots->n_free == slots->size) {
+		free_list = os_realloc_array(slots->free, slots->size + 16,
+					     sizeof(*free_list));
+		if (!free_list)
+			return;
+
+		slots->free = free_list;
+		slots->size += 16;
+	}
+
+	slots->free[slots->n_free++] = slot;
+}
+
 uc_value_t *wpa_ucode_registry_remove(uc_value_t *reg, int idx)
 {
 	uc_value_t *val = wpa_ucode_registry_get(reg, idx);
@@ -466,6 +535,7 @@ uc_value_t *wpa_ucode_registry_remove(uc_value_t *reg, int idx)
 
 	ucv_get(val);
 	ucv_array_set(reg, idx - 1, NULL);
+	wpa_ucode_registry_release(reg, idx - 1);
 	dataptr = ucv_resource_dataptr(val, NULL);
 	if (dataptr)
 		*dataptr = NULL;
@@ -484,11 +554,16 @@ uc_value_t *wpa_ucode_call(size_t nargs)
 
 void wpa_ucode_free_vm(void)
 {
+	int i;
+
 	if (!vm.config)
 		return;
 
 	uc_search_path_free(&vm.config->module_search_path);
 	uc_vm_free(&vm);
 	registry = NULL;
+	for (i = 0; i < ARRAY_SIZE(reg_slots); i++)
+		os_free(reg_slots[i].free);
+	memset(reg_slots, 0, sizeof(reg_slots));
 	vm = (uc_vm_t){};
 }
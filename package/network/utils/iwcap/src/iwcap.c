@@ -27,9 +27,12 @@
 #include <syslog.h>
 #include <errno.h>
 #include <byteswap.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <net/ethernet.h>
 #include <net/if.h>
@@ -45,6 +48,12 @@
 #define FRAMETYPE_BEACON			0x80
 #define FRAMETYPE_DATA				0x08
 
+#define TPACKET_BLOCK_SIZE			(64 * 1024)
+#define TPACKET_FRAME_SIZE			2048
+#define TPACKET_BLOCK_TIMEOUT		64	/* ms */
+
+#define STREAM_FRAMES				512	/* two iovecs each, UIO_MAXIOV is 1024 */
+
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define le16(x) __bswap_16(x)
 #else
@@ -55,8 +64,12 @@ uint8_t run_dump   = 0;
 uint8_t run_stop   = 0;
 uint8_t run_daemon = 0;
 
+uint8_t filter_data   = 0;
+uint8_t filter_beacon = 0;
+
 uint32_t frames_captured = 0;
 uint32_t frames_filtered = 0;
+uint32_t frames_dropped  = 0;
 
 int capture_sock = -1;
 const char *ifname = NULL;
@@ -93,6 +106,13 @@ typedef struct pcaprec_hdr_s {
 	uint32_t orig_len;       /* actual length of packet */
 } pcaprec_hdr_t;
 
+struct tpacket_ring {
+	struct tpacket_req3 req; /* kernel ring layout */
+	uint8_t *map;            /* mapped ring memory */
+	size_t size;             /* mapped size */
+	uint32_t block;          /* next block to read */
+};
+
 typedef struct ieee80211_radiotap_header {
 	u_int8_t  it_version;    /* set to 0 */
 	u_int8_t  it_pad;
@@ -196,6 +216,75 @@ void write_pcap_frame(FILE *o, uint32_t *sec, uint32_t *usec,
 }
 
 
+/*
+ * Frames read from the mmap ring are streamed with writev(), the iovecs
+ * point directly into the ring blocks so the frame data is never copied.
+ */
+struct stream_batch {
+	pcaprec_hdr_t hdr[STREAM_FRAMES];
+	struct iovec iov[STREAM_FRAMES * 2];
+	int n;
+};
+
+int stream_flush(struct stream_batch *b)
+{
+	struct iovec *iov = b->iov;
+	int cnt = b->n * 2;
+	ssize_t len;
+
+	b->n = 0;
+
+	while (cnt > 0)
+	{
+		len = writev(1, iov, cnt);
+
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		while (cnt > 0 && len >= iov->iov_len)
+		{
+			len -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+
+		if (cnt > 0)
+		{
+			iov->iov_base = (uint8_t *)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+
+	return 0;
+}
+
+int stream_add(struct stream_batch *b, void *data, uint32_t len, uint32_t olen,
+			   uint32_t sec, uint32_t usec)
+{
+	pcaprec_hdr_t *fhdr = &b->hdr[b->n];
+
+	fhdr->ts_sec   = sec;
+	fhdr->ts_usec  = usec;
+	fhdr->incl_len = len;
+	fhdr->orig_len = olen;
+
+	b->iov[b->n * 2].iov_base = fhdr;
+	b->iov[b->n * 2].iov_len = sizeof(*fhdr);
+	b->iov[b->n * 2 + 1].iov_base = data;
+	b->iov[b->n * 2 + 1].iov_len = len;
+
+	if (++b->n < STREAM_FRAMES)
+		return 0;
+
+	return stream_flush(b);
+}
+
+
 struct ringbuf * ringbuf_init(uint32_t num_item, uint16_t len_item)
 {
 	static struct ringbuf r;
@@ -254,6 +343,104 @@ void ringbuf_free(struct ringbuf *r)
 }
 
 
+int tpacket_ring_init(struct tpacket_ring *r, uint32_t size)
+{
+	int ver = TPACKET_V3;
+
+	memset(r, 0, sizeof(*r));
+
+	r->req.tp_block_size = TPACKET_BLOCK_SIZE;
+	r->req.tp_block_nr = size / TPACKET_BLOCK_SIZE;
+	r->req.tp_frame_size = TPACKET_FRAME_SIZE;
+	r->req.tp_frame_nr = r->req.tp_block_nr *
+		(TPACKET_BLOCK_SIZE / TPACKET_FRAME_SIZE);
+	r->req.tp_retire_blk_tov = TPACKET_BLOCK_TIMEOUT;
+
+	if (setsockopt(capture_sock, SOL_PACKET, PACKET_VERSION,
+				   &ver, sizeof(ver)) < 0)
+		return -1;
+
+	if (setsockopt(capture_sock, SOL_PACKET, PACKET_RX_RING,
+				   &r->req, sizeof(r->req)) < 0)
+		return -1;
+
+	r->size = (size_t)r->req.tp_block_size * r->req.tp_block_nr;
+	r->map = mmap(NULL, r->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+				  capture_sock, 0);
+
+	if (r->map == MAP_FAILED)
+	{
+		/* tear the ring down again, recvfrom() can't be used with it */
+		struct tpacket_req3 req = { 0 };
+		int err = errno;
+
+		setsockopt(capture_sock, SOL_PACKET, PACKET_RX_RING,
+				   &req, sizeof(req));
+
+		errno = err;
+		r->map = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+struct tpacket_block_desc * tpacket_ring_next(struct tpacket_ring *r)
+{
+	struct tpacket_block_desc *pbd = (struct tpacket_block_desc *)
+		(r->map + (size_t)r->block * r->req.tp_block_size);
+
+	if (!(__atomic_load_n(&pbd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+		  TP_STATUS_USER))
+		return NULL;
+
+	return pbd;
+}
+
+void tpacket_ring_release(struct tpacket_ring *r,
+						  struct tpacket_block_desc *pbd)
+{
+	__atomic_store_n(&pbd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+					 __ATOMIC_RELEASE);
+
+	r->block = (r->block + 1) % r->req.tp_block_nr;
+}
+
+void tpacket_ring_free(struct tpacket_ring *r)
+{
+	if (r->map)
+		munmap(r->map, r->size);
+
+	memset(r, 0, sizeof(*r));
+}
+
+
+/* accumulate the kernel drop counter, reading it resets the socket stats */
+void update_drop_stats(void)
+{
+	struct tpacket_stats_v3 st = { 0 };
+	socklen_t len = sizeof(st);
+
+	if (!getsockopt(capture_sock, SOL_PACKET, PACKET_STATISTICS, &st, &len))
+		frames_dropped += st.tp_drops;
+}
+
+
+int frame_filtered(const uint8_t *pkt, uint32_t len)
+{
+	const radiotap_hdr_t *rhdr = (const radiotap_hdr_t *)pkt;
+	uint8_t frametype;
+
+	if (len <= sizeof(radiotap_hdr_t) || le16(rhdr->it_len) >= len)
+		return 1;
+
+	frametype = pkt[le16(rhdr->it_len)];
+
+	return ((filter_data   && (frametype & FRAMETYPE_MASK) == FRAMETYPE_DATA) ||
+	        (filter_beacon && (frametype & FRAMETYPE_MASK) == FRAMETYPE_BEACON));
+}
+
+
 void msg(const char *fmt, ...)
 {
 	va_list ap;
@@ -271,16 +458,19 @@ void msg(const char *fmt, ...)
 int main(int argc, char **argv)
 {
 	int i, n;
-	struct ringbuf *ring;
+	struct ringbuf *ring = NULL;
 	struct ringbuf_entry *e;
+	struct tpacket_ring tpring = { 0 };
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *ppd;
+	struct stream_batch *batch = NULL;
+	struct pollfd pfd;
 	struct sockaddr_ll local = {
 		.sll_family   = AF_PACKET,
 		.sll_protocol = htons(ETH_P_ALL)
 	};
 
-	radiotap_hdr_t *rhdr;
-
-	uint8_t frametype;
+	uint8_t *pkt;
 	uint8_t pktbuf[0xFFFF];
 	ssize_t pktlen;
 
@@ -291,17 +481,16 @@ int main(int argc, char **argv)
 	uint8_t promisc        = 0;
 	uint8_t streaming      = 0;
 	uint8_t foreground     = 0;
-	uint8_t filter_data    = 0;
-	uint8_t filter_beacon  = 0;
 	uint8_t header_written = 0;
 
 	uint32_t ringsz   = 1024 * 1024; /* 1 Mbyte ring buffer */
+	uint32_t kringsz  = 1024 * 1024; /* 1 Mbyte kernel capture ring */
 	uint16_t pktcap   = 256;		 /* truncate frames after 265KB */
 
 	const char *output = NULL;
 
 
-	while ((opt = getopt(argc, argv, "i:r:c:o:sfhBD")) != -1)
+	while ((opt = getopt(argc, argv, "i:r:k:c:o:sfhBD")) != -1)
 	{
 		switch (opt)
 		{
@@ -324,6 +513,16 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'k':
+			kringsz = atoi(optarg);
+			if (kringsz && (kringsz < TPACKET_BLOCK_SIZE))
+			{
+				msg("Kernel ring size of %d bytes is too short, "
+					"must be at least %d bytes\n", kringsz, TPACKET_BLOCK_SIZE);
+				return 3;
+			}
+			break;
+
 		case 'c':
 			pktcap = atoi(optarg);
 			if (pktcap <= (sizeof(radiotap_hdr_t) + LEN_IEEE802_11_HDR))
@@ -358,8 +557,8 @@ int main(int argc, char **argv)
 		case 'h':
 			msg(
 				"Usage:\n"
-				"  %s -i {iface} -s [-b] [-d]\n"
-				"  %s -i {iface} -o {file} [-r len] [-c len] [-B] [-D] [-f]\n"
+				"  %s -i {iface} -s [-k len] [-b] [-d]\n"
+				"  %s -i {iface} -o {file} [-r len] [-k len] [-c len] [-B] [-D] [-f]\n"
 				"\n"
 				"  -i iface\n"
 				"    Specify interface to use, must be in monitor mode and\n"
@@ -372,6 +571,10 @@ int main(int argc, char **argv)
 				"  -r len\n"
 				"    Specify the amount of bytes to use for the ringbuffer.\n"
 				"    The default length is %d bytes.\n\n"
+				"  -k len\n"
+				"    Specify the amount of bytes to use for the memory mapped\n"
+				"    kernel capture ring, 0 reads frames one by one instead.\n"
+				"    The default length is %d bytes.\n\n"
 				"  -c len\n"
 				"    Truncate captured packets after given amount of bytes.\n"
 				"    The default size limit is %d bytes.\n\n"
@@ -383,7 +586,7 @@ int main(int argc, char **argv)
 				"    Do not daemonize but keep running in foreground.\n\n"
 				"  -h\n"
 				"    Display this help.\n\n",
-				argv[0], argv[0], ringsz, pktcap);
+				argv[0], argv[0], ringsz, kringsz, pktcap);
 
 			return 1;
 		}
@@ -426,6 +629,14 @@ int main(int argc, char **argv)
 		return 6;
 	}
 
+	if (kringsz && tpacket_ring_init(&tpring, kringsz))
+	{
+		msg("Unable to set up capture ring, reading frames one by one: %s\n",
+			strerror(errno));
+
+		tpacket_ring_free(&tpring);
+	}
+
 	if (bind(capture_sock, (struct sockaddr *)&local, sizeof(local)) == -1)
 	{
 		msg("Unable to bind to interface: %s\n",
@@ -477,8 +688,18 @@ int main(int argc, char **argv)
 	{
 		msg("Monitoring interface %s ...\n", ifname);
 		msg(" * Streaming data to stdout\n");
+
+		if (tpring.map && !(batch = calloc(1, sizeof(*batch))))
+		{
+			msg("Unable to allocate stream buffer: %s\n", strerror(errno));
+			return 5;
+		}
 	}
 
+	if (tpring.map)
+		msg(" * Using %d bytes capture ring with %d blocks\n",
+			(int)tpring.size, tpring.req.tp_block_nr);
+
 	msg(" * Beacon frames are %sfiltered\n", filter_beacon ? "" : "not ");
 	msg(" * Data frames are %sfiltered\n", filter_data ? "" : "not ");
 
@@ -516,8 +737,11 @@ int main(int argc, char **argv)
 
 				fclose(o);
 
+				update_drop_stats();
+
 				msg(" * %d frames captured\n", frames_captured);
 				msg(" * %d frames filtered\n", frames_filtered);
+				msg(" * %d frames dropped\n", frames_dropped);
 				msg(" * %d frames dumped\n", n);
 			}
 
@@ -527,31 +751,87 @@ int main(int argc, char **argv)
 		{
 			msg("Shutting down ...\n");
 
+			update_drop_stats();
+			msg(" * %d frames dropped\n", frames_dropped);
+
 			if (promisc)
 				set_promisc(0);
 
 			if (ring)
 				ringbuf_free(ring);
 
+			tpacket_ring_free(&tpring);
+			free(batch);
+
 			return 0;
 		}
 
-		pktlen = recvfrom(capture_sock, pktbuf, sizeof(pktbuf), 0, NULL, 0);
-		frames_captured++;
+		if (tpring.map)
+		{
+			if (!(pbd = tpacket_ring_next(&tpring)))
+			{
+				pfd.fd = capture_sock;
+				pfd.events = POLLIN | POLLERR;
+				pfd.revents = 0;
 
-		/* check received frametype, if we should filter it, rewind the ring */
-		rhdr = (radiotap_hdr_t *)pktbuf;
+				poll(&pfd, 1, -1);
+				continue;
+			}
 
-		if (pktlen <= sizeof(radiotap_hdr_t) || le16(rhdr->it_len) >= pktlen)
-		{
-			frames_filtered++;
+			if (streaming && !header_written)
+			{
+				write_pcap_header(stdout);
+				fflush(stdout);
+				header_written = 1;
+			}
+
+			ppd = (struct tpacket3_hdr *)
+				((uint8_t *)pbd + pbd->hdr.bh1.offset_to_first_pkt);
+
+			for (i = 0; i < pbd->hdr.bh1.num_pkts; i++)
+			{
+				pkt = (uint8_t *)ppd + ppd->tp_mac;
+				frames_captured++;
+
+				if (frame_filtered(pkt, ppd->tp_snaplen))
+				{
+					frames_filtered++;
+				}
+				else if (streaming)
+				{
+					stream_add(batch, pkt, ppd->tp_snaplen, ppd->tp_len,
+							   ppd->tp_sec, ppd->tp_nsec / 1000);
+				}
+				else
+				{
+					e = ringbuf_add(ring);
+					e->sec = ppd->tp_sec;
+					e->usec = ppd->tp_nsec / 1000;
+					e->olen = ppd->tp_len;
+					e->len = (ppd->tp_snaplen > pktcap) ? pktcap : ppd->tp_snaplen;
+
+					memcpy((void *)e + sizeof(*e), pkt, e->len);
+				}
+
+				ppd = (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+			}
+
+			/* the iovecs point into the block, write them before handing it back */
+			if (streaming)
+				stream_flush(batch);
+
+			tpacket_ring_release(&tpring, pbd);
 			continue;
 		}
 
-		frametype = *(uint8_t *)(pktbuf + le16(rhdr->it_len));
+		pktlen = recvfrom(capture_sock, pktbuf, sizeof(pktbuf), 0, NULL, 0);
+		if (pktlen < 0)
+			continue;
+
+		frames_captured++;
 
-		if ((filter_data   && (frametype & FRAMETYPE_MASK) == FRAMETYPE_DATA) ||
-		    (filter_beacon && (frametype & FRAMETYPE_MASK) == FRAMETYPE_BEACON))
+		/* check received frametype, if we should filter it, rewind the ring */
+		if (frame_filtered(pktbuf, pktlen))
 		{
 			frames_filtered++;
 			continue;
@@ -26,20 +26,33 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <net/if.h>
+
+#include <linux/nl80211.h>
+#include <netlink/genl/genl.h>
+#include <netlink/genl/family.h>
+#include <netlink/genl/ctrl.h>
+
+#include <libubox/list.h>
+#include <libubox/uloop.h>
 
 #include "iwinfo.h"
 
 #define RUN_DIR			"/var/run"
 #define LEDS_BASEPATH		"/sys/class/leds/"
-#define BACKEND_RETRY_DELAY	500000
+#define BACKEND_RETRY_DELAY	500	/* ms */
+#define POLL_BACKOFF_MAX	16	/* times the refresh interval */
 
-char *ifname;
-int qual_max;
+/* signal range mapped to 0..100% quality by the nl80211 backend of iwinfo */
+#define SIGNAL_MIN		-110	/* dBm */
+#define SIGNAL_MAX		-40	/* dBm */
 
 struct led {
 	char *sysfspath;
@@ -57,6 +70,34 @@ struct rule {
 	rule_t *next;
 };
 
+struct iface {
+	struct list_head list;
+	struct uloop_timeout timer;
+
+	char *ifname;
+	int ifindex;
+	const struct iwinfo_ops *iw;
+	int qual_max;
+
+	int refresh;		/* fastest poll interval, ms */
+	int interval;		/* current poll interval, ms */
+	int threshold;
+	int q0;
+
+	bool use_cqm;		/* allowed to take over the CQM threshold */
+	bool cqm;		/* connection quality monitor armed */
+	bool cqm_failed;	/* not supported on this interface */
+	int cqm_signal;
+
+	rule_t *rules;
+};
+
+static LIST_HEAD(ifaces);
+
+static struct nl_sock *nl_cmd, *nl_event;
+static struct uloop_fd nl_event_fd;
+static int nl80211_id = -1;
+
 void log_rules(rule_t *rules)
 {
 	rule_t *rule = rules;
@@ -158,20 +199,21 @@ void close_led(struct led **led)
 }
 
 
-int quality(const struct iwinfo_ops *iw, const char *ifname)
+int quality(struct iface *iface)
 {
+	const struct iwinfo_ops *iw = iface->iw;
 	int qual;
 
 	if ( ! iw ) return -1;
 
-	if (qual_max < 1)
-		if (iw->quality_max(ifname, &qual_max))
+	if (iface->qual_max < 1)
+		if (iw->quality_max(iface->ifname, &iface->qual_max))
 			return -1;
 
-	if (iw->quality(ifname, &qual))
+	if (iw->quality(iface->ifname, &qual))
 		return -1;
 
-	return ( qual * 100 ) / qual_max ;
+	return ( qual * 100 ) / iface->qual_max ;
 }
 
 int open_backend(const struct iwinfo_ops **iw, const char *ifname)
@@ -206,34 +248,273 @@ void update_leds(rule_t *rules, int q)
 	}
 }
 
-int main(int argc, char **argv)
+/*
+ * Program a single RSSI threshold at the current signal level, with the
+ * sustain threshold as hysteresis. The kernel then notifies us once the
+ * signal leaves the band that would require a LED update, after which the
+ * threshold is moved to the new level. Only supported on client interfaces
+ * of drivers implementing connection quality monitoring.
+ *
+ * An interface has a single CQM configuration, so this replaces whatever
+ * wpa_supplicant set up for bgscan or signal monitoring. It is therefore
+ * only done for interfaces given with -c.
+ */
+int cqm_arm(struct iface *iface)
 {
-	int i,q,q0,r,s;
-	const struct iwinfo_ops *iw = NULL;
-	rule_t *headrule = NULL, *currentrule = NULL;
+	struct nl_msg *msg;
+	struct nlattr *cqm;
+	int signal, hyst;
+	int ret = -1;
 
-	if (argc < 9 || ( (argc-4) % 5 != 0 ) )
-	{
-		printf("syntax: %s (ifname) (refresh) (threshold) (rule) [rule] ...\n", argv[0]);
-		printf("  rule: (sysfs-name) (minq) (maxq) (offset) (factore)\n");
-		return 1;
+	if (!iface->use_cqm || nl80211_id < 0 || iface->cqm_failed || !iface->ifindex ||
+	    !iface->iw || iface->iw->signal(iface->ifname, &signal))
+		return -1;
+
+	if (iface->cqm && iface->cqm_signal == signal)
+		return 0;
+
+	/* the sustain threshold is in percent of quality, the hysteresis in dBm */
+	hyst = iface->threshold * (SIGNAL_MAX - SIGNAL_MIN) / 100;
+	if (hyst < 1)
+		hyst = 1;
+
+	msg = nlmsg_alloc();
+	if (!msg)
+		return -1;
+
+	genlmsg_put(msg, NL_AUTO_PID, NL_AUTO_SEQ, nl80211_id, 0, 0,
+		    NL80211_CMD_SET_CQM, 0);
+	nla_put_u32(msg, NL80211_ATTR_IFINDEX, iface->ifindex);
+
+	cqm = nla_nest_start(msg, NL80211_ATTR_CQM);
+	if (!cqm)
+		goto out;
+
+	nla_put_u32(msg, NL80211_ATTR_CQM_RSSI_THOLD, (uint32_t)signal);
+	nla_put_u32(msg, NL80211_ATTR_CQM_RSSI_HYST, hyst);
+	nla_nest_end(msg, cqm);
+
+	if (nl_send_auto_complete(nl_cmd, msg) < 0)
+		goto out;
+
+	ret = nl_wait_for_ack(nl_cmd);
+	if (!ret)
+		iface->cqm_signal = signal;
+	else
+		iface->cqm_failed = true;
+
+out:
+	nlmsg_free(msg);
+	return ret;
+}
+
+/*
+ * The interface may not exist yet at startup and gets a new index whenever
+ * wifi is reloaded. Look it up again, a new interface may support CQM even
+ * if the previous one did not.
+ */
+void iface_update_ifindex(struct iface *iface)
+{
+	int ifindex = if_nametoindex(iface->ifname);
+
+	if (ifindex == iface->ifindex)
+		return;
+
+	iface->ifindex = ifindex;
+	iface->cqm = false;
+	iface->cqm_failed = false;
+	iface->qual_max = 0;
+}
+
+void iface_update(struct uloop_timeout *t)
+{
+	struct iface *iface = container_of(t, struct iface, timer);
+	int q, s = iface->threshold;
+	bool changed = false;
+
+	iface_update_ifindex(iface);
+
+	q = quality(iface);
+	if ( q < iface->q0 - s || q > iface->q0 + s ) {
+		update_leds(iface->rules, q);
+		iface->q0 = q;
+		changed = true;
+	}
+
+	// re-open backend...
+	if ( q == -1 && iface->q0 == -1 ) {
+		iface->cqm = false;
+		iface->iw = NULL;
+		iface_update_ifindex(iface);
+		if (open_backend(&iface->iw, iface->ifname)) {
+			uloop_timeout_set(t, BACKEND_RETRY_DELAY);
+			return;
+		}
+	}
+
+	if (q >= 0 && !cqm_arm(iface)) {
+		if (!iface->cqm)
+			syslog(LOG_INFO, "%s: using connection quality events\n",
+			       iface->ifname);
+		iface->cqm = true;
+	} else {
+		iface->cqm = false;
 	}
 
-	ifname = argv[1];
+	/*
+	 * Poll at the configured rate while the signal changes and back off
+	 * while it is stable. With connection quality events, polling only
+	 * serves as a safety net for missed notifications.
+	 */
+	if (iface->cqm)
+		iface->interval = iface->refresh * POLL_BACKOFF_MAX;
+	else if (changed)
+		iface->interval = iface->refresh;
+	else if (iface->interval < iface->refresh * POLL_BACKOFF_MAX)
+		iface->interval *= 2;
+
+	uloop_timeout_set(t, iface->interval);
+}
+
+struct iface * iface_find(int ifindex)
+{
+	struct iface *iface;
+
+	list_for_each_entry(iface, &ifaces, list)
+		if (iface->ifindex == ifindex)
+			return iface;
+
+	return NULL;
+}
+
+int nl_event_cb(struct nl_msg *msg, void *arg)
+{
+	struct genlmsghdr *gnlh = nlmsg_data(nlmsg_hdr(msg));
+	struct nlattr *tb[NL80211_ATTR_MAX + 1];
+	struct iface *iface;
+	int ifindex;
+
+	if (nla_parse(tb, NL80211_ATTR_MAX, genlmsg_attrdata(gnlh, 0),
+		      genlmsg_attrlen(gnlh, 0), NULL) < 0)
+		return NL_SKIP;
+
+	if (!tb[NL80211_ATTR_IFINDEX])
+		return NL_SKIP;
+
+	ifindex = nla_get_u32(tb[NL80211_ATTR_IFINDEX]);
+	iface = iface_find(ifindex);
+	if (!iface && gnlh->cmd == NL80211_CMD_CONNECT) {
+		/* possibly one of ours, recreated since the last update */
+		list_for_each_entry(iface, &ifaces, list)
+			iface_update_ifindex(iface);
+		iface = iface_find(ifindex);
+	}
+	if (!iface)
+		return NL_SKIP;
+
+	switch (gnlh->cmd) {
+	case NL80211_CMD_CONNECT:
+		/* the interface may have changed into client mode */
+		iface->cqm_failed = false;
+		/* fall through */
+	case NL80211_CMD_NOTIFY_CQM:
+	case NL80211_CMD_NEW_STATION:
+	case NL80211_CMD_DEL_STATION:
+	case NL80211_CMD_DISCONNECT:
+		/* re-evaluate now and resume fast polling */
+		iface->cqm = false;
+		iface->interval = iface->refresh;
+		uloop_timeout_set(&iface->timer, 0);
+		break;
+	default:
+		break;
+	}
+
+	return NL_SKIP;
+}
+
+void nl_event_read(struct uloop_fd *u, unsigned int events)
+{
+	nl_recvmsgs_default(nl_event);
+}
+
+/* without nl80211 all interfaces simply fall back to polling */
+int nl80211_init(void)
+{
+	int id, mlme;
+
+	nl_cmd = nl_socket_alloc();
+	nl_event = nl_socket_alloc();
+	if (!nl_cmd || !nl_event)
+		return -1;
+
+	if (genl_connect(nl_cmd) || genl_connect(nl_event))
+		return -1;
+
+	id = genl_ctrl_resolve(nl_cmd, "nl80211");
+	if (id < 0)
+		return -1;
+
+	mlme = genl_ctrl_resolve_grp(nl_cmd, "nl80211", "mlme");
+	if (mlme < 0 || nl_socket_add_membership(nl_event, mlme))
+		return -1;
+
+	nl_socket_disable_seq_check(nl_event);
+	nl_socket_modify_cb(nl_event, NL_CB_VALID, NL_CB_CUSTOM, nl_event_cb, NULL);
+
+	nl_event_fd.fd = nl_socket_get_fd(nl_event);
+	nl_event_fd.cb = nl_event_read;
+	uloop_fd_add(&nl_event_fd, ULOOP_READ);
+
+	nl80211_id = id;
+	return 0;
+}
+
+/* [-c] (ifname) (refresh) (threshold) (rule) [rule] ... */
+int iface_init(int argc, char **argv)
+{
+	rule_t *headrule = NULL, *currentrule = NULL;
+	struct iface *iface;
+	bool use_cqm = false;
+	int i, r, s;
+
+	if (argc > 0 && !strcmp(argv[0], "-c")) {
+		use_cqm = true;
+		argc--;
+		argv++;
+	}
+
+	if (argc < 8 || ( (argc-3) % 5 != 0 ) )
+		return 1;
 
 	/* refresh interval */
-	if ( sscanf(argv[2], "%d", &r) != 1 )
+	if ( sscanf(argv[1], "%d", &r) != 1 )
 		return 1;
 
 	/* sustain threshold */
-	if ( sscanf(argv[3], "%d", &s) != 1 )
+	if ( sscanf(argv[2], "%d", &s) != 1 )
 		return 1;
 
-	openlog("rssileds", LOG_PID, LOG_DAEMON);
-	syslog(LOG_INFO, "monitoring %s, refresh rate %d, threshold %d\n", ifname, r, s);
+	iface = calloc(1, sizeof(*iface));
+	if (!iface)
+		return 1;
+
+	iface->ifname = argv[0];
+	iface->threshold = s;
+	iface->use_cqm = use_cqm;
+	iface->q0 = -1;
+
+	/* refresh is given in microseconds */
+	iface->refresh = r / 1000;
+	if (iface->refresh < 1)
+		iface->refresh = 1;
+	iface->interval = iface->refresh;
+	iface->timer.cb = iface_update;
+
+	syslog(LOG_INFO, "monitoring %s, refresh rate %d, threshold %d\n", argv[0], r, s);
 
 	currentrule = headrule;
-	for (i=4; i<argc; i=i+5) {
+	for (i=3; i<argc; i=i+5) {
 		if (! currentrule)
 		{
 			/* first element in the list */
@@ -264,25 +545,41 @@ int main(int argc, char **argv)
 	}
 	log_rules(headrule);
 
-	q0 = -1;
-	do {
-		q = quality(iw, ifname);
-		if ( q < q0 - s || q > q0 + s ) {
-			update_leds(headrule, q);
-			q0=q;
-		};
-		// re-open backend...
-		if ( q == -1 && q0 == -1 ) {
-			if (iw) {
-				iwinfo_finish();
-				iw=NULL;
-				usleep(BACKEND_RETRY_DELAY);
-			}
-			while (open_backend(&iw, ifname))
-				usleep(BACKEND_RETRY_DELAY);
+	iface->rules = headrule;
+	list_add_tail(&iface->list, &ifaces);
+	uloop_timeout_set(&iface->timer, 0);
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, start;
+
+	openlog("rssileds", LOG_PID, LOG_DAEMON);
+	uloop_init();
+
+	/* interfaces are separated by "--" */
+	for (i = start = 1; i <= argc; i++) {
+		if (i < argc && strcmp(argv[i], "--"))
+			continue;
+
+		if (iface_init(i - start, &argv[start]))
+		{
+			printf("syntax: %s [-c] (ifname) (refresh) (threshold) (rule) [rule] ... [-- [-c] (ifname) ...]\n", argv[0]);
+			printf("  -c: use connection quality events, overrides the CQM threshold of wpa_supplicant\n");
+			printf("  rule: (sysfs-name) (minq) (maxq) (offset) (factore)\n");
+			return 1;
 		}
-		usleep(r);
-	} while(1);
+
+		start = i + 1;
+	}
+
+	if (nl80211_init())
+		syslog(LOG_INFO, "nl80211 unavailable, polling only\n");
+
+	uloop_run();
+	uloop_done();
 
 	iwinfo_finish();
 
@@ -0,0 +1,84 @@
+/*
+ * Host check of crc32() against the bitwise definition
+ *
+ * Covers empty input, every start alignment and lengths around the
+ * slicing-by-8 threshold up to several KiB, both in one call and split
+ * into two calls.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License v2
+ * as published by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "crc32.h"
+
+static uint32_t crc32_bitwise(uint32_t val, const void *ss, int len)
+{
+	const unsigned char *s = ss;
+	int i;
+
+	while (--len >= 0) {
+		val ^= *s++;
+		for (i = 0; i < 8; i++)
+			val = (val >> 1) ^ (0xedb88320 & -(val & 1));
+	}
+
+	return val;
+}
+
+static const int lengths[] = {
+	0, 1, 3, 7, 8, 9, 15, 16, 63, 64, 65, 71, 72, 127, 128, 1000,
+	4095, 4096, 4097, 8191, 65536 + 13,
+};
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[65536 + 64];
+	static const uint32_t seeds[] = { 0, 0xffffffff, 0x12345678 };
+	uint32_t ref, val;
+	int i, j, ofs, split, len, errors = 0, tests = 0;
+
+	if (crc32buf("123456789", 9) != ~0xcbf43926U) {
+		fprintf(stderr, "check value mismatch: %08x\n", ~crc32buf("123456789", 9));
+		errors++;
+	}
+
+	srand(1);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		len = lengths[i];
+
+		for (ofs = 0; ofs < 8; ofs++) {
+			for (j = 0; j < sizeof(seeds) / sizeof(seeds[0]); j++) {
+				ref = crc32_bitwise(seeds[j], buf + ofs, len);
+
+				val = crc32(seeds[j], buf + ofs, len);
+				tests++;
+				if (val != ref) {
+					fprintf(stderr, "len %d ofs %d seed %08x: %08x != %08x\n",
+						len, ofs, seeds[j], val, ref);
+					errors++;
+				}
+
+				split = len / 3;
+				val = crc32(seeds[j], buf + ofs, split);
+				val = crc32(val, buf + ofs + split, len - split);
+				tests++;
+				if (val != ref) {
+					fprintf(stderr, "len %d ofs %d seed %08x split %d: %08x != %08x\n",
+						len, ofs, seeds[j], split, val, ref);
+					errors++;
+				}
+			}
+		}
+	}
+
+	printf("crc32: %d of %d tests failed\n", errors, tests);
+
+	return !!errors;
+}
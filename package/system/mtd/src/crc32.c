@@ -93,3 +93,76 @@ const uint32_t crc32_table[256] = {
 	0x5d681b02L, 0x2a6f2b94L, 0xb40bbe37L, 0xc30c8ea1L, 0x5a05df1bL,
 	0x2d02ef8dL
 };
+
+#if defined(__ARM_FEATURE_CRC32) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_acle.h>
+#include <string.h>
+
+/* ARMv8 has CRC32 instructions for exactly this polynomial */
+uint32_t crc32(uint32_t val, const void *ss, int len)
+{
+	const unsigned char *s = ss;
+	uint64_t v;
+
+	for (; len > 0 && ((uintptr_t)s & 7); len--)
+		val = __crc32b(val, *s++);
+
+	for (; len >= 8; len -= 8, s += 8) {
+		memcpy(&v, s, sizeof(v));
+		val = __crc32d(val, v);
+	}
+
+	while (--len >= 0)
+		val = __crc32b(val, *s++);
+
+	return val;
+}
+#else
+/*
+ * Slicing-by-8: crc32_slice[k][n] is the CRC of byte n followed by k zero
+ * bytes, which allows folding in 8 bytes per iteration with independent
+ * table lookups.  The lookups are done per byte, so this works the same
+ * regardless of endianness or alignment.
+ */
+static uint32_t crc32_slice[8][256];
+static int crc32_slice_ready;
+
+static void crc32_slice_init(void)
+{
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc32_slice[0][i] = crc32_table[i];
+		for (k = 1; k < 8; k++)
+			crc32_slice[k][i] = (crc32_slice[k - 1][i] >> 8) ^
+				crc32_table[crc32_slice[k - 1][i] & 0xff];
+	}
+
+	crc32_slice_ready = 1;
+}
+
+uint32_t crc32(uint32_t val, const void *ss, int len)
+{
+	const unsigned char *s = ss;
+
+	if (len >= 64) {
+		if (!crc32_slice_ready)
+			crc32_slice_init();
+
+		for (; len >= 8; len -= 8, s += 8)
+			val = crc32_slice[7][(val ^ s[0]) & 0xff] ^
+			      crc32_slice[6][((val >> 8) ^ s[1]) & 0xff] ^
+			      crc32_slice[5][((val >> 16) ^ s[2]) & 0xff] ^
+			      crc32_slice[4][((val >> 24) ^ s[3]) & 0xff] ^
+			      crc32_slice[3][s[4]] ^
+			      crc32_slice[2][s[5]] ^
+			      crc32_slice[1][s[6]] ^
+			      crc32_slice[0][s[7]];
+	}
+
+	while (--len >= 0)
+		val = crc32_table[(val ^ *s++) & 0xff] ^ (val >> 8);
+
+	return val;
+}
+#endif
@@ -32,6 +32,12 @@
 
 #define PAD(x) (((x)+3)&~3)
 
+/* data nodes must not cross a page boundary of the file */
+#define JFFS2_DATA_MAX		4096
+
+/* eraseblocks are collected up to this size before erasing and writing them */
+#define JFFS2_WRITE_BATCH_SIZE	(512 * 1024)
+
 #if BYTE_ORDER == BIG_ENDIAN
 # define CLEANMARKER "\x19\x85\x20\x03\x00\x00\x00\x0c\xf0\x60\xdc\x98"
 #else
@@ -40,6 +46,9 @@
 
 static int last_ino = 0;
 static int last_version = 0;
+static char *batch = NULL;
+static int batch_blocks = 0;
+static int batch_max = 0;
 static char *buf = NULL;
 static int ofs = 0;
 static int outfd = -1;
@@ -48,6 +57,68 @@ static int target_ino = 0;
 
 static void prep_eraseblock(void);
 
+static int batch_alloc(void)
+{
+	/* at least one eraseblock, nothing is written in dry run mode */
+	batch_max = JFFS2_WRITE_BATCH_SIZE / erasesize;
+	if (batch_max < 1 || dry_run)
+		batch_max = 1;
+
+	batch = malloc(batch_max * erasesize);
+	batch_blocks = 0;
+	buf = batch;
+
+	return batch ? 0 : -1;
+}
+
+static void batch_free(void)
+{
+	free(batch);
+	batch = buf = NULL;
+}
+
+/*
+ * Erase and write all completed eraseblocks. Runs of good blocks are written
+ * with a single write() call. In dry run mode the flash is left untouched
+ * and only the position is advanced.
+ */
+static void flush_blocks(void)
+{
+	int i = 0, n;
+
+	while (i < batch_blocks) {
+		while ((mtdofs < mtdsize) && mtd_block_is_bad(outfd, mtdofs)) {
+			if (!quiet)
+				fprintf(stderr, "\nSkipping bad block at 0x%08x   ", mtdofs);
+
+			mtdofs += erasesize;
+
+			/* Move the file pointer along over the bad block. */
+			if (!dry_run)
+				lseek(outfd, erasesize, SEEK_CUR);
+		}
+
+		for (n = 1; i + n < batch_blocks; n++) {
+			if (mtdofs + n * erasesize >= mtdsize ||
+			    mtd_block_is_bad(outfd, mtdofs + n * erasesize))
+				break;
+		}
+
+		if (!dry_run) {
+			int j;
+
+			for (j = 0; j < n; j++)
+				mtd_erase_block(outfd, mtdofs + j * erasesize);
+			write(outfd, batch + i * erasesize, n * erasesize);
+		}
+		mtdofs += n * erasesize;
+		i += n;
+	}
+
+	batch_blocks = 0;
+	buf = batch;
+}
+
 static void pad(int size)
 {
 	if ((ofs % size == 0) && (ofs < erasesize))
@@ -59,18 +130,10 @@ static void pad(int size)
 	}
 	ofs = ofs % erasesize;
 	if (ofs == 0) {
-		while (mtd_block_is_bad(outfd, mtdofs) && (mtdofs < mtdsize)) {
-			if (!quiet)
-				fprintf(stderr, "\nSkipping bad block at 0x%08x   ", mtdofs);
-
-			mtdofs += erasesize;
-
-			/* Move the file pointer along over the bad block. */
-			lseek(outfd, erasesize, SEEK_CUR);
-		}
-		mtd_erase_block(outfd, mtdofs);
-		write(outfd, buf, erasesize);
-		mtdofs += erasesize;
+		if (++batch_blocks == batch_max)
+			flush_blocks();
+		else
+			buf = batch + batch_blocks * erasesize;
 	}
 }
 
@@ -165,7 +228,7 @@ static void add_file(const char *name, int parent)
 	int inode, f_offset = 0, fd;
 	struct jffs2_raw_inode ri;
 	struct stat st;
-	char wbuf[4096];
+	char wbuf[JFFS2_DATA_MAX];
 	const char *fname;
 
 	if (stat(name, &st)) {
@@ -212,8 +275,13 @@ static void add_file(const char *name, int parent)
 			prep_eraseblock();
 		}
 
-		if (len > sizeof(wbuf))
-			len = sizeof(wbuf);
+		/*
+		 * Use full pages where possible. After a node shortened by the
+		 * end of an eraseblock, the next one only fills up the rest of
+		 * the page, so that the following nodes are page aligned again.
+		 */
+		if (len > JFFS2_DATA_MAX - (f_offset % JFFS2_DATA_MAX))
+			len = JFFS2_DATA_MAX - (f_offset % JFFS2_DATA_MAX);
 
 		len = read(fd, wbuf, len);
 		if (len <= 0)
@@ -241,7 +309,10 @@ int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename)
 	outfd = fd;
 	mtdofs = ofs;
 
-	buf = malloc(erasesize);
+	if (batch_alloc()) {
+		fprintf(stderr, "Out of memory!\n");
+		exit(1);
+	}
 	target_ino = 1;
 	if (!last_ino)
 		last_ino = 1;
@@ -251,7 +322,8 @@ int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename)
 	/* add eof marker, pad to eraseblock size and write the data */
 	add_data(JFFS2_EOF, sizeof(JFFS2_EOF) - 1);
 	pad(erasesize);
-	free(buf);
+	flush_blocks();
+	batch_free();
 
 	return (mtdofs - ofs);
 }
@@ -285,17 +357,16 @@ void mtd_parse_jffs2data(const char *buf, const char *dir)
 
 int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 {
-	int err = -1, fdeof = 0;
+	int err = -1, fdeof = 0, start;
 
-	outfd = mtd_check_open(mtd, true);
+	outfd = mtd_check_open(mtd, !dry_run);
 	if (outfd < 0)
 		return -1;
 
-	if (quiet < 2)
+	if (quiet < 2 && !dry_run)
 		fprintf(stderr, "Appending %s to jffs2 partition %s\n", filename, mtd);
 
-	buf = malloc(erasesize);
-	if (!buf) {
+	if (batch_alloc()) {
 		fprintf(stderr, "Out of memory!\n");
 		goto done;
 	}
@@ -335,6 +406,7 @@ int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 	/* jump back one eraseblock */
 	mtdofs -= erasesize;
 	lseek(outfd, mtdofs, SEEK_SET);
+	start = mtdofs;
 
 	ofs = 0;
 
@@ -350,17 +422,26 @@ int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 	/* add eof marker, pad to eraseblock size and write the data */
 	add_data(JFFS2_EOF, sizeof(JFFS2_EOF) - 1);
 	pad(erasesize);
+	flush_blocks();
 
 	err = 0;
 
+	if (dry_run) {
+		printf("Appending %s to jffs2 partition %s needs %d of %d eraseblocks at 0x%08x\n",
+		       filename, mtd, (mtdofs - start) / erasesize,
+		       (mtdsize - start) / erasesize, start);
+		if (mtdofs > mtdsize)
+			err = -1;
+		goto done;
+	}
+
 	if (trx_fixup) {
 	  trx_fixup(outfd, mtd);
 	}
 
 done:
 	close(outfd);
-	if (buf)
-		free(buf);
+	batch_free();
 
 	return err;
 }
@@ -90,6 +90,7 @@ static char *tpl_uboot_args_part;
 static int buflen = 0;
 int quiet;
 int no_erase;
+int dry_run;
 int mtdsize = 0;
 int erasesize = 0;
 int jffs2_skip_bytes=0;
@@ -806,6 +807,8 @@ static void usage(void)
 	"        -q                      quiet mode (once: no [w] on writing,\n"
 	"                                           twice: no status messages)\n"
 	"        -n                      write without first erasing the blocks\n"
+	"        -D                      dry run for jffs2write, only report the number of\n"
+	"                                eraseblocks the data would use\n"
 	"        -r                      reboot after successful command\n"
 	"        -f                      force write without trx checks\n"
 	"        -e <device>             erase <device> before executing the command\n"
@@ -882,12 +885,13 @@ int main (int argc, char **argv)
 	buflen = 0;
 	quiet = 0;
 	no_erase = 0;
+	dry_run = 0;
 
 	while ((ch = getopt(argc, argv,
 #ifdef FIS_SUPPORT
 			"F:"
 #endif
-			"frnqe:d:s:j:p:o:c:t:l:M:")) != -1)
+			"frnqDe:d:s:j:p:o:c:t:l:M:")) != -1)
 		switch (ch) {
 			case 'f':
 				force = 1;
@@ -898,6 +902,9 @@ int main (int argc, char **argv)
 			case 'n':
 				no_erase = 1;
 				break;
+			case 'D':
+				dry_run = 1;
+				break;
 			case 'j':
 				jffs2file = optarg;
 				break;
@@ -1046,6 +1053,10 @@ int main (int argc, char **argv)
 		usage();
 	}
 
+	/* only jffs2write knows how to not touch the flash */
+	if (dry_run && (cmd != CMD_JFFS2WRITE || erase[0] || boot))
+		usage();
+
 	sync();
 
 	i = 0;
@@ -1080,6 +1091,8 @@ int main (int argc, char **argv)
 			mtd_write(imagefd, device, fis_layout, part_offset);
 			break;
 		case CMD_JFFS2WRITE:
+			if (dry_run)
+				return mtd_write_jffs2(device, imagefile, jffs2dir) ? 1 : 0;
 			if (!unlocked)
 				mtd_unlock(device);
 			mtd_write_jffs2(device, imagefile, jffs2dir);
@@ -11,6 +11,7 @@
 #define JFFS2_EOF "\xde\xad\xc0\xde"
 
 extern int quiet;
+extern int dry_run;
 extern int mtdsize;
 extern int erasesize;
 extern uint32_t opt_trxmagic;
@@ -12,9 +12,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "crc32.h"
+
 #if !defined(__BYTE_ORDER)
 #error "Unknown byte order"
 #endif
@@ -41,6 +44,9 @@
 #error "Unsupported endianness"
 #endif
 
+/* Chunk size used when streaming image data */
+#define BCM4908IMG_BUF_SIZE		(64 * 1024)
+
 #define WFI_VERSION			0x00005732
 #define WFI_VERSION_NAND_1MB_DATA	0x00005731
 
@@ -87,97 +93,79 @@ struct bcm4908img_info {
 	size_t tail_offset;
 	uint32_t crc32;			/* Calculated checksum */
 	struct bcm4908img_tail tail;
+	const uint8_t *data;		/* Whole image, mapped or read */
+	size_t size;
+	bool mapped;
 };
 
 char *pathname;
 
-static inline size_t bcm4908img_min(size_t x, size_t y) {
-	return x < y ? x : y;
-}
-
 /**************************************************
  * CRC32
  **************************************************/
 
-static const uint32_t crc32_tbl[] = {
-	0x00000000, 0x77073096, 0xee0e612c, 0x990951ba,
-	0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
-	0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-	0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
-	0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de,
-	0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-	0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,
-	0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
-	0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-	0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
-	0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940,
-	0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-	0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116,
-	0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
-	0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-	0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
-	0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a,
-	0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-	0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818,
-	0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
-	0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-	0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
-	0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c,
-	0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-	0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2,
-	0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
-	0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-	0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
-	0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086,
-	0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-	0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4,
-	0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
-	0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-	0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
-	0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8,
-	0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-	0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe,
-	0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
-	0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-	0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
-	0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252,
-	0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-	0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60,
-	0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
-	0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-	0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
-	0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04,
-	0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-	0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a,
-	0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
-	0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-	0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
-	0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e,
-	0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-	0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c,
-	0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
-	0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-	0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
-	0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0,
-	0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-	0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6,
-	0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
-	0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-	0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d,
-};
-
+/* The table and slicing-by-8 code are shared with mtd, see crc32.c */
 uint32_t bcm4908img_crc32(uint32_t crc, const void *buf, size_t len) {
 	const uint8_t *in = buf;
+	size_t bytes;
 
-	while (len) {
-		crc = crc32_tbl[(crc ^ *in) & 0xff] ^ (crc >> 8);
-		in++;
-		len--;
+	/* crc32() takes an int length */
+	for (; len; len -= bytes, in += bytes) {
+		bytes = len < (1 << 30) ? len : (1 << 30);
+		crc = crc32(crc, in, bytes);
 	}
 
 	return crc;
 }
 
+/* a * b modulo the CRC32 polynomial, both in the reflected bit order */
+static uint32_t bcm4908img_crc32_multmodp(uint32_t a, uint32_t b) {
+	uint32_t m = 1U << 31;
+	uint32_t p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ 0xedb88320 : b >> 1;
+	}
+
+	return p;
+}
+
+/**
+ * bcm4908img_crc32_update - update CRC32 after changing data in place
+ *
+ * The CRC is linear, so replacing old bytes by new ones changes it by the CRC
+ * of (old ^ new) followed by as many zeros as there are bytes after the
+ * change. Appending zeros is a multiplication by x^(8 * n) modulo polynomial,
+ * which takes log(n) steps instead of reading the rest of the image.
+ */
+static uint32_t bcm4908img_crc32_update(uint32_t crc, const void *old, const void *new, size_t len, size_t after) {
+	const uint8_t *o = old;
+	const uint8_t *n = new;
+	uint32_t delta = 0;
+	uint32_t xp = 1U << 30;		/* x^1 */
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		uint8_t d = o[i] ^ n[i];
+
+		delta = bcm4908img_crc32(delta, &d, 1);
+	}
+
+	for (after *= 8; after; after >>= 1) {
+		if (after & 1)
+			delta = bcm4908img_crc32_multmodp(xp, delta);
+		xp = bcm4908img_crc32_multmodp(xp, xp);
+	}
+
+	return crc ^ delta;
+}
+
 /**************************************************
  * Helpers
  **************************************************/
@@ -211,28 +199,59 @@ static void bcm4908img_close(FILE *fp) {
 		fclose(fp);
 }
 
-static int bcm4908img_calc_crc32(FILE *fp, struct bcm4908img_info *info) {
-	uint8_t buf[1024];
-	size_t length;
-	size_t bytes;
+/*
+ * Images are held in tmpfs or on a flash filesystem, so mapping them lets
+ * parsing, checksumming and extracting work on the same pages without
+ * copying them around. Fall back to reading the whole file if that fails.
+ */
+static int bcm4908img_map(FILE *fp, struct bcm4908img_info *info) {
+	struct stat st;
+	uint8_t *buf;
+	int err;
 
-	/* Start with cferom (or bootfs) - skip vendor header */
-	fseek(fp, info->cferom_offset, SEEK_SET);
+	if (fstat(fileno(fp), &st)) {
+		err = -errno;
+		fprintf(stderr, "Failed to fstat: %d\n", err);
+		return err;
+	}
+	info->size = st.st_size;
+	if (!info->size) {
+		fprintf(stderr, "Empty file\n");
+		return -EPROTO;
+	}
 
-	info->crc32 = 0xffffffff;
-	length = info->tail_offset - info->cferom_offset;
-	while (length && (bytes = fread(buf, 1, bcm4908img_min(sizeof(buf), length), fp)) > 0) {
-		info->crc32 = bcm4908img_crc32(info->crc32, buf, bytes);
-		length -= bytes;
+	buf = mmap(NULL, info->size, PROT_READ, MAP_SHARED, fileno(fp), 0);
+	if (buf != MAP_FAILED) {
+		info->data = buf;
+		info->mapped = true;
+		return 0;
 	}
-	if (length) {
-		fprintf(stderr, "Failed to read last %zd B of data\n", length);
+
+	buf = malloc(info->size);
+	if (!buf)
+		return -ENOMEM;
+
+	if (pread(fileno(fp), buf, info->size, 0) != info->size) {
+		fprintf(stderr, "Failed to read %zu B of data\n", info->size);
+		free(buf);
 		return -EIO;
 	}
+	info->data = buf;
 
 	return 0;
 }
 
+static void bcm4908img_unmap(struct bcm4908img_info *info) {
+	if (!info->data)
+		return;
+
+	if (info->mapped)
+		munmap((void *)info->data, info->size);
+	else
+		free((void *)info->data);
+	info->data = NULL;
+}
+
 /**************************************************
  * Existing firmware parser
  **************************************************/
@@ -275,46 +294,39 @@ static bool bcm4908img_is_all_ff(const void *buf, size_t length)
 
 static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 	struct bcm4908img_tail *tail = &info->tail;
-	struct linksys_tail *linksys;
-	struct chk_header *chk;
-	struct stat st;
-	uint8_t buf[1024];
-	size_t file_size;
-	uint16_t tmp16;
+	const struct linksys_tail *linksys;
+	const struct chk_header *chk;
+	const uint8_t *data;
 	size_t length;
-	size_t bytes;
 	int err = 0;
 
 	memset(info, 0, sizeof(*info));
 
-	/* File size */
-
-	if (fstat(fileno(fp), &st)) {
-		err = -errno;
-		fprintf(stderr, "Failed to fstat: %d\n", err);
+	err = bcm4908img_map(fp, info);
+	if (err)
 		return err;
+	data = info->data;
+
+	if (info->size < 1024) {
+		fprintf(stderr, "Failed to read file header\n");
+		err = -EIO;
+		goto err_unmap;
 	}
-	file_size = st.st_size;
 
-	info->tail_offset = file_size - sizeof(*tail);
+	info->tail_offset = info->size - sizeof(*tail);
 
 	/* Vendor formats */
 
-	rewind(fp);
-	if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf)) {
-		fprintf(stderr, "Failed to read file header\n");
-		return -EIO;
-	}
-	chk = (void *)buf;
+	chk = (const void *)data;
 	if (be32_to_cpu(chk->magic) == 0x2a23245e)
 		info->cferom_offset = be32_to_cpu(chk->header_len);
-
-	fseek(fp, -sizeof(buf), SEEK_END);
-	if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf)) {
-		fprintf(stderr, "Failed to read file header\n");
-		return -EIO;
+	if (info->cferom_offset >= info->tail_offset) {
+		fprintf(stderr, "Invalid vendor header length\n");
+		err = -EPROTO;
+		goto err_unmap;
 	}
-	linksys = (void *)(buf + sizeof(buf) - sizeof(*linksys));
+
+	linksys = (const void *)(data + info->size - sizeof(*linksys));
 	if (!memcmp(linksys->magic, ".LINKSYS.", sizeof(linksys->magic))) {
 		info->tail_offset -= sizeof(*linksys);
 	}
@@ -322,85 +334,68 @@ static int bcm4908img_parse(FILE *fp, struct bcm4908img_info *info) {
 	/* Offsets */
 
 	for (info->bootfs_offset = info->cferom_offset;
-	     info->bootfs_offset < info->tail_offset;
+	     info->bootfs_offset + sizeof(uint16_t) <= info->tail_offset;
 	     info->bootfs_offset += 0x20000) {
-		if (fseek(fp, info->bootfs_offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek to the 0x%zx\n", info->bootfs_offset);
-			return err;
-		}
-		if (fread(&tmp16, 1, sizeof(tmp16), fp) != sizeof(tmp16)) {
-			fprintf(stderr, "Failed to read while looking for JFFS2\n");
-			return -EIO;
-		}
+		uint16_t tmp16;
+
+		memcpy(&tmp16, data + info->bootfs_offset, sizeof(tmp16));
 		if (be16_to_cpu(tmp16) == 0x8519)
 			break;
 	}
-	if (info->bootfs_offset >= info->tail_offset) {
+	if (info->bootfs_offset + sizeof(uint16_t) > info->tail_offset) {
 		fprintf(stderr, "Failed to find bootfs offset\n");
-		return -EPROTO;
+		err = -EPROTO;
+		goto err_unmap;
 	}
 
 	for (info->rootfs_offset = info->bootfs_offset;
 	     info->rootfs_offset < info->tail_offset;
 	     info->rootfs_offset += 0x20000) {
-		uint32_t *magic = (uint32_t *)&buf[0];
-
-		if (fseek(fp, info->rootfs_offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek: %d\n", err);
-			return err;
-		}
+		uint32_t magic;
 
-		length = info->padding_offset ? sizeof(*magic) : 256;
-		bytes = fread(buf, 1, length, fp);
-		if (bytes != length) {
+		length = info->padding_offset ? sizeof(magic) : 256;
+		if (info->rootfs_offset + length > info->size) {
 			fprintf(stderr, "Failed to read %zu bytes\n", length);
-			return -EIO;
+			err = -EIO;
+			goto err_unmap;
 		}
 
-		if (!info->padding_offset && bcm4908img_is_all_ff(buf, length))
+		if (!info->padding_offset && bcm4908img_is_all_ff(data + info->rootfs_offset, length))
 			info->padding_offset = info->rootfs_offset;
 
-		if (be32_to_cpu(*magic) == UBI_EC_HDR_MAGIC)
+		memcpy(&magic, data + info->rootfs_offset, sizeof(magic));
+		if (be32_to_cpu(magic) == UBI_EC_HDR_MAGIC)
 			break;
 	}
 	if (info->rootfs_offset >= info->tail_offset) {
 		fprintf(stderr, "Failed to find rootfs offset\n");
-		return -EPROTO;
+		err = -EPROTO;
+		goto err_unmap;
 	}
 
 	/* CRC32 */
 
 	/* Start with cferom (or bootfs) - skip vendor header */
-	fseek(fp, info->cferom_offset, SEEK_SET);
-
-	info->crc32 = 0xffffffff;
-	length = info->tail_offset - info->cferom_offset;
-	while (length && (bytes = fread(buf, 1, bcm4908img_min(sizeof(buf), length), fp)) > 0) {
-		info->crc32 = bcm4908img_crc32(info->crc32, buf, bytes);
-		length -= bytes;
-	}
-	if (length) {
-		fprintf(stderr, "Failed to read last %zd B of data\n", length);
-		return -EIO;
-	}
+	info->crc32 = bcm4908img_crc32(0xffffffff, data + info->cferom_offset,
+				       info->tail_offset - info->cferom_offset);
 
 	/* Tail */
 
-	if (fread(tail, 1, sizeof(*tail), fp) != sizeof(*tail)) {
-		fprintf(stderr, "Failed to read BCM4908 image tail\n");
-		return -EIO;
-	}
+	memcpy(tail, data + info->tail_offset, sizeof(*tail));
 
 	/* Standard validation */
 
 	if (info->crc32 != le32_to_cpu(tail->crc32)) {
 		fprintf(stderr, "Invalid data crc32: 0x%08x instead of 0x%08x\n", info->crc32, le32_to_cpu(tail->crc32));
-		return -EPROTO;
+		err = -EPROTO;
+		goto err_unmap;
 	}
 
 	return 0;
+
+err_unmap:
+	bcm4908img_unmap(info);
+	return err;
 }
 
 /**************************************************
@@ -443,6 +438,7 @@ static int bcm4908img_info(int argc, char **argv) {
 	printf("rootfs offset:\t0x%zx\n", info.rootfs_offset);
 	printf("Checksum:\t0x%08x\n", info.crc32);
 
+	bcm4908img_unmap(&info);
 err_close:
 	bcm4908img_close(fp);
 out:
@@ -454,10 +450,10 @@ out:
  **************************************************/
 
 static ssize_t bcm4908img_create_append_file(FILE *trx, const char *in_path, uint32_t *crc32) {
+	static uint8_t buf[BCM4908IMG_BUF_SIZE];
 	FILE *in;
 	size_t bytes;
 	ssize_t length = 0;
-	uint8_t buf[1024];
 
 	in = fopen(in_path, "r");
 	if (!in) {
@@ -593,10 +589,8 @@ static int bcm4908img_extract(int argc, char **argv) {
 	struct bcm4908img_info info;
 	const char *pathname = NULL;
 	const char *type = NULL;
-	uint8_t buf[1024];
 	size_t offset;
 	size_t length;
-	size_t bytes;
 	FILE *fp;
 	int c;
 	int err = 0;
@@ -628,14 +622,14 @@ static int bcm4908img_extract(int argc, char **argv) {
 	if (!type) {
 		err = -EINVAL;
 		fprintf(stderr, "No data to extract specified\n");
-		goto err_close;
+		goto err_unmap;
 	} else if (!strcmp(type, "cferom")) {
 		offset = info.cferom_offset;
 		length = info.bootfs_offset - offset;
 		if (!length) {
 			err = -ENOENT;
 			fprintf(stderr, "This BCM4908 image doesn't contain cferom\n");
-			goto err_close;
+			goto err_unmap;
 		}
 	} else if (!strcmp(type, "bootfs")) {
 		offset = info.bootfs_offset;
@@ -649,26 +643,23 @@ static int bcm4908img_extract(int argc, char **argv) {
 	} else {
 		err = -EINVAL;
 		fprintf(stderr, "Unsupported extract type: %s\n", type);
-		goto err_close;
+		goto err_unmap;
 	}
 
 	if (!length) {
 		err = -EINVAL;
 		fprintf(stderr, "Failed to find requested data in input image\n");
-		goto err_close;
+		goto err_unmap;
 	}
 
-	fseek(fp, offset, SEEK_SET);
-	while (length && (bytes = fread(buf, 1, bcm4908img_min(sizeof(buf), length), fp)) > 0) {
-		fwrite(buf, bytes, 1, stdout);
-		length -= bytes;
-	}
-	if (length) {
+	/* Data was just verified, write it out straight from the mapping */
+	if (fwrite(info.data + offset, 1, length, stdout) != length) {
 		err = -EIO;
-		fprintf(stderr, "Failed to read last %zd B of data\n", length);
-		goto err_close;
+		fprintf(stderr, "Failed to write %zu B of data\n", length);
 	}
 
+err_unmap:
+	bcm4908img_unmap(&info);
 err_close:
 	bcm4908img_close(fp);
 err_out:
@@ -741,71 +732,59 @@ struct jffs2_raw_dirent
 #define je16_to_cpu(x) ((x).v16)
 #define je32_to_cpu(x) ((x).v32)
 
-static int bcm4908img_bootfs_ls(FILE *fp, struct bcm4908img_info *info) {
-	struct jffs2_unknown_node node;
-	struct jffs2_raw_dirent dirent;
-	size_t offset;
-	size_t bytes;
-	int err = 0;
-
-	for (offset = info->bootfs_offset; ; offset += (je32_to_cpu(node.totlen) + 0x03) & ~0x03) {
-		char name[FILENAME_MAX + 1];
-
-		if (fseek(fp, offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek: %d\n", err);
-			return err;
-		}
+/**
+ * bcm4908img_bootfs_next - find the next JFFS2 dirent in the bootfs
+ *
+ * Starts looking at *offset and stores the offset of the found dirent there.
+ * Returns NULL when the end of JFFS2 data is reached.
+ */
+static const struct jffs2_raw_dirent *bcm4908img_bootfs_next(struct bcm4908img_info *info, size_t *offset) {
+	const struct jffs2_unknown_node *node;
+	const struct jffs2_raw_dirent *dirent;
 
-		bytes = fread(&node, 1, sizeof(node), fp);
-		if (bytes != sizeof(node)) {
-			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
-			return -EIO;
-		}
+	for (; *offset + sizeof(*node) <= info->tail_offset; *offset += (je32_to_cpu(node->totlen) + 0x03) & ~0x03) {
+		node = (const void *)(info->data + *offset);
 
-		if (je16_to_cpu(node.magic) != JFFS2_MAGIC_BITMASK) {
+		if (je16_to_cpu(node->magic) != JFFS2_MAGIC_BITMASK)
 			break;
-		}
 
-		if (je16_to_cpu(node.nodetype) != JFFS2_NODETYPE_DIRENT) {
+		if (je16_to_cpu(node->nodetype) != JFFS2_NODETYPE_DIRENT)
 			continue;
-		}
 
-		memcpy(&dirent, &node, sizeof(node));
-		bytes += fread((uint8_t *)&dirent + sizeof(node), 1, sizeof(dirent) - sizeof(node), fp);
-		if (bytes != sizeof(dirent)) {
-			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
-			return -EIO;
+		dirent = (const void *)node;
+		if (*offset + sizeof(*dirent) + dirent->nsize > info->tail_offset) {
+			fprintf(stderr, "Truncated JFFS2 dirent at 0x%zx\n", *offset);
+			break;
 		}
 
-		if (dirent.nsize + 1 > sizeof(name)) {
-			/* Keep reading & printing BUT exit with error code */
-			fprintf(stderr, "Too long filename\n");
-			err = -ENOMEM;
-			continue;
-		}
+		return dirent;
+	}
 
-		bytes = fread(name, 1, dirent.nsize, fp);
-		if (bytes != dirent.nsize) {
-			fprintf(stderr, "Failed to read filename\n");
-			return -EIO;
-		}
-		name[bytes] = '\0';
+	return NULL;
+}
+
+static int bcm4908img_bootfs_ls(FILE *fp, struct bcm4908img_info *info) {
+	const struct jffs2_raw_dirent *dirent;
+	size_t offset;
 
-		printf("%s\n", name);
+	for (offset = info->bootfs_offset;
+	     (dirent = bcm4908img_bootfs_next(info, &offset));
+	     offset += (je32_to_cpu(dirent->totlen) + 0x03) & ~0x03) {
+		printf("%.*s\n", dirent->nsize, dirent->name);
 	}
 
-	return err;
+	return 0;
 }
 
 static int bcm4908img_bootfs_mv(FILE *fp, struct bcm4908img_info *info, int argc, char **argv) {
-	struct jffs2_unknown_node node;
-	struct jffs2_raw_dirent dirent;
+	const struct jffs2_raw_dirent *dirent;
 	const char *oldname;
 	const char *newname;
+	uint8_t *buf;
 	size_t offset;
-	size_t bytes;
-	int err = -ENOENT;
+	size_t length;
+	uint32_t crc32;
+	int err;
 
 	if (argc - optind < 2) {
 		fprintf(stderr, "No enough arguments passed\n");
@@ -819,89 +798,46 @@ static int bcm4908img_bootfs_mv(FILE *fp, struct bcm4908img_info *info, int argc
 		return -EINVAL;
 	}
 
-	for (offset = info->bootfs_offset; ; offset += (je32_to_cpu(node.totlen) + 0x03) & ~0x03) {
-		char name[FILENAME_MAX];
-		uint32_t crc32;
-
-		if (fseek(fp, offset, SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek: %d\n", err);
-			return err;
-		}
-
-		bytes = fread(&node, 1, sizeof(node), fp);
-		if (bytes != sizeof(node)) {
-			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
-			return -EIO;
-		}
-
-		if (je16_to_cpu(node.magic) != JFFS2_MAGIC_BITMASK) {
-			break;
-		}
-
-		if (je16_to_cpu(node.nodetype) != JFFS2_NODETYPE_DIRENT) {
-			continue;
-		}
-
-		bytes += fread((uint8_t *)&dirent + sizeof(node), 1, sizeof(dirent) - sizeof(node), fp);
-		if (bytes != sizeof(dirent)) {
-			fprintf(stderr, "Failed to read %zu bytes\n", sizeof(node));
-			return -EIO;
-		}
+	for (offset = info->bootfs_offset;
+	     (dirent = bcm4908img_bootfs_next(info, &offset));
+	     offset += (je32_to_cpu(dirent->totlen) + 0x03) & ~0x03) {
+		if (debug)
+			printf("offset:%08zx name_crc:%04x filename:%.*s\n", offset, je32_to_cpu(dirent->name_crc), dirent->nsize, dirent->name);
 
-		if (dirent.nsize + 1 > sizeof(name)) {
-			fprintf(stderr, "Too long filename\n");
-			err = -ENOMEM;
+		if (dirent->nsize != strlen(oldname) || memcmp(dirent->name, oldname, dirent->nsize))
 			continue;
-		}
 
-		bytes = fread(name, 1, dirent.nsize, fp);
-		if (bytes != dirent.nsize) {
-			fprintf(stderr, "Failed to read filename\n");
-			return -EIO;
-		}
-		name[bytes] = '\0';
+		/* name_crc and name are adjacent, rewrite them in one go */
+		length = sizeof(dirent->name_crc) + dirent->nsize;
+		buf = malloc(length);
+		if (!buf)
+			return -ENOMEM;
 
-		if (debug)
-			printf("offset:%08zx name_crc:%04x filename:%s\n", offset, je32_to_cpu(dirent.name_crc), name);
+		crc32 = bcm4908img_crc32(0, newname, dirent->nsize);
+		memcpy(buf, &crc32, sizeof(crc32));
+		memcpy(buf + sizeof(crc32), newname, dirent->nsize);
 
-		if (strcmp(name, oldname)) {
-			continue;
-		}
+		/* Update BCM4908 image checksum for the changed bytes only */
 
-		if (fseek(fp, offset + offsetof(struct jffs2_raw_dirent, name_crc), SEEK_SET)) {
-			err = -errno;
-			fprintf(stderr, "Failed to fseek: %d\n", err);
-			return err;
-		}
-		crc32 = bcm4908img_crc32(0, newname, dirent.nsize);
-		bytes = fwrite(&crc32, 1, sizeof(crc32), fp);
-		if (bytes != sizeof(crc32)) {
-			fprintf(stderr, "Failed to write new CRC32\n");
-			return -EIO;
-		}
+		offset += offsetof(struct jffs2_raw_dirent, name_crc);
+		info->crc32 = bcm4908img_crc32_update(info->crc32, info->data + offset, buf, length,
+						      info->tail_offset - offset - length);
 
-		if (fseek(fp, offset + offsetof(struct jffs2_raw_dirent, name), SEEK_SET)) {
+		if (fseek(fp, offset, SEEK_SET)) {
 			err = -errno;
 			fprintf(stderr, "Failed to fseek: %d\n", err);
+			free(buf);
 			return err;
 		}
-		bytes = fwrite(newname, 1, dirent.nsize, fp);
-		if (bytes != dirent.nsize) {
+		if (fwrite(buf, 1, length, fp) != length) {
 			fprintf(stderr, "Failed to write new filename\n");
+			free(buf);
 			return -EIO;
 		}
-
-		/* Calculate new BCM4908 image checksum */
-
-		err = bcm4908img_calc_crc32(fp, info);
-		if (err) {
-			fprintf(stderr, "Failed to write new filename\n");
-			return err;
-		}
+		free(buf);
 
 		info->tail.crc32 = cpu_to_le32(info->crc32);
-		if (fseek(fp, -sizeof(struct bcm4908img_tail), SEEK_END)) {
+		if (fseek(fp, info->tail_offset, SEEK_SET)) {
 			err = -errno;
 			fprintf(stderr, "Failed to write new filename\n");
 			return err;
@@ -969,6 +905,7 @@ static int bcm4908img_bootfs(int argc, char **argv) {
 		fprintf(stderr, "Unsupported bootfs command: %s\n", cmd);
 	}
 
+	bcm4908img_unmap(&info);
 err_close:
 	bcm4908img_close(fp);
 out:
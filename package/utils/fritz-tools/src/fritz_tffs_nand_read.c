@@ -62,9 +62,14 @@
 
 #define TFFS_SEGMENT_CLEARED 0xffffffff
 
+#define TFFS_INDEX_MAGIC	0x54464958	/* "TFIX" */
+#define TFFS_INDEX_VERSION	1
+#define TFFS_INDEX_PATH		"/tmp/fritz_tffs_nand.%s.idx"
+
 static char *progname;
 static char *mtddev;
-static char *name_filter = NULL;
+static char **name_filter = NULL;
+static int num_name_filter = 0;
 static bool show_all = false;
 static bool print_all_key_names = false;
 static bool read_oob_sector_health = false;
@@ -73,9 +78,9 @@ static uint8_t readbuf[TFFS_SECTOR_SIZE];
 static uint8_t oobbuf[TFFS_SECTOR_OOB_SIZE];
 static uint32_t blocksize;
 static int mtdfd;
+static struct mtd_info_user mtdinfo;
 static uint32_t num_sectors;
 static uint8_t *sectors;
-static uint32_t *sector_ids;
 
 static inline void sector_mark_bad(int num)
 {
@@ -107,6 +112,36 @@ struct tffs_key_name_table {
 	struct tffs_name_table_entry *entries;
 };
 
+/* header of a valid entry segment found while scanning the TFFS */
+struct tffs_index_entry {
+	uint32_t sector;
+	uint32_t id;
+	uint32_t len;
+	uint32_t rev;
+	uint32_t seg;
+	uint32_t next_seg;
+};
+
+/*
+ * The index is cached in /tmp, the MTD geometry and ECC statistics are used
+ * to tell whether it still matches the flash contents.
+ */
+struct tffs_index_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t size;
+	uint32_t erasesize;
+	struct mtd_ecc_stats ecc;
+	uint32_t num_entries;
+};
+
+#define TFFS_INDEX_FLAG_SWAP	(1 << 0)
+#define TFFS_INDEX_FLAG_OOB	(1 << 1)
+
+static struct tffs_index_entry *tffs_index;
+static uint32_t tffs_index_size;
+
 static inline uint8_t read_uint8(void *buf, ptrdiff_t off)
 {
 	return *(uint8_t *)(buf + off);
@@ -136,8 +171,6 @@ static int read_sector(off_t pos)
 		return -1;
 	}
 
-	sector_ids[pos / TFFS_SECTOR_SIZE] = read_uint32(readbuf, 0x00);
-
 	return 0;
 }
 
@@ -171,89 +204,43 @@ static int find_entry(uint32_t id, struct tffs_entry *entry)
 {
 	uint32_t rev = 0;
 	uint32_t num_segments = 0;
-	struct tffs_entry_segment *segments = NULL;
+	struct tffs_index_entry **segments = NULL;
+	int ret = 0;
 
-	off_t pos = 0;
-	uint8_t block_end = 0;
-	for (uint32_t sector = 0; sector < num_sectors; sector++, pos += TFFS_SECTOR_SIZE) {
-		if (block_end) {
-			if (pos % blocksize == 0) {
-				block_end = 0;
-			}
-		} else if (sector_get_good(sector)) {
-			if (sector_ids[sector]) {
-				if (sector_ids[sector] == TFFS_ID_END) {
-					/* no more entries in this block */
-					block_end = 1;
-					continue;
-				}
-
-				if (sector_ids[sector] != id)
-					continue;
-			}
+	for (uint32_t i = 0; i < tffs_index_size; i++) {
+		struct tffs_index_entry *e = &tffs_index[i];
 
-			if (read_sectoroob(pos) || read_sector(pos)) {
-				fprintf(stderr, "ERROR: sector isn't readable, but has been previously!\n");
+		if (e->id != id)
+			continue;
+
+		if (e->rev < rev) {
+			/* obsolete revision => ignore this */
+			continue;
+		}
+		if (e->rev > rev) {
+			/* newer revision => forget old segments */
+			rev = e->rev;
+			num_segments = 0;
+		}
+
+		if (e->seg == TFFS_SEGMENT_CLEARED) {
+			continue;
+		}
+
+		uint32_t new_num_segs = e->next_seg == 0 ? e->seg + 1 : e->next_seg + 1;
+		if (new_num_segs <= e->seg)
+			new_num_segs = e->seg + 1;
+		if (new_num_segs > num_segments) {
+			segments = realloc(segments, new_num_segs * sizeof(*segments));
+			if (!segments) {
+				fprintf(stderr, "ERROR: memory allocation failed!\n");
 				exit(EXIT_FAILURE);
 			}
-			uint32_t read_id = read_uint32(readbuf, 0x00);
-			uint32_t read_len = read_uint32(readbuf, 0x04);
-			uint32_t read_rev = read_uint32(readbuf, 0x0c);
-			if (read_oob_sector_health) {
-				uint32_t oob_id = read_uint32(oobbuf, 0x02);
-				uint32_t oob_len = read_uint32(oobbuf, 0x06);
-				uint32_t oob_rev = read_uint32(oobbuf, 0x0a);
-
-				if (oob_id != read_id || oob_len != read_len || oob_rev != read_rev) {
-					fprintf(stderr, "Warning: sector has inconsistent metadata\n");
-					continue;
-				}
-			}
-			if (read_id == TFFS_ID_END) {
-				/* no more entries in this block */
-				block_end = 1;
-				continue;
-			}
-			if (read_len > TFFS_MAXIMUM_SEGMENT_SIZE) {
-				fprintf(stderr, "Warning: segment is longer than possible\n");
-				continue;
-			}
-			if (read_id == id) {
-				if (read_rev < rev) {
-					/* obsolete revision => ignore this */
-					continue;
-				}
-				if (read_rev > rev) {
-					/* newer revision => clear old data */
-					for (uint32_t i = 0; i < num_segments; i++) {
-						free(segments[i].val);
-					}
-					free (segments);
-					rev = read_rev;
-					num_segments = 0;
-					segments = NULL;
-				}
-
-				uint32_t seg = read_uint32(readbuf, 0x10);
-
-				if (seg == TFFS_SEGMENT_CLEARED) {
-					continue;
-				}
-
-				uint32_t next_seg = read_uint32(readbuf, 0x14);
-
-				uint32_t new_num_segs = next_seg == 0 ? seg + 1 : next_seg + 1;
-				if (new_num_segs > num_segments) {
-					segments = realloc(segments, new_num_segs * sizeof(struct tffs_entry_segment));
-					memset(segments + (num_segments * sizeof(struct tffs_entry_segment)), 0x0,
-							(new_num_segs - num_segments) * sizeof(struct tffs_entry_segment));
-					num_segments = new_num_segs;
-				}
-				segments[seg].len = read_len;
-				segments[seg].val = malloc(read_len);
-				memcpy(segments[seg].val, readbuf + TFFS_ENTRY_HEADER_SIZE, read_len);
-			}
+			memset(segments + num_segments, 0x0,
+			       (new_num_segs - num_segments) * sizeof(*segments));
+			num_segments = new_num_segs;
 		}
+		segments[e->seg] = e;
 	}
 
 	if (num_segments == 0) {
@@ -264,23 +251,31 @@ static int find_entry(uint32_t id, struct tffs_entry *entry)
 
 	uint32_t len = 0;
 	for (uint32_t i = 0; i < num_segments; i++) {
-		if (segments[i].val == NULL) {
+		if (segments[i] == NULL) {
 			/* missing segment */
-			return 0;
+			goto out;
 		}
 
-		len += segments[i].len;
+		len += segments[i]->len;
 	}
 
+	/* only the sectors of the newest revision are read */
 	void *p = malloc(len);
 	entry->val = p;
 	entry->len = len;
 	for (uint32_t i = 0; i < num_segments; i++) {
-		memcpy(p, segments[i].val, segments[i].len);
-		p += segments[i].len;
+		if (read_sector((off_t)segments[i]->sector * TFFS_SECTOR_SIZE)) {
+			fprintf(stderr, "ERROR: sector isn't readable, but has been previously!\n");
+			exit(EXIT_FAILURE);
+		}
+		memcpy(p, readbuf + TFFS_ENTRY_HEADER_SIZE, segments[i]->len);
+		p += segments[i]->len;
 	}
+	ret = 1;
 
-	return 1;
+out:
+	free(segments);
+	return ret;
 }
 
 static void parse_key_names(struct tffs_entry *names_entry,
@@ -345,7 +340,8 @@ static int show_all_key_value_pairs(struct tffs_key_name_table *key_names)
 	return EXIT_SUCCESS;
 }
 
-static int show_matching_key_value(struct tffs_key_name_table *key_names)
+static int show_matching_key_value(struct tffs_key_name_table *key_names,
+				   const char *name_filter)
 {
 	struct tffs_entry tmp;
 	const char *name;
@@ -372,6 +368,18 @@ static int show_matching_key_value(struct tffs_key_name_table *key_names)
 	return EXIT_FAILURE;
 }
 
+static int show_matching_key_values(struct tffs_key_name_table *key_names)
+{
+	int ret = EXIT_SUCCESS;
+
+	for (int i = 0; i < num_name_filter; i++) {
+		if (show_matching_key_value(key_names, name_filter[i]) != EXIT_SUCCESS)
+			ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
+
 static int check_sector(off_t pos)
 {
 	if (!read_oob_sector_health) {
@@ -419,18 +427,10 @@ static int check_block(off_t pos, uint32_t sector)
 
 static int scan_mtd(void)
 {
-	struct mtd_info_user info;
+	struct mtd_info_user info = mtdinfo;
 
-	if (ioctl(mtdfd, MEMGETINFO, &info)) {
-		return 0;
-	}
-
-	blocksize = info.erasesize;
-
-	num_sectors = info.size / TFFS_SECTOR_SIZE;
 	sectors = malloc((num_sectors + 7) / 8);
-	sector_ids = calloc(num_sectors, sizeof(uint32_t));
-	if (!sectors || !sector_ids) {
+	if (!sectors) {
 		fprintf(stderr, "ERROR: memory allocation failed!\n");
 		exit(EXIT_FAILURE);
 	}
@@ -455,6 +455,185 @@ static int scan_mtd(void)
 	return valid_blocks;
 }
 
+/*
+ * Walk all good sectors once and remember the headers of valid segments,
+ * values are then assembled from the index without scanning the TFFS again.
+ */
+static void build_index(void)
+{
+	off_t pos = 0;
+	uint8_t block_end = 0;
+
+	tffs_index = calloc(num_sectors, sizeof(*tffs_index));
+	if (!tffs_index) {
+		fprintf(stderr, "ERROR: memory allocation failed!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (uint32_t sector = 0; sector < num_sectors; sector++, pos += TFFS_SECTOR_SIZE) {
+		if (block_end) {
+			if (pos % blocksize == 0) {
+				block_end = 0;
+			}
+			continue;
+		}
+
+		if (!sector_get_good(sector))
+			continue;
+
+		if ((read_oob_sector_health && read_sectoroob(pos)) || read_sector(pos)) {
+			fprintf(stderr, "ERROR: sector isn't readable, but has been previously!\n");
+			exit(EXIT_FAILURE);
+		}
+		uint32_t read_id = read_uint32(readbuf, 0x00);
+		uint32_t read_len = read_uint32(readbuf, 0x04);
+		uint32_t read_rev = read_uint32(readbuf, 0x0c);
+		if (read_oob_sector_health) {
+			uint32_t oob_id = read_uint32(oobbuf, 0x02);
+			uint32_t oob_len = read_uint32(oobbuf, 0x06);
+			uint32_t oob_rev = read_uint32(oobbuf, 0x0a);
+
+			if (oob_id != read_id || oob_len != read_len || oob_rev != read_rev) {
+				fprintf(stderr, "Warning: sector has inconsistent metadata\n");
+				continue;
+			}
+		}
+		if (read_id == TFFS_ID_END) {
+			/* no more entries in this block */
+			block_end = 1;
+			continue;
+		}
+		if (read_len > TFFS_MAXIMUM_SEGMENT_SIZE) {
+			fprintf(stderr, "Warning: segment is longer than possible\n");
+			continue;
+		}
+
+		struct tffs_index_entry *e = &tffs_index[tffs_index_size++];
+
+		e->sector = sector;
+		e->id = read_id;
+		e->len = read_len;
+		e->rev = read_rev;
+		e->seg = read_uint32(readbuf, 0x10);
+		e->next_seg = read_uint32(readbuf, 0x14);
+	}
+}
+
+static int index_header_init(struct tffs_index_header *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = TFFS_INDEX_MAGIC;
+	hdr->version = TFFS_INDEX_VERSION;
+	hdr->flags = (swap_bytes ? TFFS_INDEX_FLAG_SWAP : 0) |
+		     (read_oob_sector_health ? TFFS_INDEX_FLAG_OOB : 0);
+	hdr->size = mtdinfo.size;
+	hdr->erasesize = mtdinfo.erasesize;
+
+	return ioctl(mtdfd, ECCGETSTATS, &hdr->ecc) ? -1 : 0;
+}
+
+static void index_path(char *path, size_t len)
+{
+	const char *name = strrchr(mtddev, '/');
+
+	snprintf(path, len, TFFS_INDEX_PATH, name ? name + 1 : mtddev);
+}
+
+static int load_index(void)
+{
+	struct tffs_index_header hdr, cur;
+	struct stat st;
+	char path[64];
+	size_t len;
+	FILE *f;
+	int fd;
+
+	if (index_header_init(&cur))
+		return 0;
+
+	/* /tmp is shared, only trust an index written by ourselves */
+	index_path(path, sizeof(path));
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != geteuid() ||
+	    !(f = fdopen(fd, "r"))) {
+		close(fd);
+		return 0;
+	}
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(&hdr, &cur, offsetof(struct tffs_index_header, num_entries)) ||
+	    hdr.num_entries > num_sectors)
+		goto err;
+
+	len = hdr.num_entries * sizeof(*tffs_index);
+	tffs_index = malloc(len ? len : 1);
+	if (!tffs_index || fread(tffs_index, 1, len, f) != len)
+		goto err;
+
+	for (uint32_t i = 0; i < hdr.num_entries; i++) {
+		if (tffs_index[i].sector >= num_sectors ||
+		    tffs_index[i].len > TFFS_MAXIMUM_SEGMENT_SIZE)
+			goto err;
+	}
+
+	tffs_index_size = hdr.num_entries;
+	fclose(f);
+	return 1;
+
+err:
+	free(tffs_index);
+	tffs_index = NULL;
+	fclose(f);
+	return 0;
+}
+
+static void save_index(void)
+{
+	struct tffs_index_header hdr;
+	char path[64], tmp[72];
+	size_t len;
+	FILE *f;
+	int fd;
+
+	index_path(path, sizeof(path));
+	if (index_header_init(&hdr))
+		goto err;
+	hdr.num_entries = tffs_index_size;
+
+	/* mkstemp() creates a new file with mode 0600, never follows a link */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto err;
+
+	f = fdopen(fd, "w");
+	if (!f) {
+		close(fd);
+		goto err_tmp;
+	}
+
+	len = tffs_index_size * sizeof(*tffs_index);
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(tffs_index, 1, len, f) != len) {
+		fclose(f);
+		goto err_tmp;
+	}
+
+	if (fclose(f) || rename(tmp, path))
+		goto err_tmp;
+
+	return;
+
+err_tmp:
+	unlink(tmp);
+err:
+	/* do not leave an outdated index behind */
+	unlink(path);
+}
+
 static void usage(int status)
 {
 	FILE *stream = (status != EXIT_SUCCESS) ? stderr : stdout;
@@ -467,7 +646,7 @@ static void usage(int status)
 	"  -d <mtd>        inspect the TFFS on mtd device <mtd>\n"
 	"  -h              show this screen\n"
 	"  -l              list all supported keys\n"
-	"  -n <key name>   display the value of the given key\n"
+	"  -n <key name>   display the value of the given key, may be repeated\n"
 	"  -o              read OOB information about sector health\n"
 	);
 
@@ -486,7 +665,7 @@ static void parse_options(int argc, char *argv[])
 		switch (c) {
 		case 'a':
 			show_all = true;
-			name_filter = NULL;
+			num_name_filter = 0;
 			print_all_key_names = false;
 			break;
 		case 'b':
@@ -501,10 +680,16 @@ static void parse_options(int argc, char *argv[])
 		case 'l':
 			print_all_key_names = true;
 			show_all = false;
-			name_filter = NULL;
+			num_name_filter = 0;
 			break;
 		case 'n':
-			name_filter = optarg;
+			name_filter = realloc(name_filter,
+					      (num_name_filter + 1) * sizeof(*name_filter));
+			if (!name_filter) {
+				fprintf(stderr, "ERROR: memory allocation failed!\n");
+				exit(EXIT_FAILURE);
+			}
+			name_filter[num_name_filter++] = optarg;
 			show_all = false;
 			print_all_key_names = false;
 			break;
@@ -522,7 +707,7 @@ static void parse_options(int argc, char *argv[])
 		usage(EXIT_FAILURE);
 	}
 
-	if (!show_all && !name_filter && !print_all_key_names) {
+	if (!show_all && !num_name_filter && !print_all_key_names) {
 		fprintf(stderr,
 			"ERROR: either -l, -a or -n <key name> is required!\n");
 		usage(EXIT_FAILURE);
@@ -546,11 +731,23 @@ int main(int argc, char *argv[])
 		goto out;
 	}
 
-	if (!scan_mtd()) {
-		fprintf(stderr, "ERROR: Parsing blocks from tffs device %s failed\n", mtddev);
-		fprintf(stderr, "       Is byte-swapping (-b) required?\n");
+	if (ioctl(mtdfd, MEMGETINFO, &mtdinfo)) {
+		fprintf(stderr, "ERROR: Failed to get info about tffs device %s\n", mtddev);
 		goto out_close;
 	}
+	blocksize = mtdinfo.erasesize;
+	num_sectors = mtdinfo.size / TFFS_SECTOR_SIZE;
+
+	if (!load_index()) {
+		if (!scan_mtd()) {
+			fprintf(stderr, "ERROR: Parsing blocks from tffs device %s failed\n", mtddev);
+			fprintf(stderr, "       Is byte-swapping (-b) required?\n");
+			goto out_free_sectors;
+		}
+
+		build_index();
+		save_index();
+	}
 
 	if (!find_entry(TFFS_ID_TABLE_NAME, &name_table)) {
 		fprintf(stderr, "ERROR: No name table found on tffs device %s\n",
@@ -571,14 +768,14 @@ int main(int argc, char *argv[])
 	} else if (show_all) {
 		ret = show_all_key_value_pairs(&key_names);
 	} else {
-		ret = show_matching_key_value(&key_names);
+		ret = show_matching_key_values(&key_names);
 	}
 
 	free(key_names.entries);
 out_free_entry:
 	free(name_table.val);
 out_free_sectors:
-	free(sector_ids);
+	free(tffs_index);
 	free(sectors);
 out_close:
 	close(mtdfd);
@@ -1,22 +1,30 @@
 #include <sys/resource.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <net/if.h>
 
 #include <stdint.h>
+#include <limits.h>
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 
+#include <linux/if_link.h>
+
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 
+#include <libubox/uloop.h>
+
 #include "ucode/module.h"
 
 #define err_return_int(err, ...) do { set_error(err, __VA_ARGS__); return -1; } while(0)
 #define err_return(err, ...) do { set_error(err, __VA_ARGS__); return NULL; } while(0)
 #define TRUE ucv_boolean_new(true)
 
+#define UC_BPF_BATCH_SIZE	256
+
 static uc_value_t *registry;
 static uc_vm_t *debug_vm;
 
@@ -32,7 +40,42 @@ struct uc_bpf_fd {
 
 struct uc_bpf_map {
 	struct uc_bpf_fd fd; /* must be first */
+	unsigned int type, flags, max_entries;
 	unsigned int key_size, val_size;
+	/* per-CPU maps carry one 8-byte aligned value slot per possible CPU */
+	unsigned int n_values, val_stride;
+};
+
+struct uc_bpf_map_mmap {
+	uint8_t *data;
+	size_t size;
+	unsigned int val_size, val_stride, max_entries;
+	bool writable;
+};
+
+struct uc_bpf_field {
+	const char *name;
+	unsigned int offset, size;
+};
+
+struct uc_bpf_layout {
+	bool single;
+	unsigned int size;
+	unsigned int n_fields;
+	struct uc_bpf_field fields[];
+};
+
+struct uc_bpf_consumer {
+	struct uloop_fd fd;
+	struct ring_buffer *rb;
+	struct perf_buffer *pb;
+	struct uc_bpf_layout *layout;
+
+	uc_vm_t *vm;
+	uc_value_t *res, *cb, *state, *batch;
+	unsigned int registry_index;
+
+	uint64_t records, batches, lost;
 };
 
 struct uc_bpf_map_iter {
@@ -186,18 +229,69 @@ uc_bpf_open_module(uc_vm_t *vm, size_t nargs)
 	return ucv_resource_create(vm, "bpf.module", obj);
 }
 
+static unsigned int
+uc_bpf_num_cpus(void)
+{
+	static int n_cpus;
+
+	if (!n_cpus)
+		n_cpus = libbpf_num_possible_cpus();
+
+	return n_cpus > 0 ? n_cpus : 1;
+}
+
+static bool
+uc_bpf_map_type_percpu(unsigned int type)
+{
+	switch (type) {
+	case BPF_MAP_TYPE_PERCPU_HASH:
+	case BPF_MAP_TYPE_PERCPU_ARRAY:
+	case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+	case BPF_MAP_TYPE_PERCPU_CGROUP_STORAGE:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static inline bool
+uc_bpf_map_percpu(struct uc_bpf_map *map)
+{
+	return uc_bpf_map_type_percpu(map->type);
+}
+
+/* size of the value buffer used by lookup/update syscalls */
+static inline unsigned int
+uc_bpf_map_buf_size(struct uc_bpf_map *map)
+{
+	return map->n_values * map->val_stride;
+}
+
 static uc_value_t *
-uc_bpf_map_create(uc_vm_t *vm, uc_value_t *mod, int fd, unsigned int key_size,
-		  unsigned int val_size, bool close)
+uc_bpf_map_create(uc_vm_t *vm, uc_value_t *mod, int fd, bool close)
 {
+	struct bpf_map_info info = {};
+	__u32 len = sizeof(info);
 	struct uc_bpf_map *uc_map;
 	uc_value_t *res;
 
+	if (bpf_obj_get_info_by_fd(fd, &info, &len))
+		err_return(errno, NULL);
+
 	res = ucv_resource_create_ex(vm, "bpf.map", (void **)&uc_map, 1, sizeof(*uc_map));
 	ucv_resource_value_set(res, 0, ucv_get(mod));
 	uc_map->fd.fd = fd;
-	uc_map->key_size = key_size;
-	uc_map->val_size = val_size;
+	uc_map->type = info.type;
+	uc_map->flags = info.map_flags;
+	uc_map->max_entries = info.max_entries;
+	uc_map->key_size = info.key_size;
+	uc_map->val_size = info.value_size;
+	uc_map->n_values = 1;
+	uc_map->val_stride = info.value_size;
+	if (uc_bpf_map_type_percpu(info.type)) {
+		uc_map->n_values = uc_bpf_num_cpus();
+		uc_map->val_stride = (info.value_size + 7) & ~7;
+	}
 	uc_map->fd.close = close;
 
 	return res;
@@ -220,10 +314,8 @@ uc_bpf_prog_create(uc_vm_t *vm, uc_value_t *mod, int fd, bool close)
 static uc_value_t *
 uc_bpf_open_map(uc_vm_t *vm, size_t nargs)
 {
-	struct bpf_map_info info;
 	uc_value_t *path = uc_fn_arg(0);
-	__u32 len = sizeof(info);
-	int err;
+	uc_value_t *res;
 	int fd;
 
 	if (ucv_type(path) != UC_STRING)
@@ -233,13 +325,11 @@ uc_bpf_open_map(uc_vm_t *vm, size_t nargs)
 	if (fd < 0)
 		err_return(errno, NULL);
 
-	err = bpf_obj_get_info_by_fd(fd, &info, &len);
-	if (err) {
+	res = uc_bpf_map_create(vm, NULL, fd, true);
+	if (!res)
 		close(fd);
-		err_return(errno, NULL);
-	}
 
-	return uc_bpf_map_create(vm, NULL, fd, info.key_size, info.value_size, true);
+	return res;
 }
 
 static uc_value_t *
@@ -295,7 +385,7 @@ uc_bpf_module_get_map(uc_vm_t *vm, size_t nargs)
 	if (fd < 0)
 		err_return(EINVAL, NULL);
 
-	return uc_bpf_map_create(vm, _uc_fn_this_res(vm), fd, bpf_map__key_size(map), bpf_map__value_size(map), false);
+	return uc_bpf_map_create(vm, _uc_fn_this_res(vm), fd, false);
 }
 
 static uc_value_t *
@@ -368,11 +458,234 @@ uc_bpf_map_arg(uc_value_t *val, const char *kind, unsigned int size)
 	err_return(EINVAL, "%s size mismatch (expected: %d)", kind, size);
 }
 
+/*
+ * Fill a value buffer of uc_bpf_map_buf_size() bytes. Per-CPU maps accept
+ * an array with one value per possible CPU, or a single value which is
+ * stored for every CPU.
+ */
+static void *
+uc_bpf_map_value_arg(struct uc_bpf_map *map, uc_value_t *val, uint8_t *buf)
+{
+	unsigned int i;
+	void *cur;
+
+	memset(buf, 0, uc_bpf_map_buf_size(map));
+
+	if (uc_bpf_map_percpu(map) && ucv_type(val) == UC_ARRAY) {
+		if (ucv_array_length(val) != map->n_values)
+			err_return(EINVAL, "value count mismatch (expected: %d)",
+				   map->n_values);
+
+		for (i = 0; i < map->n_values; i++) {
+			cur = uc_bpf_map_arg(ucv_array_get(val, i), "value",
+					     map->val_size);
+			if (!cur)
+				return NULL;
+
+			memcpy(buf + i * map->val_stride, cur, map->val_size);
+		}
+
+		return buf;
+	}
+
+	cur = uc_bpf_map_arg(val, "value", map->val_size);
+	if (!cur)
+		return NULL;
+
+	for (i = 0; i < map->n_values; i++)
+		memcpy(buf + i * map->val_stride, cur, map->val_size);
+
+	return buf;
+}
+
+static uc_value_t *
+uc_bpf_map_value_new(uc_vm_t *vm, struct uc_bpf_map *map, const uint8_t *buf)
+{
+	uc_value_t *rv;
+	unsigned int i;
+
+	if (!uc_bpf_map_percpu(map))
+		return ucv_string_new_length((const char *)buf, map->val_size);
+
+	rv = ucv_array_new_length(vm, map->n_values);
+	for (i = 0; i < map->n_values; i++)
+		ucv_array_set(rv, i, ucv_string_new_length((const char *)buf + i * map->val_stride,
+							   map->val_size));
+
+	return rv;
+}
+
+static unsigned int
+uc_bpf_field_size(const char *type, size_t len)
+{
+	static const char * const types[] = { "u8", "u16", "u32", "u64" };
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(types); i++)
+		if (strlen(types[i]) == len && !strncmp(type, types[i], len))
+			return 1 << i;
+
+	return 0;
+}
+
+static void
+uc_bpf_layout_free(struct uc_bpf_layout *l)
+{
+	unsigned int i;
+
+	if (!l)
+		return;
+
+	for (i = 0; i < l->n_fields; i++)
+		free((char *)l->fields[i].name);
+
+	free(l);
+}
+
+/*
+ * Parse a value layout: either a single type name ("u32", "u64", ...) or an
+ * object mapping field names to types. Fields are placed like members of
+ * a C struct, an explicit offset can be given as "u64@16".
+ */
+static struct uc_bpf_layout *
+uc_bpf_layout_parse(uc_value_t *val, unsigned int val_size)
+{
+	struct uc_bpf_layout *l;
+	unsigned int offset = 0;
+	size_t n = 1;
+
+	if (ucv_type(val) == UC_OBJECT)
+		n = ucv_object_length(val);
+	else if (ucv_type(val) != UC_STRING)
+		err_return(EINVAL, "layout type");
+
+	l = calloc(1, sizeof(*l) + n * sizeof(l->fields[0]));
+	if (!l)
+		err_return(ENOMEM, NULL);
+
+	if (ucv_type(val) == UC_STRING) {
+		const char *type = ucv_string_get(val);
+
+		l->single = true;
+		l->n_fields = 1;
+		l->fields[0].size = uc_bpf_field_size(type, strlen(type));
+		if (!l->fields[0].size || l->fields[0].size > val_size) {
+			free(l);
+			err_return(EINVAL, "layout type %s", type);
+		}
+
+		l->size = l->fields[0].size;
+		return l;
+	}
+
+	ucv_object_foreach(val, name, type) {
+		struct uc_bpf_field *f = &l->fields[l->n_fields++];
+		const char *str = ucv_string_get(type), *sep;
+		unsigned int size = 0;
+
+		if (str) {
+			sep = strchr(str, '@');
+			size = uc_bpf_field_size(str, sep ? sep - str : strlen(str));
+			if (sep)
+				offset = strtoul(sep + 1, NULL, 0);
+		}
+
+		if (!size) {
+			uc_bpf_layout_free(l);
+			err_return(EINVAL, "field %s type", name);
+		}
+
+		offset = (offset + size - 1) & ~(size - 1);
+		if (offset + size > val_size) {
+			uc_bpf_layout_free(l);
+			err_return(EINVAL, "field %s exceeds value size %d", name, val_size);
+		}
+
+		/* the layout may outlive the object the names belong to */
+		f->name = strdup(name);
+		if (!f->name) {
+			uc_bpf_layout_free(l);
+			err_return(ENOMEM, NULL);
+		}
+
+		f->offset = offset;
+		f->size = size;
+		offset += size;
+		if (offset > l->size)
+			l->size = offset;
+	}
+
+	return l;
+}
+
+static uint64_t
+uc_bpf_field_get(const uint8_t *data, unsigned int size)
+{
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+
+	switch (size) {
+	case 1:
+		return *data;
+	case 2:
+		memcpy(&v16, data, sizeof(v16));
+		return v16;
+	case 4:
+		memcpy(&v32, data, sizeof(v32));
+		return v32;
+	default:
+		memcpy(&v64, data, sizeof(v64));
+		return v64;
+	}
+}
+
+/* decode a value according to the layout, summing up all value slots */
+static uc_value_t *
+uc_bpf_layout_decode(uc_vm_t *vm, struct uc_bpf_layout *l, const uint8_t *buf,
+		     unsigned int n_values, unsigned int stride)
+{
+	uc_value_t *rv = NULL;
+	unsigned int i, j;
+
+	if (!l->single)
+		rv = ucv_object_new(vm);
+
+	for (i = 0; i < l->n_fields; i++) {
+		struct uc_bpf_field *f = &l->fields[i];
+		uint64_t sum = 0;
+
+		for (j = 0; j < n_values; j++)
+			sum += uc_bpf_field_get(buf + j * stride + f->offset, f->size);
+
+		if (l->single)
+			return ucv_uint64_new(sum);
+
+		ucv_object_add(rv, f->name, ucv_uint64_new(sum));
+	}
+
+	return rv;
+}
+
+static uc_value_t *
+uc_bpf_map_value_decode(uc_vm_t *vm, struct uc_bpf_map *map,
+			struct uc_bpf_layout *layout, const uint8_t *buf)
+{
+	if (!layout)
+		return uc_bpf_map_value_new(vm, map, buf);
+
+	return uc_bpf_layout_decode(vm, layout, buf, map->n_values,
+				    map->val_stride);
+}
+
 static uc_value_t *
 uc_bpf_map_get(uc_vm_t *vm, size_t nargs)
 {
 	struct uc_bpf_map *map = uc_fn_thisval("bpf.map");
 	uc_value_t *a_key = uc_fn_arg(0);
+	uc_value_t *a_layout = uc_fn_arg(1);
+	struct uc_bpf_layout *layout = NULL;
+	uc_value_t *rv = NULL;
 	void *key, *val;
 
 	if (!map)
@@ -382,11 +695,19 @@ uc_bpf_map_get(uc_vm_t *vm, size_t nargs)
 	if (!key)
 		return NULL;
 
-	val = alloca(map->val_size);
-	if (bpf_map_lookup_elem(map->fd.fd, key, val))
-		return NULL;
+	if (a_layout) {
+		layout = uc_bpf_layout_parse(a_layout, map->val_size);
+		if (!layout)
+			return NULL;
+	}
+
+	val = alloca(uc_bpf_map_buf_size(map));
+	if (!bpf_map_lookup_elem(map->fd.fd, key, val))
+		rv = uc_bpf_map_value_decode(vm, map, layout, val);
 
-	return ucv_string_new_length(val, map->val_size);
+	uc_bpf_layout_free(layout);
+
+	return rv;
 }
 
 static uc_value_t *
@@ -402,12 +723,16 @@ uc_bpf_map_set(uc_vm_t *vm, size_t nargs)
 	if (!map)
 		err_return(EINVAL, NULL);
 
-	key = uc_bpf_map_arg(a_key, "key", map->key_size);
-	if (!key)
+	val = uc_bpf_map_arg(a_key, "key", map->key_size);
+	if (!val)
 		return NULL;
 
-	val = uc_bpf_map_arg(a_val, "value", map->val_size);
-	if (!val)
+	/* uc_bpf_map_arg() returns a static buffer for integers */
+	key = alloca(map->key_size);
+	memcpy(key, val, map->key_size);
+
+	val = alloca(uc_bpf_map_buf_size(map));
+	if (!uc_bpf_map_value_arg(map, a_val, val))
 		return NULL;
 
 	if (!a_flags)
@@ -420,7 +745,7 @@ uc_bpf_map_set(uc_vm_t *vm, size_t nargs)
 	if (bpf_map_update_elem(map->fd.fd, key, val, flags))
 		return NULL;
 
-	return ucv_string_new_length(val, map->val_size);
+	return uc_bpf_map_value_new(vm, map, val);
 }
 
 static uc_value_t *
@@ -445,11 +770,381 @@ uc_bpf_map_delete(uc_vm_t *vm, size_t nargs)
 		return ucv_boolean_new(ret == 0);
 	}
 
-	val = alloca(map->val_size);
+	val = alloca(uc_bpf_map_buf_size(map));
 	if (bpf_map_lookup_and_delete_elem(map->fd.fd, key, val))
 		return NULL;
 
-	return ucv_string_new_length(val, map->val_size);
+	return uc_bpf_map_value_new(vm, map, val);
+}
+
+static bool
+uc_bpf_batch_unsupported(int err)
+{
+	/* kernel without batch ops or map type without batch support */
+	return err == EINVAL || err == EOPNOTSUPP || err == 524 /* ENOTSUPP */;
+}
+
+static void *
+uc_bpf_map_batch_arg(uc_value_t *list, const char *kind, unsigned int size)
+{
+	size_t i, len = ucv_array_length(list);
+	uint8_t *buf;
+
+	buf = calloc(len ? len : 1, size);
+	if (!buf)
+		err_return(ENOMEM, NULL);
+
+	for (i = 0; i < len; i++) {
+		void *cur = uc_bpf_map_arg(ucv_array_get(list, i), kind, size);
+
+		if (!cur) {
+			free(buf);
+			return NULL;
+		}
+
+		memcpy(buf + i * size, cur, size);
+	}
+
+	return buf;
+}
+
+typedef void (*uc_bpf_map_walk_cb)(void *priv, const void *key, const void *val);
+
+/*
+ * Walk all map entries in chunks using BPF_MAP_LOOKUP_BATCH (or
+ * BPF_MAP_LOOKUP_AND_DELETE_BATCH). Returns 1 if the kernel or map type
+ * does not support batch lookups and nothing was consumed yet, so that the
+ * caller can fall back to bpf_map_get_next_key.
+ */
+static int
+uc_bpf_map_walk_batch(struct uc_bpf_map *map, bool delete,
+		      uc_bpf_map_walk_cb cb, void *priv)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	unsigned int tok_size = map->key_size > 8 ? map->key_size : 8;
+	unsigned int batch = UC_BPF_BATCH_SIZE;
+	uint8_t *keys = NULL, *vals = NULL, *tok;
+	bool first = true;
+	int ret = -1;
+	__u32 i;
+
+	tok = calloc(2, tok_size);
+	if (!tok)
+		return -1;
+
+	while (1) {
+		__u32 count = batch;
+		int err = 0;
+
+		if (!keys) {
+			keys = calloc(batch, map->key_size);
+			vals = calloc(batch, uc_bpf_map_buf_size(map));
+			if (!keys || !vals)
+				goto out;
+		}
+
+		if (delete)
+			err = bpf_map_lookup_and_delete_batch(map->fd.fd,
+							      first ? NULL : tok,
+							      tok + tok_size,
+							      keys, vals, &count,
+							      &opts);
+		else
+			err = bpf_map_lookup_batch(map->fd.fd,
+						   first ? NULL : tok,
+						   tok + tok_size,
+						   keys, vals, &count, &opts);
+		if (err)
+			err = errno;
+
+		/* hash bucket larger than the batch buffer */
+		if (err == ENOSPC && batch < (1 << 20)) {
+			free(keys);
+			free(vals);
+			keys = vals = NULL;
+			batch *= 2;
+			continue;
+		}
+
+		if (err && err != ENOENT) {
+			if (first && uc_bpf_batch_unsupported(err))
+				ret = 1;
+			errno = err;
+			goto out;
+		}
+
+		for (i = 0; i < count; i++)
+			cb(priv, keys + i * map->key_size,
+			   vals + i * uc_bpf_map_buf_size(map));
+
+		if (err == ENOENT)
+			break;
+
+		memcpy(tok, tok + tok_size, tok_size);
+		first = false;
+	}
+
+	ret = 0;
+
+out:
+	free(keys);
+	free(vals);
+	free(tok);
+
+	return ret;
+}
+
+static uc_value_t *
+uc_bpf_map_get_batch(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_map *map = uc_fn_thisval("bpf.map");
+	uc_value_t *a_keys = uc_fn_arg(0);
+	uc_value_t *a_layout = uc_fn_arg(1);
+	struct uc_bpf_layout *layout = NULL;
+	size_t i, len;
+	uc_value_t *rv;
+	uint8_t *keys;
+	void *val;
+
+	if (!map || ucv_type(a_keys) != UC_ARRAY)
+		err_return(EINVAL, NULL);
+
+	if (a_layout) {
+		layout = uc_bpf_layout_parse(a_layout, map->val_size);
+		if (!layout)
+			return NULL;
+	}
+
+	keys = uc_bpf_map_batch_arg(a_keys, "key", map->key_size);
+	if (!keys) {
+		uc_bpf_layout_free(layout);
+		return NULL;
+	}
+
+	/*
+	 * BPF_MAP_LOOKUP_BATCH iterates the map rather than taking a key
+	 * list, so look up the requested keys one by one, but without
+	 * returning to the VM in between.
+	 */
+	len = ucv_array_length(a_keys);
+	rv = ucv_array_new_length(vm, len);
+	val = alloca(uc_bpf_map_buf_size(map));
+	for (i = 0; i < len; i++) {
+		uc_value_t *cur = NULL;
+
+		if (!bpf_map_lookup_elem(map->fd.fd, keys + i * map->key_size, val))
+			cur = uc_bpf_map_value_decode(vm, map, layout, val);
+
+		ucv_array_set(rv, i, cur);
+	}
+
+	free(keys);
+	uc_bpf_layout_free(layout);
+
+	return rv;
+}
+
+static uc_value_t *
+uc_bpf_map_set_batch(uc_vm_t *vm, size_t nargs)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	struct uc_bpf_map *map = uc_fn_thisval("bpf.map");
+	uc_value_t *a_keys = uc_fn_arg(0);
+	uc_value_t *a_vals = uc_fn_arg(1);
+	uc_value_t *a_flags = uc_fn_arg(2);
+	unsigned int buf_size;
+	uint8_t *keys, *vals;
+	__u32 i, count, len;
+	int err = 0;
+
+	if (!map || ucv_type(a_keys) != UC_ARRAY || ucv_type(a_vals) != UC_ARRAY)
+		err_return(EINVAL, NULL);
+
+	len = ucv_array_length(a_keys);
+	if (ucv_array_length(a_vals) != len)
+		err_return(EINVAL, "key/value count mismatch");
+
+	if (!a_flags)
+		opts.elem_flags = BPF_ANY;
+	else if (ucv_type(a_flags) != UC_INTEGER)
+		err_return(EINVAL, "flags");
+	else
+		opts.elem_flags = ucv_int64_get(a_flags);
+
+	keys = uc_bpf_map_batch_arg(a_keys, "key", map->key_size);
+	if (!keys)
+		return NULL;
+
+	buf_size = uc_bpf_map_buf_size(map);
+	vals = calloc(len ? len : 1, buf_size);
+	if (!vals) {
+		free(keys);
+		err_return(ENOMEM, NULL);
+	}
+
+	for (i = 0; i < len; i++) {
+		if (uc_bpf_map_value_arg(map, ucv_array_get(a_vals, i),
+					 vals + i * buf_size))
+			continue;
+
+		free(keys);
+		free(vals);
+		return NULL;
+	}
+
+	count = len;
+	if (len && bpf_map_update_batch(map->fd.fd, keys, vals, &count, &opts)) {
+		err = errno;
+		if (uc_bpf_batch_unsupported(err)) {
+			err = 0;
+			for (count = 0; count < len; count++) {
+				if (!bpf_map_update_elem(map->fd.fd,
+							 keys + count * map->key_size,
+							 vals + count * buf_size,
+							 opts.elem_flags))
+					continue;
+
+				err = errno;
+				break;
+			}
+		}
+	}
+
+	free(keys);
+	free(vals);
+
+	if (err)
+		err_return(err, "updated %u of %u entries", count, len);
+
+	return ucv_int64_new(count);
+}
+
+static uc_value_t *
+uc_bpf_map_delete_batch(uc_vm_t *vm, size_t nargs)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts);
+	struct uc_bpf_map *map = uc_fn_thisval("bpf.map");
+	uc_value_t *a_keys = uc_fn_arg(0);
+	__u32 count, done = 0, deleted = 0, len;
+	uint8_t *keys;
+	int err = 0;
+
+	if (!map || ucv_type(a_keys) != UC_ARRAY)
+		err_return(EINVAL, NULL);
+
+	keys = uc_bpf_map_batch_arg(a_keys, "key", map->key_size);
+	if (!keys)
+		return NULL;
+
+	len = ucv_array_length(a_keys);
+	while (done < len) {
+		count = len - done;
+		if (!bpf_map_delete_batch(map->fd.fd, keys + done * map->key_size,
+					  &count, &opts)) {
+			deleted += count;
+			break;
+		}
+
+		err = errno;
+		if (err == ENOENT) {
+			/* skip the missing key and continue after it */
+			deleted += count;
+			done += count + 1;
+			err = 0;
+			continue;
+		}
+
+		if (!uc_bpf_batch_unsupported(err))
+			break;
+
+		err = 0;
+		for (; done < len; done++)
+			if (!bpf_map_delete_elem(map->fd.fd, keys + done * map->key_size))
+				deleted++;
+	}
+
+	free(keys);
+
+	if (err)
+		err_return(err, NULL);
+
+	return ucv_int64_new(deleted);
+}
+
+struct uc_bpf_map_dump {
+	uc_vm_t *vm;
+	struct uc_bpf_map *map;
+	struct uc_bpf_layout *layout;
+	uc_value_t *list;
+};
+
+static void
+uc_bpf_map_dump_cb(void *priv, const void *key, const void *val)
+{
+	struct uc_bpf_map_dump *d = priv;
+	uc_value_t *entry;
+
+	entry = ucv_array_new_length(d->vm, 2);
+	ucv_array_set(entry, 0, ucv_string_new_length(key, d->map->key_size));
+	ucv_array_set(entry, 1, uc_bpf_map_value_decode(d->vm, d->map, d->layout, val));
+	ucv_array_push(d->list, entry);
+}
+
+static uc_value_t *
+uc_bpf_map_dump(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_map *map = uc_fn_thisval("bpf.map");
+	uc_value_t *a_layout = uc_fn_arg(0);
+	struct uc_bpf_map_dump d = {
+		.vm = vm,
+		.map = map,
+	};
+	void *key, *next, *val;
+	bool has_next;
+	int ret;
+
+	if (!map)
+		err_return(EINVAL, NULL);
+
+	if (a_layout) {
+		d.layout = uc_bpf_layout_parse(a_layout, map->val_size);
+		if (!d.layout)
+			return NULL;
+	}
+
+	d.list = ucv_array_new(vm);
+	ret = uc_bpf_map_walk_batch(map, false, uc_bpf_map_dump_cb, &d);
+	if (ret < 0) {
+		ret = errno;
+		uc_bpf_layout_free(d.layout);
+		ucv_put(d.list);
+		err_return(ret, NULL);
+	}
+
+	if (!ret)
+		goto out;
+
+	key = alloca(map->key_size);
+	next = alloca(map->key_size);
+	val = alloca(uc_bpf_map_buf_size(map));
+	has_next = !bpf_map_get_next_key(map->fd.fd, NULL, next);
+	while (has_next) {
+		memcpy(key, next, map->key_size);
+		has_next = !bpf_map_get_next_key(map->fd.fd, next, next);
+
+		if (!bpf_map_lookup_elem(map->fd.fd, key, val))
+			uc_bpf_map_dump_cb(&d, key, val);
+	}
+
+out:
+	uc_bpf_layout_free(d.layout);
+
+	return d.list;
+}
+
+static void
+uc_bpf_map_discard_cb(void *priv, const void *key, const void *val)
+{
 }
 
 static uc_value_t *
@@ -463,6 +1158,10 @@ uc_bpf_map_delete_all(uc_vm_t *vm, size_t nargs)
 	if (!map)
 		err_return(EINVAL, NULL);
 
+	if (!ucv_is_callable(filter) &&
+	    !uc_bpf_map_walk_batch(map, true, uc_bpf_map_discard_cb, NULL))
+		return TRUE;
+
 	key = alloca(map->key_size);
 	next = alloca(map->key_size);
 	has_next = !bpf_map_get_next_key(map->fd.fd, NULL, next);
@@ -591,6 +1290,368 @@ uc_bpf_map_foreach(uc_vm_t *vm, size_t nargs)
 	return ucv_boolean_new(ret);
 }
 
+static uc_value_t *
+uc_bpf_map_mmap(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_map *map = uc_fn_thisval("bpf.map");
+	long page_size = sysconf(_SC_PAGESIZE);
+	struct uc_bpf_map_mmap *m;
+	bool writable = true;
+	unsigned int stride;
+	uc_value_t *res;
+	size_t size;
+	void *data;
+
+	if (!map)
+		err_return(EINVAL, NULL);
+
+	if (map->type != BPF_MAP_TYPE_ARRAY || !(map->flags & BPF_F_MMAPABLE))
+		err_return(EINVAL, "map is not a mmapable array");
+
+	stride = (map->val_size + 7) & ~7;
+	size = (size_t)stride * map->max_entries;
+	size = (size + page_size - 1) & ~(page_size - 1);
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd.fd, 0);
+	if (data == MAP_FAILED) {
+		/* frozen or read-only map */
+		writable = false;
+		data = mmap(NULL, size, PROT_READ, MAP_SHARED, map->fd.fd, 0);
+	}
+
+	if (data == MAP_FAILED)
+		err_return(errno, NULL);
+
+	res = ucv_resource_create_ex(vm, "bpf.map_mmap", (void **)&m, 1, sizeof(*m));
+	ucv_resource_value_set(res, 0, ucv_get(_uc_fn_this_res(vm)));
+	m->data = data;
+	m->size = size;
+	m->val_size = map->val_size;
+	m->val_stride = stride;
+	m->max_entries = map->max_entries;
+	m->writable = writable;
+
+	return res;
+}
+
+static uint8_t *
+uc_bpf_map_mmap_elem(struct uc_bpf_map_mmap *m, uc_value_t *index)
+{
+	int64_t idx;
+
+	if (ucv_type(index) != UC_INTEGER)
+		err_return(EINVAL, "index type");
+
+	idx = ucv_int64_get(index);
+	if (idx < 0 || idx >= m->max_entries)
+		err_return(ERANGE, "index out of range");
+
+	return m->data + idx * m->val_stride;
+}
+
+static uc_value_t *
+uc_bpf_map_mmap_get(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_map_mmap *m = uc_fn_thisval("bpf.map_mmap");
+	uc_value_t *a_layout = uc_fn_arg(1);
+	struct uc_bpf_layout *layout;
+	uc_value_t *rv;
+	uint8_t *elem;
+
+	if (!m)
+		err_return(EINVAL, NULL);
+
+	elem = uc_bpf_map_mmap_elem(m, uc_fn_arg(0));
+	if (!elem)
+		return NULL;
+
+	if (!a_layout)
+		return ucv_string_new_length((const char *)elem, m->val_size);
+
+	layout = uc_bpf_layout_parse(a_layout, m->val_size);
+	if (!layout)
+		return NULL;
+
+	rv = uc_bpf_layout_decode(vm, layout, elem, 1, m->val_stride);
+	uc_bpf_layout_free(layout);
+
+	return rv;
+}
+
+static uc_value_t *
+uc_bpf_map_mmap_set(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_map_mmap *m = uc_fn_thisval("bpf.map_mmap");
+	uint8_t *elem;
+	void *val;
+
+	if (!m)
+		err_return(EINVAL, NULL);
+
+	if (!m->writable)
+		err_return(EPERM, "map is read-only");
+
+	elem = uc_bpf_map_mmap_elem(m, uc_fn_arg(0));
+	if (!elem)
+		return NULL;
+
+	val = uc_bpf_map_arg(uc_fn_arg(1), "value", m->val_size);
+	if (!val)
+		return NULL;
+
+	memcpy(elem, val, m->val_size);
+
+	return TRUE;
+}
+
+static void uc_bpf_map_mmap_free(void *ptr)
+{
+	struct uc_bpf_map_mmap *m = ptr;
+
+	if (m->data)
+		munmap(m->data, m->size);
+}
+
+static unsigned int
+uc_bpf_registry_add(uc_value_t *val)
+{
+	size_t i, len = ucv_array_length(registry);
+
+	/* slot 0 holds the debug handler */
+	for (i = 1; i < len; i++)
+		if (!ucv_array_get(registry, i))
+			break;
+
+	ucv_array_set(registry, i, ucv_get(val));
+
+	return i;
+}
+
+static void
+uc_bpf_consumer_record(struct uc_bpf_consumer *c, const void *data, size_t size)
+{
+	uc_value_t *rec;
+
+	c->records++;
+
+	/*
+	 * With a layout, fields are decoded straight from the ring buffer
+	 * memory instead of copying the record into a string first.
+	 */
+	if (c->layout && size >= c->layout->size)
+		rec = uc_bpf_layout_decode(c->vm, c->layout, data, 1, 0);
+	else
+		rec = ucv_string_new_length(data, size);
+
+	if (!c->batch)
+		c->batch = ucv_array_new(c->vm);
+
+	ucv_array_push(c->batch, rec);
+}
+
+static int
+uc_bpf_ringbuf_sample_cb(void *ctx, void *data, size_t size)
+{
+	uc_bpf_consumer_record(ctx, data, size);
+
+	return 0;
+}
+
+static void
+uc_bpf_perf_sample_cb(void *ctx, int cpu, void *data, __u32 size)
+{
+	uc_bpf_consumer_record(ctx, data, size);
+}
+
+static void
+uc_bpf_perf_lost_cb(void *ctx, int cpu, __u64 cnt)
+{
+	struct uc_bpf_consumer *c = ctx;
+
+	c->lost += cnt;
+}
+
+static int
+uc_bpf_consumer_read(struct uc_bpf_consumer *c)
+{
+	uc_value_t *res, *batch;
+	int ret;
+
+	if (c->rb)
+		ret = ring_buffer__consume(c->rb);
+	else
+		ret = perf_buffer__consume(c->pb);
+
+	batch = c->batch;
+	c->batch = NULL;
+	if (!batch)
+		return ret;
+
+	c->batches++;
+
+	/* the callback may close the consumer */
+	res = ucv_get(c->res);
+	uc_vm_stack_push(c->vm, ucv_get(res));
+	uc_vm_stack_push(c->vm, ucv_get(c->cb));
+	uc_vm_stack_push(c->vm, batch);
+	uc_vm_stack_push(c->vm, ucv_uint64_new(c->lost));
+	if (uc_vm_call(c->vm, true, 2) == EXCEPTION_NONE)
+		ucv_put(uc_vm_stack_pop(c->vm));
+	ucv_put(res);
+
+	return ret;
+}
+
+static void
+uc_bpf_consumer_fd_cb(struct uloop_fd *fd, unsigned int events)
+{
+	struct uc_bpf_consumer *c = container_of(fd, struct uc_bpf_consumer, fd);
+
+	uc_bpf_consumer_read(c);
+}
+
+static uc_value_t *
+uc_bpf_map_consumer(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_map *map = uc_fn_thisval("bpf.map");
+	uc_value_t *cb = uc_fn_arg(0);
+	uc_value_t *opts = uc_fn_arg(1);
+	uc_value_t *layout = NULL, *val;
+	struct uc_bpf_consumer *c;
+	unsigned int pages = 8;
+
+	if (!map || !ucv_is_callable(cb) ||
+	    (opts && ucv_type(opts) != UC_OBJECT))
+		err_return(EINVAL, NULL);
+
+	if (map->type != BPF_MAP_TYPE_RINGBUF &&
+	    map->type != BPF_MAP_TYPE_PERF_EVENT_ARRAY)
+		err_return(EINVAL, "map is not a ring buffer or perf event array");
+
+	if ((val = ucv_object_get(opts, "pages", NULL)) != NULL) {
+		if (ucv_type(val) != UC_INTEGER)
+			err_return(EINVAL, "pages");
+
+		pages = ucv_int64_get(val);
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		err_return(ENOMEM, NULL);
+
+	layout = ucv_object_get(opts, "layout", NULL);
+	if (layout) {
+		c->layout = uc_bpf_layout_parse(layout, UINT_MAX);
+		if (!c->layout)
+			goto free;
+	}
+
+	if (map->type == BPF_MAP_TYPE_RINGBUF) {
+		c->rb = ring_buffer__new(map->fd.fd, uc_bpf_ringbuf_sample_cb, c, NULL);
+		if (!c->rb) {
+			set_error(errno, "ring_buffer__new");
+			goto free;
+		}
+
+		c->fd.fd = ring_buffer__epoll_fd(c->rb);
+	} else {
+		c->pb = perf_buffer__new(map->fd.fd, pages, uc_bpf_perf_sample_cb,
+					 uc_bpf_perf_lost_cb, c, NULL);
+		if (!c->pb) {
+			set_error(errno, "perf_buffer__new");
+			goto free;
+		}
+
+		c->fd.fd = perf_buffer__epoll_fd(c->pb);
+	}
+
+	c->vm = vm;
+	c->res = ucv_resource_create(vm, "bpf.consumer", c);
+	c->state = ucv_array_new(vm);
+	ucv_array_set(c->state, 0, ucv_get(c->res));
+	ucv_array_set(c->state, 1, ucv_get(cb));
+	ucv_array_set(c->state, 2, ucv_get(_uc_fn_this_res(vm)));
+	c->cb = cb;
+	c->registry_index = uc_bpf_registry_add(c->state);
+
+	c->fd.cb = uc_bpf_consumer_fd_cb;
+	uloop_fd_add(&c->fd, ULOOP_READ);
+
+	return c->res;
+
+free:
+	uc_bpf_layout_free(c->layout);
+	free(c);
+	return NULL;
+}
+
+static void uc_bpf_consumer_free(void *ptr)
+{
+	struct uc_bpf_consumer *c = ptr;
+
+	if (!c)
+		return;
+
+	uloop_fd_delete(&c->fd);
+	ring_buffer__free(c->rb);
+	perf_buffer__free(c->pb);
+	ucv_put(c->batch);
+	uc_bpf_layout_free(c->layout);
+	free(c);
+}
+
+static uc_value_t *
+uc_bpf_consumer_close(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_consumer **c = (struct uc_bpf_consumer **)uc_fn_this("bpf.consumer");
+	uc_value_t *state;
+
+	if (!c || !*c)
+		return NULL;
+
+	/* dropping the registry reference may free the resource itself */
+	state = (*c)->state;
+	ucv_array_set(registry, (*c)->registry_index, NULL);
+	uc_bpf_consumer_free(*c);
+	*c = NULL;
+	ucv_put(state);
+
+	return TRUE;
+}
+
+static uc_value_t *
+uc_bpf_consumer_poll(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_consumer *c = uc_fn_thisval("bpf.consumer");
+	int ret;
+
+	if (!c)
+		err_return(EINVAL, NULL);
+
+	ret = uc_bpf_consumer_read(c);
+	if (ret < 0)
+		err_return(-ret, NULL);
+
+	return ucv_int64_new(ret);
+}
+
+static uc_value_t *
+uc_bpf_consumer_stats(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_consumer *c = uc_fn_thisval("bpf.consumer");
+	uc_value_t *rv;
+
+	if (!c)
+		err_return(EINVAL, NULL);
+
+	rv = ucv_object_new(vm);
+	ucv_object_add(rv, "records", ucv_uint64_new(c->records));
+	ucv_object_add(rv, "batches", ucv_uint64_new(c->batches));
+	ucv_object_add(rv, "lost", ucv_uint64_new(c->lost));
+
+	return rv;
+}
+
 static uc_value_t *
 uc_bpf_obj_pin(uc_vm_t *vm, size_t nargs, const char *type)
 {
@@ -695,6 +1756,95 @@ uc_bpf_tc_detach(uc_vm_t *vm, size_t nargs)
 	return uc_bpf_set_tc_hook(ifname, type, prio, NULL, -1);
 }
 
+static int
+uc_bpf_xdp_flags(uc_value_t *mode, uint32_t *flags)
+{
+	const char *str;
+
+	*flags = 0;
+	if (!mode)
+		return 0;
+
+	if (ucv_type(mode) != UC_STRING)
+		return -1;
+
+	str = ucv_string_get(mode);
+	if (!strcmp(str, "native"))
+		*flags = XDP_FLAGS_DRV_MODE;
+	else if (!strcmp(str, "generic"))
+		*flags = XDP_FLAGS_SKB_MODE;
+	else if (!strcmp(str, "offload"))
+		*flags = XDP_FLAGS_HW_MODE;
+	else
+		return -1;
+
+	return 0;
+}
+
+/*
+ * With old_fd set, the kernel only replaces or detaches the program if
+ * that program is the one currently attached, and fails with EEXIST
+ * otherwise.
+ */
+static uc_value_t *
+uc_bpf_set_xdp(uc_value_t *ifname, uc_value_t *mode, int fd, int old_fd)
+{
+	LIBBPF_OPTS(bpf_xdp_attach_opts, opts);
+	uint32_t flags;
+	int ifindex, ret;
+
+	if (ucv_type(ifname) != UC_STRING || uc_bpf_xdp_flags(mode, &flags))
+		err_return(EINVAL, NULL);
+
+	ifindex = if_nametoindex(ucv_string_get(ifname));
+	if (!ifindex)
+		err_return(ENOENT, NULL);
+
+	if (old_fd >= 0)
+		opts.old_prog_fd = old_fd;
+
+	ret = bpf_xdp_attach(ifindex, fd, flags, &opts);
+	if (ret < 0)
+		err_return(-ret, NULL);
+
+	return TRUE;
+}
+
+static uc_value_t *
+uc_bpf_program_xdp_attach(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_fd *f = uc_fn_thisval("bpf.program");
+	uc_value_t *ifname = uc_fn_arg(0);
+	uc_value_t *mode = uc_fn_arg(1);
+
+	if (!f)
+		err_return(EINVAL, NULL);
+
+	return uc_bpf_set_xdp(ifname, mode, f->fd, -1);
+}
+
+static uc_value_t *
+uc_bpf_program_xdp_detach(uc_vm_t *vm, size_t nargs)
+{
+	struct uc_bpf_fd *f = uc_fn_thisval("bpf.program");
+	uc_value_t *ifname = uc_fn_arg(0);
+	uc_value_t *mode = uc_fn_arg(1);
+
+	if (!f)
+		err_return(EINVAL, NULL);
+
+	return uc_bpf_set_xdp(ifname, mode, -1, f->fd);
+}
+
+static uc_value_t *
+uc_bpf_xdp_detach(uc_vm_t *vm, size_t nargs)
+{
+	uc_value_t *ifname = uc_fn_arg(0);
+	uc_value_t *mode = uc_fn_arg(1);
+
+	return uc_bpf_set_xdp(ifname, mode, -1, -1);
+}
+
 static int
 uc_bpf_debug_print(enum libbpf_print_level level, const char *format,
 		   va_list args)
@@ -778,6 +1928,12 @@ static const uc_function_list_t map_fns[] = {
 	{ "set",			uc_bpf_map_set },
 	{ "delete",			uc_bpf_map_delete },
 	{ "delete_all",			uc_bpf_map_delete_all },
+	{ "get_batch",			uc_bpf_map_get_batch },
+	{ "set_batch",			uc_bpf_map_set_batch },
+	{ "delete_batch",		uc_bpf_map_delete_batch },
+	{ "dump",			uc_bpf_map_dump },
+	{ "mmap",			uc_bpf_map_mmap },
+	{ "consumer",			uc_bpf_map_consumer },
 	{ "foreach",			uc_bpf_map_foreach },
 	{ "iterator",			uc_bpf_map_iterator },
 };
@@ -795,9 +1951,22 @@ static const uc_function_list_t map_iter_fns[] = {
 	{ "next_int",			uc_bpf_map_iter_next_int },
 };
 
+static const uc_function_list_t map_mmap_fns[] = {
+	{ "get",			uc_bpf_map_mmap_get },
+	{ "set",			uc_bpf_map_mmap_set },
+};
+
+static const uc_function_list_t consumer_fns[] = {
+	{ "poll",			uc_bpf_consumer_poll },
+	{ "stats",			uc_bpf_consumer_stats },
+	{ "close",			uc_bpf_consumer_close },
+};
+
 static const uc_function_list_t prog_fns[] = {
 	{ "pin",			uc_bpf_program_pin },
 	{ "tc_attach",			uc_bpf_program_tc_attach },
+	{ "xdp_attach",			uc_bpf_program_xdp_attach },
+	{ "xdp_detach",			uc_bpf_program_xdp_detach },
 };
 
 static const uc_function_list_t global_fns[] = {
@@ -807,6 +1976,7 @@ static const uc_function_list_t global_fns[] = {
 	{ "open_map",			uc_bpf_open_map },
 	{ "open_program",		uc_bpf_open_program },
 	{ "tc_detach",			uc_bpf_tc_detach },
+	{ "xdp_detach",			uc_bpf_xdp_detach },
 };
 
 void uc_module_init(uc_vm_t *vm, uc_value_t *scope)
@@ -820,5 +1990,7 @@ void uc_module_init(uc_vm_t *vm, uc_value_t *scope)
 	uc_type_declare(vm, "bpf.module", module_fns, module_free);
 	uc_type_declare(vm, "bpf.map", map_fns, uc_bpf_fd_free);
 	uc_type_declare(vm, "bpf.map_iter", map_iter_fns, NULL);
+	uc_type_declare(vm, "bpf.map_mmap", map_mmap_fns, uc_bpf_map_mmap_free);
+	uc_type_declare(vm, "bpf.consumer", consumer_fns, uc_bpf_consumer_free);
 	uc_type_declare(vm, "bpf.program", prog_fns, uc_bpf_fd_free);
 }
@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: ISC
+/*
+ * Replay recorded key input through uline and report the amount of
+ * terminal output and time spent rendering.
+ *
+ * usage: uline-replay [-p] [-c <cols>] [-n <count>] [-o <file>] <keys>
+ *
+ * <keys> holds the raw bytes sent by the terminal, e.g. recorded with
+ * "cat > keys" after "stty raw -echo". By default the input is delivered
+ * one byte at a time, like interactive typing; with -p it is delivered in
+ * large chunks, like a paste. With -o the terminal output of the last run
+ * is written to <file>, so that the screen contents of two builds can be
+ * compared.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "uline.h"
+
+struct replay_stats {
+	unsigned long writes;
+	unsigned long bytes;
+	unsigned long lines;
+	uint64_t time_ns;
+};
+
+static struct replay_stats stats;
+static FILE *dump;
+
+static ssize_t
+replay_write(void *cookie, const char *buf, size_t len)
+{
+	stats.writes++;
+	stats.bytes += len;
+	if (dump)
+		fwrite(buf, len, 1, dump);
+
+	return len;
+}
+
+static bool
+replay_key_input(struct uline_state *s, unsigned char c, unsigned int count)
+{
+	return false;
+}
+
+static void
+replay_event(struct uline_state *s, enum uline_event ev)
+{
+}
+
+static bool
+replay_line(struct uline_state *s, const char *str, size_t len)
+{
+	stats.lines++;
+
+	return true;
+}
+
+static const struct uline_cb replay_cb = {
+	.key_input = replay_key_input,
+	.event = replay_event,
+	.line = replay_line,
+};
+
+static uint64_t
+replay_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+replay_run(const char *keys, size_t len, unsigned int cols, bool paste)
+{
+	static const cookie_io_functions_t io = {
+		.write = replay_write,
+	};
+	struct uline_state s = {};
+	size_t ofs = 0, chunk;
+	uint64_t start;
+	FILE *out;
+	int fds[2];
+	ssize_t ret;
+
+	if (pipe2(fds, O_NONBLOCK))
+		return -1;
+
+	/* line buffered, like stdout on a terminal */
+	out = fopencookie(NULL, "w", io);
+	if (!out)
+		return -1;
+	setvbuf(out, NULL, _IOLBF, BUFSIZ);
+
+	uline_init(&s, &replay_cb, fds[0], out, true);
+	s.cols = cols;
+	s.rows = 25;
+	uline_set_prompt(&s, "> ");
+	fflush(out);
+
+	start = replay_time();
+	while (ofs < len) {
+		chunk = paste ? len - ofs : 1;
+		ret = write(fds[1], keys + ofs, chunk);
+		if (ret <= 0)
+			break;
+
+		ofs += ret;
+		uline_poll(&s);
+	}
+	close(fds[1]);
+	uline_poll(&s);
+	stats.time_ns += replay_time() - start;
+
+	uline_free(&s);
+	fclose(out);
+	close(fds[0]);
+
+	return 0;
+}
+
+static int usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-p] [-c <cols>] [-n <count>] [-o <file>] <keys>\n"
+		"	-p:		deliver input in large chunks (paste)\n"
+		"	-c <cols>:	terminal width (default: 80)\n"
+		"	-n <count>:	number of runs (default: 1)\n"
+		"	-o <file>:	write the terminal output of the last run to <file>\n",
+		prog);
+
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int cols = 80, count = 1, i;
+	const char *dump_file = NULL;
+	bool paste = false;
+	struct stat st;
+	char *keys;
+	int ch, fd;
+
+	while ((ch = getopt(argc, argv, "c:n:o:p")) != -1) {
+		switch (ch) {
+		case 'c':
+			cols = atoi(optarg);
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'o':
+			dump_file = optarg;
+			break;
+		case 'p':
+			paste = true;
+			break;
+		default:
+			return usage(argv[0]);
+		}
+	}
+
+	if (optind + 1 != argc || !cols || !count)
+		return usage(argv[0]);
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) || !st.st_size) {
+		perror("open");
+		return 1;
+	}
+
+	keys = malloc(st.st_size);
+	if (!keys || read(fd, keys, st.st_size) != st.st_size) {
+		perror("read");
+		return 1;
+	}
+	close(fd);
+
+	for (i = 0; i < count; i++) {
+		if (i == count - 1 && dump_file) {
+			dump = fopen(dump_file, "w");
+			if (!dump) {
+				perror("fopen");
+				return 1;
+			}
+		}
+
+		if (replay_run(keys, st.st_size, cols, paste)) {
+			perror("replay");
+			return 1;
+		}
+	}
+
+	if (dump)
+		fclose(dump);
+
+	printf("%u runs, %lld input bytes, %lu lines\n"
+	       "per run: %lu writes, %lu bytes, %llu us\n",
+	       count, (long long)st.st_size, stats.lines / count,
+	       stats.writes / count, stats.bytes / count,
+	       (unsigned long long)(stats.time_ns / count / 1000));
+
+	free(keys);
+
+	return 0;
+}
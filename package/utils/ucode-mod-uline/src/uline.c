@@ -21,6 +21,7 @@
 #include "private.h"
 
 #define LINEBUF_CHUNK 64
+#define LINEBUF_POS_INVALID ((size_t)-1)
 
 static int sigwinch_count;
 
@@ -202,6 +203,25 @@ handle_utf8(struct uline_state *s, unsigned char c)
 	return s->utf8_cont;
 }
 
+static void
+linebuf_pos_invalidate(struct linebuf *line, size_t ofs)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(line->pos_cache); i++)
+		if (line->pos_cache[i].ofs > ofs)
+			line->pos_cache[i].ofs = LINEBUF_POS_INVALID;
+}
+
+static void
+linebuf_touch(struct linebuf *line, size_t ofs)
+{
+	if (line->update_pos > ofs)
+		line->update_pos = ofs;
+	linebuf_pos_invalidate(line, ofs);
+	line->dirty = true;
+}
+
 static bool
 linebuf_insert(struct linebuf *line, char *c, size_t len)
 {
@@ -218,8 +238,7 @@ linebuf_insert(struct linebuf *line, char *c, size_t len)
 	else
 		dest[len] = 0;
 
-	if (line->update_pos > line->pos)
-		line->update_pos = line->pos;
+	linebuf_touch(line, line->pos);
 
 	memcpy(dest, c, len);
 	line->len += len;
@@ -236,8 +255,7 @@ linebuf_delete(struct linebuf *line, size_t len)
 	ssize_t tail = line->len - line->pos;
 	size_t max_len = line->len - line->pos;
 
-	if (line->update_pos > line->pos)
-		line->update_pos = line->pos;
+	linebuf_touch(line, line->pos);
 
 	if (len > max_len)
 		len = max_len;
@@ -341,6 +359,77 @@ pos_diff(struct pos start, struct pos end)
 	return diff;
 }
 
+/*
+ * Returns the screen position of a buffer offset relative to the start of
+ * the prompt. Starts from a cached position where possible, so that editing
+ * near the end of a long buffer does not rescan it from the beginning.
+ */
+static struct pos
+linebuf_get_pos(struct uline_state *s, struct linebuf *line, size_t ofs)
+{
+	struct linebuf_pos *c, *best = NULL;
+	struct pos pos = {};
+	size_t i, start = 0, len;
+
+	if (line->pos_cache_cols != s->cols) {
+		for (i = 0; i < ARRAY_SIZE(line->pos_cache); i++)
+			line->pos_cache[i].ofs = LINEBUF_POS_INVALID;
+		line->pos_cache_cols = s->cols;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(line->pos_cache); i++) {
+		c = &line->pos_cache[i];
+		if (c->ofs == LINEBUF_POS_INVALID)
+			continue;
+
+		if (c->ofs == ofs)
+			return c->pos;
+
+		if (c->ofs < ofs) {
+			if (!best || best->ofs < c->ofs)
+				best = c;
+			continue;
+		}
+
+		// without newlines or escape sequences, positions are linear
+		len = c->ofs - ofs;
+		if (memchr(line->buf + ofs, '\n', len) ||
+		    memchr(line->buf + ofs, KEY_ESC, len))
+			continue;
+
+		pos = c->pos;
+		pos_add(s, &pos, pos_convert(s, -(ssize_t)nsyms(s, line->buf + ofs, len)));
+		goto out;
+	}
+
+	if (best) {
+		pos = best->pos;
+		start = best->ofs;
+	} else if (line->prompt) {
+		pos_add_string(s, &pos, line->prompt, strlen(line->prompt));
+	}
+	pos_add_string(s, &pos, line->buf + start, ofs - start);
+
+out:
+	c = &line->pos_cache[line->pos_cache_next++ % ARRAY_SIZE(line->pos_cache)];
+	if (c == best)
+		c = &line->pos_cache[line->pos_cache_next++ % ARRAY_SIZE(line->pos_cache)];
+	c->ofs = ofs;
+	c->pos = pos;
+
+	return pos;
+}
+
+static struct pos
+line_pos(struct uline_state *s, struct linebuf *line, struct pos base,
+	 size_t ofs)
+{
+	struct pos pos = linebuf_get_pos(s, line, ofs);
+
+	pos.y += base.y;
+	return pos;
+}
+
 static void
 set_cursor(struct uline_state *s, struct pos pos)
 {
@@ -367,49 +456,84 @@ display_output_string(struct uline_state *s, const char *str,
 	pos_add_string(s, &s->cursor_pos, str, len);
 }
 
-static void
+static struct pos
 display_update_line(struct uline_state *s, struct linebuf *line,
-		    struct pos *pos)
+		    struct pos base)
 {
-	char *start = line->buf;
-	char *end = line->buf + line->len;
-	struct pos update_pos;
+	char *start, *end = line->buf + line->len;
 	size_t prompt_len = 0;
 
-	if (line->prompt)
-		prompt_len = strlen(line->prompt);
-
 	if (s->full_update) {
+		if (line->prompt)
+			prompt_len = strlen(line->prompt);
 		display_output_string(s, line->prompt, prompt_len);
-		*pos = s->cursor_pos;
 		line->update_pos = 0;
-	} else {
-		pos_add_string(s, pos, line->prompt, prompt_len);
+		line->dirty = true;
 	}
 
-	update_pos = *pos;
-	if (line->update_pos) {
-		start += line->update_pos;
-		pos_add_string(s, &update_pos, line->buf, line->update_pos);
-	}
-	set_cursor(s, update_pos);
+	if (!line->dirty)
+		return line_pos(s, line, base, line->len);
+
+	set_cursor(s, line_pos(s, line, base, line->update_pos));
 	vt100_erase_right(s->output);
+
+	start = line->buf + line->update_pos;
 	line->update_pos = line->len;
+	line->dirty = false;
 
 	if (end - start <= 0)
-		return;
+		return s->cursor_pos;
 
 	display_output_string(s, start, end - start);
 	if (s->cursor_pos.x == 0 && end[-1] != '\n')
 		vt100_next_line(s->output);
+
+	return s->cursor_pos;
+}
+
+static FILE *
+display_begin(struct uline_state *s)
+{
+	FILE *out = s->output;
+
+	if (!s->render)
+		s->render = open_memstream(&s->render_buf, &s->render_size);
+	if (!s->render)
+		return out;
+
+	rewind(s->render);
+	s->output = s->render;
+
+	return out;
+}
+
+static void
+display_end(struct uline_state *s, FILE *out)
+{
+	long len;
+
+	if (s->output != out) {
+		s->output = out;
+		fflush(s->render);
+		len = ftell(s->render);
+		if (len > 0)
+			fwrite(s->render_buf, len, 1, out);
+	}
+
+	fflush(out);
 }
 
 static void
 display_update(struct uline_state *s)
 {
-	struct pos edit_pos, end_diff;
-	struct pos base_pos = {};
+	struct pos base_pos = {}, end_pos, edit_pos, end_diff;
 	struct linebuf *line = &s->line;
+	bool changed;
+	FILE *out;
+
+	changed = s->full_update || line->dirty ||
+		  (s->line2 && s->line2->dirty);
+	out = display_begin(s);
 
 	if (s->full_update) {
 		set_cursor(s, (struct pos){});
@@ -417,35 +541,50 @@ display_update(struct uline_state *s)
 		vt100_erase_down(s->output);
 	}
 
-	display_update_line(s, line, &base_pos);
+	end_pos = display_update_line(s, line, base_pos);
 
 	if (s->line2) {
 		line = s->line2;
 
-		if (s->cursor_pos.x != 0) {
-			vt100_next_line(s->output);
-			pos_add_newline(s, &s->cursor_pos);
+		base_pos = end_pos;
+		if (base_pos.x != 0) {
+			pos_add_newline(s, &base_pos);
+			if (s->full_update || line->dirty) {
+				set_cursor(s, end_pos);
+				vt100_next_line(s->output);
+				s->cursor_pos = base_pos;
+			}
 		}
 
-		base_pos = s->cursor_pos;
-		display_update_line(s, s->line2, &base_pos);
+		end_pos = display_update_line(s, line, base_pos);
 	}
 
-	edit_pos = base_pos;
-	pos_add_string(s, &edit_pos, line->buf, line->pos);
+	edit_pos = line_pos(s, line, base_pos, line->pos);
 
-	end_diff = pos_diff(s->end_pos, s->cursor_pos);
-	s->end_pos = s->cursor_pos;
+	if (changed) {
+		set_cursor(s, end_pos);
+		end_diff = pos_diff(s->end_pos, end_pos);
+		s->end_pos = end_pos;
 
-	if (end_diff.y != 0)
-		vt100_erase_down(s->output);
-	else
-		vt100_erase_right(s->output);
+		if (end_diff.y != 0)
+			vt100_erase_down(s->output);
+		else
+			vt100_erase_right(s->output);
+	}
 
 	set_cursor(s, edit_pos);
-	fflush(s->output);
+	display_end(s, out);
 
 	s->full_update = false;
+	s->update_pending = false;
+}
+
+static void
+display_flush(struct uline_state *s)
+{
+	// wait for the rest of a partially received utf-8 symbol
+	if (s->update_pending && !s->utf8_cont)
+		display_update(s);
 }
 
 static bool
@@ -606,6 +745,8 @@ linebuf_reset(struct linebuf *line)
 	line->len = 0;
 	line->buf[0] = 0;
 	line->update_pos = 0;
+	line->dirty = true;
+	linebuf_pos_invalidate(line, 0);
 }
 
 static void
@@ -617,6 +758,9 @@ free_line2(struct uline_state *s)
 	linebuf_free(s->line2);
 	free(s->line2);
 	s->line2 = NULL;
+
+	// erase the area previously used by the secondary line
+	s->line.dirty = true;
 }
 
 static bool
@@ -624,6 +768,7 @@ process_newline(struct uline_state *s, bool drop)
 {
 	bool ret;
 
+	display_flush(s);
 	if (drop)
 		goto reset;
 
@@ -727,7 +872,7 @@ check_key_repeat(struct uline_state *s, char c)
 }
 
 static void
-process_char(struct uline_state *s, char c)
+process_char(struct uline_state *s, char c, bool defer)
 {
 	enum vt100_escape esc;
 	uint32_t data = 0;
@@ -766,36 +911,65 @@ out:
 	if (s->stop)
 		return;
 
+	// more input is already queued, render it together with this change
+	if (defer) {
+		s->update_pending = true;
+		return;
+	}
+
 	display_update(s);
 }
 
+static bool
+input_is_text(char c)
+{
+	return (unsigned char)c >= 32 && c != 127;
+}
+
 void uline_poll(struct uline_state *s)
 {
+	bool defer;
 	int ret;
 	char c;
 
 	uline_refresh_prompt(s);
 	s->stop = false;
 	while (!s->stop) {
-		ret = read(s->input, &c, 1);
-		if (ret < 0) {
-			if (errno == EINTR)
-				continue;
-			if (errno == EAGAIN)
+		if (s->input_ofs == s->input_len) {
+			ret = read(s->input, s->input_buf, sizeof(s->input_buf));
+			if (ret < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN) {
+					display_flush(s);
+					return;
+				}
+				ret = 0;
+			}
+
+			if (!ret) {
+				display_flush(s);
+				s->cb->event(s, EDITLINE_EV_EOF);
+				termios_set_orig_mode(s);
 				return;
-			ret = 0;
-		}
+			}
 
-		if (!ret) {
-			s->cb->event(s, EDITLINE_EV_EOF);
-			termios_set_orig_mode(s);
-			return;
+			s->input_len = ret;
+			s->input_ofs = 0;
 		}
 
 		if (s->sigwinch_count != sigwinch_count)
 			update_window_size(s, false);
 
-		process_char(s, c);
+		/*
+		 * Pasted text arrives in large chunks. Defer the display update
+		 * while more plain text input is queued, control characters
+		 * always see an up to date display.
+		 */
+		c = s->input_buf[s->input_ofs++];
+		defer = s->input_ofs < s->input_len &&
+			input_is_text(s->input_buf[s->input_ofs]);
+		process_char(s, c, defer);
 	}
 }
 
@@ -806,6 +980,7 @@ void uline_set_prompt(struct uline_state *s, const char *str)
 
 	free(s->line.prompt);
 	s->line.prompt = strdup(str);
+	s->line.pos_cache_cols = 0;
 	s->full_update = true;
 }
 
@@ -823,6 +998,7 @@ void uline_set_line2_prompt(struct uline_state *s, const char *str)
 
 	free(s->line2->prompt);
 	s->line2->prompt = strdup(str);
+	s->line2->pos_cache_cols = 0;
 	s->full_update = true;
 }
 
@@ -844,7 +1020,7 @@ __uline_set_line(struct uline_state *s, struct linebuf *line, const char *str, s
 		while (i > 0 && (str[i] & 0xc0) == 0x80)
 			i--;
 	}
-	line->update_pos = i;
+	linebuf_touch(line, i);
 
 	memcpy(line->buf, str, len);
 	line->len = len;
@@ -866,6 +1042,7 @@ void uline_set_line2(struct uline_state *s, const char *str, size_t len)
 
 void uline_hide_prompt(struct uline_state *s)
 {
+	s->update_pending = false;
 	set_cursor(s, (struct pos){});
 	vt100_erase_down(s->output);
 	s->full_update = true;
@@ -880,8 +1057,10 @@ void uline_refresh_prompt(struct uline_state *s)
 
 void uline_set_hint(struct uline_state *s, const char *str, size_t len)
 {
-	struct pos prev_pos = s->cursor_pos;
+	struct pos prev_pos;
 
+	display_flush(s);
+	prev_pos = s->cursor_pos;
 	if (len) {
 		vt100_next_line(s->output);
 		pos_add_newline(s, &s->cursor_pos);
@@ -942,4 +1121,7 @@ void uline_free(struct uline_state *s)
 	free_line2(s);
 	termios_set_orig_mode(s);
 	linebuf_free(&s->line);
+	if (s->render)
+		fclose(s->render);
+	free(s->render_buf);
 }
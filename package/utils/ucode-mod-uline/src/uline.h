@@ -14,6 +14,16 @@
 
 struct uline_state;
 
+struct pos {
+	int16_t x;
+	int16_t y;
+};
+
+struct linebuf_pos {
+	size_t ofs;
+	struct pos pos;
+};
+
 struct linebuf {
 	char *buf;
 	size_t len;
@@ -22,11 +32,13 @@ struct linebuf {
 	char *prompt;
 	size_t pos;
 	size_t update_pos;
-};
+	bool dirty;
 
-struct pos {
-	int16_t x;
-	int16_t y;
+	// screen positions of recently used buffer offsets, relative to the
+	// start of the prompt. only valid for pos_cache_cols terminal columns
+	struct linebuf_pos pos_cache[2];
+	unsigned int pos_cache_cols;
+	uint8_t pos_cache_next;
 };
 
 enum uline_event {
@@ -87,6 +99,16 @@ struct uline_state {
 	bool stop;
 
 	bool utf8;
+	bool update_pending;
+
+	// display updates are rendered here and written out in one go
+	FILE *render;
+	char *render_buf;
+	size_t render_size;
+
+	char input_buf[128];
+	uint8_t input_len;
+	uint8_t input_ofs;
 
 	char esc_seq[32];
 	int8_t esc_idx;
@@ -230,7 +230,7 @@ static bool conf_set_all_new_symbols(enum conf_def_mode mode)
 	sym_clear_all_valid();
 
 	for_all_symbols(i, sym) {
-		if (sym_has_value(sym) || sym->flags & SYMBOL_VALID)
+		if (sym_has_value(sym) || sym_is_valid(sym))
 			continue;
 		switch (sym_get_type(sym)) {
 		case S_BOOLEAN:
@@ -688,6 +688,25 @@ static const struct option long_opts[] = {
 	{NULL, 0, NULL, 0}
 };
 
+/* KCONFIG_PROFILE=1 prints the time spent in each processing phase */
+static bool profile;
+static struct timespec profile_ts;
+
+static void profile_phase(const char *phase)
+{
+	struct timespec now;
+
+	if (!profile)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (phase)
+		fprintf(stderr, "kconfig: %-6s %8.3f ms\n", phase,
+			(now.tv_sec - profile_ts.tv_sec) * 1e3 +
+			(now.tv_nsec - profile_ts.tv_nsec) / 1e6);
+	profile_ts = now;
+}
+
 static void conf_usage(const char *progname)
 {
 	printf("Usage: %s [options] <kconfig-file>\n", progname);
@@ -730,6 +749,9 @@ int main(int ac, char **av)
 
 	tty_stdio = isatty(0) && isatty(1);
 
+	name = getenv("KCONFIG_PROFILE");
+	profile = name && *name && strcmp(name, "0");
+
 	while ((opt = getopt_long(ac, av, "hr:w:s", long_opts, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
@@ -779,8 +801,10 @@ int main(int ac, char **av)
 		conf_usage(progname);
 		exit(1);
 	}
+	profile_phase(NULL);
 	conf_parse(av[optind]);
 	//zconfdump(stdout);
+	profile_phase("parse");
 
 	switch (input_mode) {
 	case defconfig:
@@ -814,6 +838,8 @@ int main(int ac, char **av)
 		break;
 	}
 
+	profile_phase("read");
+
 	if (sync_kconfig) {
 		name = getenv("KCONFIG_NOSILENTUPDATE");
 		if (name && *name) {
@@ -877,6 +903,8 @@ int main(int ac, char **av)
 		break;
 	}
 
+	profile_phase("calc");
+
 	if (input_mode == savedefconfig) {
 		if (conf_write_defconfig(defconfig_file)) {
 			fprintf(stderr, "n*** Error while saving defconfig to: %s\n\n",
@@ -905,5 +933,10 @@ int main(int ac, char **av)
 			return 1;
 		}
 	}
+
+	profile_phase("write");
+	if (profile)
+		sym_profile_report(stderr, 20);
+
 	return 0;
 }
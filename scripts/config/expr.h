@@ -92,11 +92,18 @@ struct symbol {
 
 	/*
 	 * The calculated value of the symbol. The SYMBOL_VALID bit is set in
-	 * 'flags' when this is up to date. Note that this value might differ
-	 * from the user value set in e.g. a .config file, due to visibility.
+	 * 'flags' and 'calc_gen' matches sym_generation when this is up to
+	 * date. Note that this value might differ from the user value set in
+	 * e.g. a .config file, due to visibility.
 	 */
 	struct symbol_value curr;
 
+	/* Value of sym_generation when 'curr' was last calculated */
+	unsigned int calc_gen;
+
+	/* Number of times 'curr' was (re)calculated, see KCONFIG_PROFILE */
+	unsigned int calc_count;
+
 	/*
 	 * Values for the symbol provided from outside. def[S_DEF_USER] holds
 	 * the .config value.
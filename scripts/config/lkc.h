@@ -108,13 +108,29 @@ struct gstr get_relations_str(struct symbol **sym_arr, struct list_head *head);
 void menu_get_ext_help(struct menu *menu, struct gstr *help);
 
 /* symbol.c */
+extern unsigned int sym_generation;
 void sym_clear_all_valid(void);
+void sym_profile_report(FILE *out, int count);
 struct symbol *sym_choice_default(struct symbol *sym);
 struct property *sym_get_range_prop(struct symbol *sym);
 const char *sym_get_string_default(struct symbol *sym);
 struct symbol *sym_check_deps(struct symbol *sym);
 struct symbol *prop_get_symbol(struct property *prop);
 
+/*
+ * A calculated value stays valid until the next sym_clear_all_valid(), which
+ * just bumps sym_generation instead of walking the whole symbol table
+ * (only a wraparound of the counter resets the cached values explicitly).
+ * Constant symbols never need to be recalculated.
+ */
+static inline bool sym_is_valid(struct symbol *sym)
+{
+	if (!(sym->flags & SYMBOL_VALID))
+		return false;
+
+	return (sym->flags & SYMBOL_CONST) || sym->calc_gen == sym_generation;
+}
+
 static inline tristate sym_get_tristate_value(struct symbol *sym)
 {
 	return sym->curr.tri;
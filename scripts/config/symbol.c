@@ -38,6 +38,7 @@ static struct symbol symbol_empty = {
 struct symbol *modules_sym;
 static tristate modules_val;
 int recursive_is_error;
+unsigned int sym_generation = 1;
 
 enum symbol_type sym_get_type(struct symbol *sym)
 {
@@ -308,7 +309,7 @@ void sym_calc_value(struct symbol *sym)
 	if (!sym)
 		return;
 
-	if (sym->flags & SYMBOL_VALID)
+	if (sym_is_valid(sym))
 		return;
 
 	if (sym_is_choice_value(sym) &&
@@ -319,6 +320,8 @@ void sym_calc_value(struct symbol *sym)
 	}
 
 	sym->flags |= SYMBOL_VALID;
+	sym->calc_gen = sym_generation;
+	sym->calc_count++;
 
 	oldval = sym->curr;
 
@@ -445,15 +448,69 @@ void sym_calc_value(struct symbol *sym)
 
 void sym_clear_all_valid(void)
 {
-	struct symbol *sym;
-	int i;
-
-	for_all_symbols(i, sym)
-		sym->flags &= ~SYMBOL_VALID;
+	/*
+	 * Invalidate all calculated values at once. Walking the whole symbol
+	 * table on every change is quadratic for the large trees generated
+	 * from package feeds. This is a global invalidation, not a per-symbol
+	 * dependency walk: every symbol is recalculated on its next access.
+	 */
+	if (!++sym_generation) {
+		struct symbol *sym;
+		int i;
+
+		/* Counter wrapped, stale calc_gen values could match again */
+		for_all_symbols(i, sym) {
+			if (sym->flags & SYMBOL_CONST)
+				continue;
+			sym->flags &= ~SYMBOL_VALID;
+			sym->calc_gen = 0;
+		}
+		sym_generation = 1;
+	}
 	conf_set_changed(true);
 	sym_calc_value(modules_sym);
 }
 
+static int sym_calc_count_cmp(const void *a, const void *b)
+{
+	const struct symbol *sa = *(const struct symbol **)a;
+	const struct symbol *sb = *(const struct symbol **)b;
+
+	if (sa->calc_count != sb->calc_count)
+		return sa->calc_count < sb->calc_count ? 1 : -1;
+
+	return strcmp(sa->name ?: "", sb->name ?: "");
+}
+
+void sym_profile_report(FILE *out, int count)
+{
+	struct symbol *sym, **syms;
+	unsigned long total = 0;
+	int i, n = 0;
+
+	for_all_symbols(i, sym)
+		if (sym->calc_count)
+			n++;
+
+	syms = xcalloc(n ?: 1, sizeof(*syms));
+	n = 0;
+	for_all_symbols(i, sym) {
+		if (!sym->calc_count)
+			continue;
+		syms[n++] = sym;
+		total += sym->calc_count;
+	}
+	qsort(syms, n, sizeof(*syms), sym_calc_count_cmp);
+
+	fprintf(out, "kconfig: %d symbols calculated %lu times, %u invalidations\n",
+		n, total, sym_generation - 1);
+	for (i = 0; i < n && i < count; i++)
+		fprintf(out, "kconfig: %10u  %s\n", syms[i]->calc_count,
+			syms[i]->name ?: "<choice>");
+
+	free(syms);
+}
+
 bool sym_tristate_within_range(struct symbol *sym, tristate val)
 {
 	int type = sym_get_type(sym);
@@ -34,7 +34,11 @@
  *   reorder the script as an lzma wrapper; do not depend on flash access
  */
 
+#ifdef LOADER_LZ4
+#include "unlz4.h"
+#else
 #include "LzmaDecode.h"
+#endif
 
 #define KSEG0			0x80000000
 #define KSEG1			0xa0000000
@@ -78,37 +82,63 @@ static __inline__ void blast_dcache(unsigned long size, unsigned long lsize)
 	}
 }
 
-unsigned char *data;
+/* This puts lzma workspace 128k below RAM end.
+ * That should be enough for both lzma and stack
+ */
+static char *buffer = (char *)(RAMSTART + RAMSIZE - 0x00020000);
+extern unsigned char lzma_start[];
+extern unsigned char lzma_end[];
 
-static int read_byte(void *object, unsigned char **buffer, UInt32 *bufferSize)
+#ifdef LOADER_LZ4
+static __inline__ int decompress(unsigned char *out)
 {
-	*bufferSize = 1;
-	*buffer = data;
-	++data;
-	return LZMA_RESULT_OK;
-}
+	unsigned int osize;
 
-static __inline__ unsigned char get_byte(void)
+	/* everything up to the workspace may be used for the kernel */
+	return unlz4(lzma_start, lzma_end - lzma_start, out,
+		     (unsigned char *)buffer - out, &osize) != UNLZ4_OK;
+}
+#else
+static __inline__ unsigned int get_le32(const unsigned char *p)
 {
-	unsigned char *buffer;
-	UInt32 fake;
-
-	return read_byte(0, &buffer, &fake), *buffer;
+	return ((unsigned int)p[0]) +
+		((unsigned int)p[1] << 8) +
+		((unsigned int)p[2] << 16) +
+		((unsigned int)p[3] << 24);
 }
 
-/* This puts lzma workspace 128k below RAM end.
- * That should be enough for both lzma and stack
+/*
+ * The payload is linked into the loader, so hand the whole of it to the
+ * decoder at once instead of feeding it through a byte sized callback.
  */
-static char *buffer = (char *)(RAMSTART + RAMSIZE - 0x00020000);
-extern char lzma_start[];
-extern char lzma_end[];
+static __inline__ int decompress(unsigned char *out)
+{
+	CLzmaDecoderState vs;
+	unsigned char *data = lzma_start;
+	SizeT isize, osize;
+	unsigned int i;
+
+	/* lzma args */
+	i = data[0];
+	vs.Properties.lc = i % 9, i = i / 9;
+	vs.Properties.lp = i % 5, vs.Properties.pb = i / 5;
+
+	vs.Probs = (CProb *)buffer;
+
+	/* the header ends with the 64 bit uncompressed size, only the
+	 * lower half of it is used */
+	osize = get_le32(&data[LZMA_PROPERTIES_SIZE]);
+	data += LZMA_PROPERTIES_SIZE + 8;
+
+	return LzmaDecode(&vs, data, lzma_end - data, &isize,
+			  out, osize, &osize) != LZMA_RESULT_OK;
+}
+#endif
 
 /* should be the first function */
 void entry(unsigned long icache_size, unsigned long icache_lsize,
 	unsigned long dcache_size, unsigned long dcache_lsize)
 {
-	unsigned int i;  /* temp value */
-	unsigned int osize; /* uncompressed size */
 	volatile unsigned int arg0, arg1, arg2, arg3;
 
 	/* restore argument registers */
@@ -117,36 +147,8 @@ void entry(unsigned long icache_size, unsigned long icache_lsize,
 	__asm__ __volatile__ ("ori %0, $14, 0":"=r"(arg2));
 	__asm__ __volatile__ ("ori %0, $15, 0":"=r"(arg3));
 
-	ILzmaInCallback callback;
-	CLzmaDecoderState vs;
-	callback.Read = read_byte;
-
-	data = lzma_start;
-
-	/* lzma args */
-	i = get_byte();
-	vs.Properties.lc = i % 9, i = i / 9;
-	vs.Properties.lp = i % 5, vs.Properties.pb = i / 5;
-
-	vs.Probs = (CProb *)buffer;
-
-	/* skip rest of the LZMA coder property */
-	for (i = 0; i < 4; i++)
-		get_byte();
-
-	/* read the lower half of uncompressed size in the header */
-	osize = ((unsigned int)get_byte()) +
-		((unsigned int)get_byte() << 8) +
-		((unsigned int)get_byte() << 16) +
-		((unsigned int)get_byte() << 24);
-
-	/* skip rest of the header (upper half of uncompressed size) */
-	for (i = 0; i < 4; i++)
-		get_byte();
-
 	/* decompress kernel */
-	if ((i = LzmaDecode(&vs, &callback,
-	(unsigned char*)KERNEL_ENTRY, osize, &osize)) == LZMA_RESULT_OK)
+	if (decompress((unsigned char *)KERNEL_ENTRY) == 0)
 	{
 		blast_dcache(dcache_size, dcache_lsize);
 		blast_icache(icache_size, icache_lsize);
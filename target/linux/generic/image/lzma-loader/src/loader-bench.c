@@ -0,0 +1,173 @@
+/*
+ * Host benchmark for the loader decompressors
+ *
+ * Decodes the same payload compressed with LZMA and with LZ4 (legacy
+ * format) through the decoders used by the loader, checks the output
+ * against the original and prints the compressed size and decode time of
+ * both. The LZMA path is set up the same way as in decompress.c, with the
+ * whole payload handed to LzmaDecode at once.
+ *
+ * usage: loader-bench <file> <file.lzma> <file.lz4> [runs]
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "LzmaDecode.h"
+#include "unlz4.h"
+
+static unsigned char *read_file(const char *name, unsigned int *len)
+{
+	unsigned char *buf = NULL;
+	FILE *f;
+	long size;
+
+	f = fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		return NULL;
+	}
+
+	if (!fseek(f, 0, SEEK_END) && (size = ftell(f)) > 0) {
+		rewind(f);
+		buf = malloc(size);
+		if (buf && fread(buf, 1, size, f) != (size_t)size) {
+			free(buf);
+			buf = NULL;
+		}
+		*len = size;
+	}
+	fclose(f);
+
+	if (!buf)
+		fprintf(stderr, "%s: read failed\n", name);
+
+	return buf;
+}
+
+static double now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int decode_lzma(const unsigned char *data, unsigned int len,
+		       unsigned char *out, unsigned int out_max,
+		       unsigned int *out_len)
+{
+	CLzmaDecoderState vs;
+	SizeT isize, osize;
+	unsigned int i;
+	int ret;
+
+	if (len < LZMA_PROPERTIES_SIZE + 8)
+		return LZMA_RESULT_DATA_ERROR;
+
+	i = data[0];
+	vs.Properties.lc = i % 9, i = i / 9;
+	vs.Properties.lp = i % 5, vs.Properties.pb = i / 5;
+
+	vs.Probs = malloc(LzmaGetNumProbs(&vs.Properties) * sizeof(CProb));
+	if (!vs.Probs)
+		return LZMA_RESULT_DATA_ERROR;
+
+	/* streams written with an unknown size run to the end of the buffer */
+	osize = data[5] | (data[6] << 8) | (data[7] << 16) |
+		((unsigned int)data[8] << 24);
+	if (osize > out_max)
+		osize = out_max;
+
+	data += LZMA_PROPERTIES_SIZE + 8;
+	len -= LZMA_PROPERTIES_SIZE + 8;
+
+	ret = LzmaDecode(&vs, data, len, &isize, out, osize, &osize);
+	*out_len = osize;
+	free(vs.Probs);
+
+	return ret;
+}
+
+static int decode_lz4(const unsigned char *data, unsigned int len,
+		      unsigned char *out, unsigned int out_max,
+		      unsigned int *out_len)
+{
+	return unlz4(data, len, out, out_max, out_len);
+}
+
+static int bench(const char *name,
+		 int (*decode)(const unsigned char *, unsigned int,
+			       unsigned char *, unsigned int, unsigned int *),
+		 const char *file, const unsigned char *raw, unsigned int raw_len,
+		 unsigned char *out, int runs)
+{
+	unsigned char *data;
+	unsigned int len, out_len;
+	double start, ms;
+	int i;
+
+	data = read_file(file, &len);
+	if (!data)
+		return 1;
+
+	start = now_ms();
+	for (i = 0; i < runs; i++) {
+		memset(out, 0, raw_len);
+		if (decode(data, len, out, raw_len, &out_len) ||
+		    out_len != raw_len || memcmp(out, raw, raw_len)) {
+			fprintf(stderr, "%s: decoded data differs from the original\n",
+				file);
+			free(data);
+			return 1;
+		}
+	}
+	ms = (now_ms() - start) / runs;
+
+	printf("%-5s %9u bytes (%5.1f%%) %8.2f ms %8.1f MB/s\n", name, len,
+	       100.0 * len / raw_len, ms, raw_len / ms / 1000);
+
+	free(data);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char *raw, *out;
+	unsigned int raw_len;
+	int runs = 10, ret;
+
+	if (argc < 4 || argc > 5) {
+		fprintf(stderr, "usage: %s <file> <file.lzma> <file.lz4> [runs]\n",
+			argv[0]);
+		return 1;
+	}
+
+	if (argc > 4)
+		runs = atoi(argv[4]);
+	if (runs < 1)
+		runs = 1;
+
+	raw = read_file(argv[1], &raw_len);
+	if (!raw)
+		return 1;
+
+	out = malloc(raw_len);
+	if (!out)
+		return 1;
+
+	printf("%-5s %9u bytes\n", "raw", raw_len);
+	ret = bench("lzma", decode_lzma, argv[2], raw, raw_len, out, runs);
+	ret |= bench("lz4", decode_lz4, argv[3], raw, raw_len, out, runs);
+
+	free(out);
+	free(raw);
+
+	return ret;
+}
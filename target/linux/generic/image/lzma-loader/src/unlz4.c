@@ -0,0 +1,136 @@
+/*
+ * LZ4 legacy format decompressor for the kernel loader
+ *
+ * Decodes the output of "lz4c -l", i.e. the same format the kernel uses
+ * for its own LZ4 compressed images. The whole payload is linked into the
+ * loader, so input and output are plain memory buffers.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include "unlz4.h"
+
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_MIN_MATCH		4
+
+struct unaligned_u32 {
+	unsigned int v;
+} __attribute__((packed));
+
+static inline unsigned int get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static inline void copy_u32(unsigned char *dst, const unsigned char *src)
+{
+	((struct unaligned_u32 *)dst)->v = ((const struct unaligned_u32 *)src)->v;
+}
+
+static inline int get_len(const unsigned char **ip, const unsigned char *end,
+			  unsigned int *len)
+{
+	unsigned int c;
+
+	do {
+		if (*ip >= end)
+			return -1;
+		c = *(*ip)++;
+		*len += c;
+	} while (c == 255);
+
+	return 0;
+}
+
+static int unlz4_block(const unsigned char *ip, const unsigned char *iend,
+		       unsigned char *out, unsigned char **opp, unsigned char *oend)
+{
+	unsigned char *op = *opp;
+	const unsigned char *match;
+	unsigned int token, len, offset;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* literals, copied a word at a time */
+		len = token >> 4;
+		if (len == 15 && get_len(&ip, iend, &len))
+			return -1;
+
+		if (len > (unsigned int)(iend - ip) ||
+		    len > (unsigned int)(oend - op))
+			return -1;
+
+		for (; len >= 4; len -= 4, ip += 4, op += 4)
+			copy_u32(op, ip);
+		while (len--)
+			*op++ = *ip++;
+
+		/* the last sequence of a block has no match */
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		len = token & 15;
+		if (len == 15 && get_len(&ip, iend, &len))
+			return -1;
+		len += LZ4_MIN_MATCH;
+
+		if (!offset || offset > (unsigned int)(op - out) ||
+		    len > (unsigned int)(oend - op))
+			return -1;
+
+		match = op - offset;
+		if (offset >= 4) {
+			/* no overlap within a word, copy forward in words */
+			for (; len >= 4; len -= 4, match += 4, op += 4)
+				copy_u32(op, match);
+		}
+		while (len--)
+			*op++ = *match++;
+	}
+
+	*opp = op;
+	return 0;
+}
+
+int unlz4(const unsigned char *in, unsigned int in_len,
+	  unsigned char *out, unsigned int out_max, unsigned int *out_len)
+{
+	const unsigned char *ip = in, *iend = in + in_len;
+	unsigned char *op = out, *oend = out + out_max;
+	unsigned int size;
+
+	if (in_len < 4 || get_le32(ip) != LZ4_LEGACY_MAGIC)
+		return UNLZ4_DATA_ERROR;
+	ip += 4;
+
+	/* only a stream ending right after a complete chunk is accepted */
+	while (ip < iend) {
+		if (iend - ip < 4)
+			return UNLZ4_DATA_ERROR;
+
+		size = get_le32(ip);
+		ip += 4;
+
+		/* concatenated streams start over with the magic */
+		if (size == LZ4_LEGACY_MAGIC)
+			continue;
+
+		if (!size || size > (unsigned int)(iend - ip))
+			return UNLZ4_DATA_ERROR;
+
+		if (unlz4_block(ip, ip + size, out, &op, oend))
+			return UNLZ4_DATA_ERROR;
+		ip += size;
+	}
+
+	*out_len = op - out;
+	return UNLZ4_OK;
+}
@@ -0,0 +1,18 @@
+/*
+ * LZ4 legacy format decompressor for the kernel loader
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#ifndef _UNLZ4_H
+#define _UNLZ4_H
+
+#define UNLZ4_OK		0
+#define UNLZ4_DATA_ERROR	1
+
+int unlz4(const unsigned char *in, unsigned int in_len,
+	  unsigned char *out, unsigned int out_max, unsigned int *out_len);
+
+#endif /* _UNLZ4_H */
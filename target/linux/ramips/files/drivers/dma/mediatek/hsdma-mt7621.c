@@ -40,7 +40,7 @@
 #define HSDMA_REG_SCH_Q23		0x284
 
 #define HSDMA_DESCS_MAX			0xfff
-#define HSDMA_DESCS_NUM			8
+#define HSDMA_DESCS_NUM			64
 #define HSDMA_DESCS_MASK		(HSDMA_DESCS_NUM - 1)
 #define HSDMA_NEXT_DESC(x)		(((x) + 1) & HSDMA_DESCS_MASK)
 
@@ -119,6 +119,8 @@
 #define HSDMA_ALIGN_SIZE		3
 /* align size 128bytes */
 #define HSDMA_MAX_PLEN			0x3f80
+/* one rx desc per segment, one rx desc is always kept free */
+#define HSDMA_MAX_SGS			(HSDMA_DESCS_NUM - 1)
 
 struct hsdma_desc {
 	u32 addr0;
@@ -136,6 +138,8 @@ struct mtk_hsdma_sg {
 struct mtk_hsdma_desc {
 	struct virt_dma_desc vdesc;
 	unsigned int num_sgs;
+	unsigned int done_sgs;
+	bool queued;
 	struct mtk_hsdma_sg sg[1];
 };
 
@@ -147,8 +151,7 @@ struct mtk_hsdma_chan {
 	int rx_idx;
 	struct hsdma_desc *tx_ring;
 	struct hsdma_desc *rx_ring;
-	struct mtk_hsdma_desc *desc;
-	unsigned int next_sg;
+	unsigned int inflight;	/* rx descs owned by the hardware */
 };
 
 struct mtk_hsdam_engine {
@@ -193,6 +196,7 @@ static void mtk_hsdma_reset_chan(struct mtk_hsdam_engine *hsdma,
 {
 	chan->tx_idx = 0;
 	chan->rx_idx = HSDMA_DESCS_NUM - 1;
+	chan->inflight = 0;
 
 	mtk_hsdma_write(hsdma, HSDMA_REG_TX_CTX, chan->tx_idx);
 	mtk_hsdma_write(hsdma, HSDMA_REG_RX_CRX, chan->rx_idx);
@@ -285,7 +289,6 @@ static int mtk_hsdma_terminate_all(struct dma_chan *c)
 	LIST_HEAD(head);
 
 	spin_lock_bh(&chan->vchan.lock);
-	chan->desc = NULL;
 	clear_bit(chan->id, &hsdma->chan_issued);
 	vchan_get_all_descriptors(&chan->vchan, &head);
 	spin_unlock_bh(&chan->vchan.lock);
@@ -308,8 +311,8 @@ static int mtk_hsdma_terminate_all(struct dma_chan *c)
 	return 0;
 }
 
-static int mtk_hsdma_start_transfer(struct mtk_hsdam_engine *hsdma,
-				    struct mtk_hsdma_chan *chan)
+static void mtk_hsdma_queue_desc(struct mtk_hsdma_chan *chan,
+				 struct mtk_hsdma_desc *desc)
 {
 	dma_addr_t src, dst;
 	size_t len, tlen;
@@ -318,13 +321,12 @@ static int mtk_hsdma_start_transfer(struct mtk_hsdam_engine *hsdma,
 	unsigned int i;
 	int rx_idx;
 
-	sg = &chan->desc->sg[0];
-	len = sg->len;
-	chan->desc->num_sgs = DIV_ROUND_UP(len, HSDMA_MAX_PLEN);
+	sg = &desc->sg[0];
 
-	/* tx desc */
+	/* tx desc, two segments per desc, LS marks the end of this copy */
+	len = sg->len;
 	src = sg->src_addr;
-	for (i = 0; i < chan->desc->num_sgs; i++) {
+	for (i = 0; i < desc->num_sgs; i++) {
 		tx_desc = &chan->tx_ring[chan->tx_idx];
 
 		if (len > HSDMA_MAX_PLEN)
@@ -351,11 +353,11 @@ static int mtk_hsdma_start_transfer(struct mtk_hsdam_engine *hsdma,
 	else
 		tx_desc->flags |= HSDMA_DESC_LS1;
 
-	/* rx desc */
-	rx_idx = HSDMA_NEXT_DESC(chan->rx_idx);
+	/* rx desc, behind the ones still owned by the hardware */
+	rx_idx = (chan->rx_idx + 1 + chan->inflight) & HSDMA_DESCS_MASK;
 	len = sg->len;
 	dst = sg->dst_addr;
-	for (i = 0; i < chan->desc->num_sgs; i++) {
+	for (i = 0; i < desc->num_sgs; i++) {
 		rx_desc = &chan->rx_ring[rx_idx];
 		if (len > HSDMA_MAX_PLEN)
 			tlen = HSDMA_MAX_PLEN;
@@ -372,50 +374,74 @@ static int mtk_hsdma_start_transfer(struct mtk_hsdam_engine *hsdma,
 		rx_idx = HSDMA_NEXT_DESC(rx_idx);
 	}
 
-	/* make sure desc and index all up to date */
-	wmb();
-	mtk_hsdma_write(hsdma, HSDMA_REG_TX_CTX, chan->tx_idx);
-
-	return 0;
+	chan->inflight += desc->num_sgs;
+	desc->queued = true;
 }
 
-static int gdma_next_desc(struct mtk_hsdma_chan *chan)
+/*
+ * Put as many issued copies on the rings as there is room for, so that
+ * back to back copies are chained and the hardware does not idle until
+ * the completion of the previous one has been handled.
+ */
+static void mtk_hsdma_start_transfer(struct mtk_hsdam_engine *hsdma,
+				     struct mtk_hsdma_chan *chan)
 {
 	struct virt_dma_desc *vdesc;
+	struct mtk_hsdma_desc *desc;
+	bool kick = false;
+
+	list_for_each_entry(vdesc, &chan->vchan.desc_issued, node) {
+		desc = to_mtk_hsdma_desc(vdesc);
+		if (desc->queued)
+			continue;
 
-	vdesc = vchan_next_desc(&chan->vchan);
-	if (!vdesc) {
-		chan->desc = NULL;
-		return 0;
+		if (chan->inflight + desc->num_sgs > HSDMA_MAX_SGS)
+			break;
+
+		mtk_hsdma_queue_desc(chan, desc);
+		kick = true;
 	}
-	chan->desc = to_mtk_hsdma_desc(vdesc);
-	chan->next_sg = 0;
 
-	return 1;
+	if (!kick)
+		return;
+
+	/* make sure desc and index all up to date */
+	wmb();
+	mtk_hsdma_write(hsdma, HSDMA_REG_TX_CTX, chan->tx_idx);
 }
 
 static void mtk_hsdma_chan_done(struct mtk_hsdam_engine *hsdma,
-				struct mtk_hsdma_chan *chan)
+				struct mtk_hsdma_chan *chan, int cnt)
 {
+	struct virt_dma_desc *vdesc;
 	struct mtk_hsdma_desc *desc;
-	int chan_issued;
+	unsigned int n;
 
-	chan_issued = 0;
-	spin_lock_bh(&chan->vchan.lock);
-	desc = chan->desc;
-	if (likely(desc)) {
-		if (chan->next_sg == desc->num_sgs) {
+	/* copies complete in the order they were queued */
+	while (cnt) {
+		vdesc = vchan_next_desc(&chan->vchan);
+		if (!vdesc) {
+			dev_dbg(hsdma->ddev.dev, "no desc to complete\n");
+			break;
+		}
+
+		desc = to_mtk_hsdma_desc(vdesc);
+		if (!desc->queued)
+			break;
+
+		n = min_t(unsigned int, cnt, desc->num_sgs - desc->done_sgs);
+		desc->done_sgs += n;
+		cnt -= n;
+
+		if (desc->done_sgs == desc->num_sgs) {
 			list_del(&desc->vdesc.node);
 			vchan_cookie_complete(&desc->vdesc);
-			chan_issued = gdma_next_desc(chan);
 		}
-	} else {
-		dev_dbg(hsdma->ddev.dev, "no desc to complete\n");
 	}
 
-	if (chan_issued)
+	/* ring space was freed, queue whatever is still waiting */
+	if (!list_empty(&chan->vchan.desc_issued))
 		set_bit(chan->id, &hsdma->chan_issued);
-	spin_unlock_bh(&chan->vchan.lock);
 }
 
 static irqreturn_t mtk_hsdma_irq(int irq, void *devid)
@@ -443,13 +469,9 @@ static void mtk_hsdma_issue_pending(struct dma_chan *c)
 	struct mtk_hsdam_engine *hsdma = mtk_hsdma_chan_get_dev(chan);
 
 	spin_lock_bh(&chan->vchan.lock);
-	if (vchan_issue_pending(&chan->vchan) && !chan->desc) {
-		if (gdma_next_desc(chan)) {
-			set_bit(chan->id, &hsdma->chan_issued);
-			tasklet_schedule(&hsdma->task);
-		} else {
-			dev_dbg(hsdma->ddev.dev, "no desc to issue\n");
-		}
+	if (vchan_issue_pending(&chan->vchan)) {
+		set_bit(chan->id, &hsdma->chan_issued);
+		tasklet_schedule(&hsdma->task);
 	}
 	spin_unlock_bh(&chan->vchan.lock);
 }
@@ -464,6 +486,11 @@ static struct dma_async_tx_descriptor *mtk_hsdma_prep_dma_memcpy(
 	if (len <= 0)
 		return NULL;
 
+	if (len > HSDMA_MAX_SGS * HSDMA_MAX_PLEN) {
+		dev_err(c->device->dev, "memcpy len %zu too large\n", len);
+		return NULL;
+	}
+
 	desc = kzalloc(sizeof(*desc), GFP_ATOMIC);
 	if (!desc) {
 		dev_err(c->device->dev, "alloc memcpy decs error\n");
@@ -473,6 +500,7 @@ static struct dma_async_tx_descriptor *mtk_hsdma_prep_dma_memcpy(
 	desc->sg[0].src_addr = src;
 	desc->sg[0].dst_addr = dest;
 	desc->sg[0].len = len;
+	desc->num_sgs = DIV_ROUND_UP(len, HSDMA_MAX_PLEN);
 
 	return vchan_tx_prep(&chan->vchan, &desc->vdesc, flags);
 }
@@ -500,10 +528,9 @@ static void mtk_hsdma_tx(struct mtk_hsdam_engine *hsdma)
 
 	if (test_and_clear_bit(0, &hsdma->chan_issued)) {
 		chan = &hsdma->chan[0];
-		if (chan->desc)
-			mtk_hsdma_start_transfer(hsdma, chan);
-		else
-			dev_dbg(hsdma->ddev.dev, "chan 0 no desc to issue\n");
+		spin_lock_bh(&chan->vchan.lock);
+		mtk_hsdma_start_transfer(hsdma, chan);
+		spin_unlock_bh(&chan->vchan.lock);
 	}
 }
 
@@ -520,14 +547,16 @@ static void mtk_hsdma_rx(struct mtk_hsdam_engine *hsdma)
 	if (!cnt)
 		return;
 
-	chan->next_sg += cnt;
+	spin_lock_bh(&chan->vchan.lock);
 	chan->rx_idx = (chan->rx_idx + cnt) & HSDMA_DESCS_MASK;
+	chan->inflight -= min_t(unsigned int, cnt, chan->inflight);
 
 	/* update rx crx */
 	wmb();
 	mtk_hsdma_write(hsdma, HSDMA_REG_RX_CRX, chan->rx_idx);
 
-	mtk_hsdma_chan_done(hsdma, chan);
+	mtk_hsdma_chan_done(hsdma, chan, cnt);
+	spin_unlock_bh(&chan->vchan.lock);
 }
 
 static void mtk_hsdma_tasklet(struct tasklet_struct *t)
@@ -929,6 +929,8 @@ struct msdc_host {
 	int                         irq;            /* host interrupt */
 
 	struct delayed_work		card_delaywork;
+	struct work_struct		req_work;       /* runs async requests */
+	struct mmc_request		*async_mrq;
 
 	struct completion           cmd_done;
 	struct completion           xfer_done;
@@ -39,6 +39,7 @@
 #include <linux/spinlock.h>
 #include <linux/platform_device.h>
 #include <linux/interrupt.h>
+#include <linux/workqueue.h>
 #include <linux/of.h>
 
 #include <linux/mmc/host.h>
@@ -100,6 +101,10 @@
 #define MAX_SGMT_SZ         (MAX_DMA_CNT)
 #define MAX_REQ_SZ          (MAX_SGMT_SZ * 8)
 
+/* data->host_cookie */
+#define MSDC_PREPARE_FLAG   BIT(0)  /* sg list is dma mapped */
+#define MSDC_ASYNC_FLAG     BIT(1)  /* mapped by pre_req, unmapped by post_req */
+
 static int cd_active_low = 1;
 
 //=================================
@@ -1034,16 +1039,6 @@ static void msdc_dma_stop(struct msdc_host *host)
 	N_MSG(DMA, "DMA stop");
 }
 
-/* calc checksum */
-static u8 msdc_dma_calcs(u8 *buf, u32 len)
-{
-	u32 i, sum = 0;
-
-	for (i = 0; i < len; i++)
-		sum += buf[i];
-	return 0xFF - (u8)sum;
-}
-
 /* gpd bd setup + dma registers */
 static void msdc_dma_config(struct msdc_host *host, struct msdc_dma *dma)
 {
@@ -1084,26 +1079,16 @@ static void msdc_dma_config(struct msdc_host *host, struct msdc_dma *dma)
 		//gpd->intr = 0;
 		gpd->hwo = 1;  /* hw will clear it */
 		gpd->bdp = 1;
-		gpd->chksum = 0;  /* need to clear first. */
-		gpd->chksum = msdc_dma_calcs((u8 *)gpd, 16);
 
-		/* modify bd*/
+		/* modify bd, the next pointers are fixed in msdc_init_gpd_bd() */
 		for_each_sg(dma->sg, sg, dma->sglen, j) {
-			bd[j].blkpad = 0;
-			bd[j].dwpad = 0;
 			bd[j].ptr = (void *)sg_dma_address(sg);
 			bd[j].buflen = sg_dma_len(sg);
-
-			if (j == dma->sglen - 1)
-				bd[j].eol = 1;	/* the last bd */
-			else
-				bd[j].eol = 0;
-
-			bd[j].chksum = 0; /* checksume need to clear first */
-			bd[j].chksum = msdc_dma_calcs((u8 *)(&bd[j]), 16);
+			bd[j].eol = (j == dma->sglen - 1);	/* the last bd */
 		}
 
-		sdr_set_field(MSDC_DMA_CFG, MSDC_DMA_CFG_DECSEN, 1);
+		/* descriptor checksums are not verified, don't compute them */
+		sdr_set_field(MSDC_DMA_CFG, MSDC_DMA_CFG_DECSEN, 0);
 		sdr_set_field(MSDC_DMA_CTRL, MSDC_DMA_CTRL_BRUSTSZ,
 			      MSDC_BRUST_64B);
 		sdr_set_field(MSDC_DMA_CTRL, MSDC_DMA_CTRL_MODE, 1);
@@ -1137,6 +1122,29 @@ static void msdc_dma_setup(struct msdc_host *host, struct msdc_dma *dma,
 	msdc_dma_config(host, dma);
 }
 
+static void msdc_prepare_data(struct msdc_host *host, struct mmc_data *data)
+{
+	if (data->host_cookie & MSDC_PREPARE_FLAG)
+		return;
+
+	data->sg_count = dma_map_sg(mmc_dev(host->mmc), data->sg,
+				    data->sg_len, mmc_get_dma_dir(data));
+	if (data->sg_count)
+		data->host_cookie |= MSDC_PREPARE_FLAG;
+}
+
+static void msdc_unprepare_data(struct msdc_host *host, struct mmc_data *data)
+{
+	if (data->host_cookie & MSDC_ASYNC_FLAG)
+		return;
+
+	if (data->host_cookie & MSDC_PREPARE_FLAG) {
+		dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+			     mmc_get_dma_dir(data));
+		data->host_cookie &= ~MSDC_PREPARE_FLAG;
+	}
+}
+
 static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	__must_hold(&host->lock)
 {
@@ -1174,6 +1182,19 @@ static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 		send_type = SND_DAT;
 
 		data->error = 0;
+
+		msdc_prepare_data(host, data);
+		if (!(data->host_cookie & MSDC_PREPARE_FLAG)) {
+			data->error = -ENOMEM;
+			goto done;
+		}
+
+		/* CMD23: announce the block count, no CMD12 needed then */
+		if (mrq->sbc) {
+			if (msdc_do_command(host, mrq->sbc, 1, CMD_TIMEOUT) != 0)
+				goto done;
+		}
+
 		read = data->flags & MMC_DATA_READ ? 1 : 0;
 		host->data = data;
 		host->xfer_size = data->blocks * data->blksz;
@@ -1196,9 +1217,6 @@ static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 		if (msdc_command_start(host, cmd, 1, CMD_TIMEOUT) != 0)
 			goto done;
 
-		data->sg_count = dma_map_sg(mmc_dev(mmc), data->sg,
-					    data->sg_len,
-					    mmc_get_dma_dir(data));
 		msdc_dma_setup(host, &host->dma, data->sg,
 			       data->sg_count);
 
@@ -1227,8 +1245,8 @@ static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 		spin_lock(&host->lock);
 		msdc_dma_stop(host);
 
-		/* Last: stop transfer */
-		if (data->stop) {
+		/* Last: stop transfer, unless the count was set by CMD23 */
+		if (data->stop && (!mrq->sbc || data->error)) {
 			if (msdc_do_command(host, data->stop, 0, CMD_TIMEOUT) != 0)
 				goto done;
 		}
@@ -1237,8 +1255,7 @@ static int msdc_do_request(struct mmc_host *mmc, struct mmc_request *mrq)
 done:
 	if (data != NULL) {
 		host->data = NULL;
-		dma_unmap_sg(mmc_dev(mmc), data->sg, data->sg_len,
-			     mmc_get_dma_dir(data));
+		msdc_unprepare_data(host, data);
 		host->blksz = 0;
 
 #if 0 // don't stop twice!
@@ -1277,8 +1294,10 @@ done:
 #endif
 #endif /* end of --- */
 
+	if (mrq->sbc && mrq->sbc->error)
+		host->error = 0x1000;
 	if (mrq->cmd->error)
-		host->error = 0x001;
+		host->error |= 0x001;
 	if (mrq->data && mrq->data->error)
 		host->error |= 0x010;
 	if (mrq->stop && mrq->stop->error)
@@ -1651,8 +1670,7 @@ static int msdc_tune_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	return ret;
 }
 
-/* ops.request */
-static void msdc_ops_request(struct mmc_host *mmc, struct mmc_request *mrq)
+static void msdc_process_request(struct mmc_host *mmc, struct mmc_request *mrq)
 {
 	struct msdc_host *host = mmc_priv(mmc);
 
@@ -1718,6 +1736,60 @@ static void msdc_ops_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	return;
 }
 
+static void msdc_request_work(struct work_struct *work)
+{
+	struct msdc_host *host = container_of(work, struct msdc_host,
+					      req_work);
+
+	msdc_process_request(host->mmc, host->async_mrq);
+}
+
+/* ops.request */
+static void msdc_ops_request(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct msdc_host *host = mmc_priv(mmc);
+
+	/*
+	 * Requests prepared by pre_req are completed from the work item, so
+	 * the core can map the next one while this one is on the bus.
+	 */
+	if (mrq->data && (mrq->data->host_cookie & MSDC_ASYNC_FLAG)) {
+		host->async_mrq = mrq;
+		queue_work(system_highpri_wq, &host->req_work);
+		return;
+	}
+
+	msdc_process_request(mmc, mrq);
+}
+
+/* ops.pre_req */
+static void msdc_ops_pre_req(struct mmc_host *mmc, struct mmc_request *mrq)
+{
+	struct msdc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	msdc_prepare_data(host, data);
+	if (data->host_cookie & MSDC_PREPARE_FLAG)
+		data->host_cookie |= MSDC_ASYNC_FLAG;
+}
+
+/* ops.post_req */
+static void msdc_ops_post_req(struct mmc_host *mmc, struct mmc_request *mrq,
+			      int err)
+{
+	struct msdc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+
+	if (!data)
+		return;
+
+	data->host_cookie &= ~MSDC_ASYNC_FLAG;
+	msdc_unprepare_data(host, data);
+}
+
 /* called by ops.set_ios */
 static void msdc_set_buswidth(struct msdc_host *host, u32 width)
 {
@@ -1875,6 +1947,8 @@ static int msdc_ops_get_cd(struct mmc_host *mmc)
 
 static struct mmc_host_ops mt_msdc_ops = {
 	.request         = msdc_ops_request,
+	.pre_req         = msdc_ops_pre_req,
+	.post_req        = msdc_ops_post_req,
 	.set_ios         = msdc_ops_set_ios,
 	.get_ro          = msdc_ops_get_ro,
 	.get_cd          = msdc_ops_get_cd,
@@ -2237,6 +2311,8 @@ static int msdc_drv_probe(struct platform_device *pdev)
 	//TODO: read this as bus-width from dt (via mmc_of_parse)
 	mmc->caps  |= MMC_CAP_4_BIT_DATA;
 
+	mmc->caps  |= MMC_CAP_CMD23;
+
 	cd_active_low = !of_property_read_bool(pdev->dev.of_node, "cd-inverted");
 
 	if (of_property_read_bool(pdev->dev.of_node, "mediatek,cd-poll"))
@@ -2297,6 +2373,7 @@ static int msdc_drv_probe(struct platform_device *pdev)
 	msdc_init_gpd_bd(host, &host->dma);
 
 	INIT_DELAYED_WORK(&host->card_delaywork, msdc_tasklet_card);
+	INIT_WORK(&host->req_work, msdc_request_work);
 	spin_lock_init(&host->lock);
 	msdc_init_hw(host);
 
@@ -2364,6 +2441,7 @@ static void msdc_drv_remove(struct platform_device *pdev)
 	msdc_deinit_hw(host);
 
 	cancel_delayed_work_sync(&host->card_delaywork);
+	cancel_work_sync(&host->req_work);
 
 	dma_free_coherent(&pdev->dev, MAX_GPD_NUM * sizeof(struct gpd),
 			  host->dma.gpd, host->dma.gpd_addr);
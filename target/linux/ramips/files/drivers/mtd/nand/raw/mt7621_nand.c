@@ -12,6 +12,8 @@
 #include <linux/init.h>
 #include <linux/errno.h>
 #include <linux/sizes.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
 #include <linux/iopoll.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
@@ -19,6 +21,7 @@
 #include <linux/mtd/rawnand.h>
 #include <linux/mtd/partitions.h>
 #include <linux/mtd/mtk_bmt.h>
+#include <linux/dma-mapping.h>
 #include <linux/platform_device.h>
 #include <asm/addrspace.h>
 
@@ -31,6 +34,8 @@
 #define   CNFG_HW_ECC_EN		BIT(8)
 #define   CNFG_BYTE_RW			BIT(6)
 #define   CNFG_READ_MODE		BIT(1)
+#define   CNFG_DMA_BURST_EN		BIT(2)
+#define   CNFG_AHB			BIT(0)
 
 #define NFI_PAGEFMT			0x004
 #define   PAGEFMT_FDM_ECC_S		12
@@ -114,6 +119,10 @@
 #define   SEC_ADDR_S			0
 #define   SEC_ADDR_M			GENMASK(9, 0)
 
+#define NFI_STRADDR			0x080
+
+#define NFI_BYTELEN			0x084
+
 #define NFI_CSEL			0x090
 #define   CSEL_S			0
 #define   CSEL_M			GENMASK(1, 0)
@@ -209,6 +218,28 @@
 
 #define MT7621_NFC_NAME			"mt7621-nand"
 
+enum mt7621_nfc_xfer {
+	XFER_PIO_READ,
+	XFER_PIO_WRITE,
+	XFER_DMA_READ,
+	XFER_DMA_WRITE,
+
+	__XFER_MAX
+};
+
+static const char * const mt7621_nfc_xfer_names[__XFER_MAX] = {
+	[XFER_PIO_READ] = "pio read",
+	[XFER_PIO_WRITE] = "pio write",
+	[XFER_DMA_READ] = "dma read",
+	[XFER_DMA_WRITE] = "dma write",
+};
+
+struct mt7621_nfc_stats {
+	u64 pages;
+	u64 bytes;
+	u64 time_ns;
+};
+
 struct mt7621_nfc {
 	struct nand_controller controller;
 	struct nand_chip nand;
@@ -220,6 +251,13 @@ struct mt7621_nfc {
 	void __iomem *ecc_regs;
 
 	u32 spare_per_sector;
+
+	/* page sized bounce buffer for AHB DMA */
+	bool use_dma;
+	u8 *dma_buf;
+
+	struct mt7621_nfc_stats stats[__XFER_MAX];
+	struct dentry *debugfs;
 };
 
 static const u16 mt7621_nfi_page_size[] = { SZ_512, SZ_2K, SZ_4K };
@@ -623,6 +661,107 @@ static void mt7621_nfc_write_data_empty(struct mt7621_nfc *nfc, u32 len)
 	}
 }
 
+static int mt7621_nfc_wait_read_completion(struct mt7621_nfc *nfc,
+					   struct nand_chip *nand)
+{
+	struct device *dev = nfc->dev;
+	u32 val;
+	int ret;
+
+	ret = readl_poll_timeout(nfc->nfi_regs + NFI_BYTELEN, val,
+		((val & SEC_CNTR_M) >> SEC_CNTR_S) >= nand->ecc.steps, 10,
+		NFI_CORE_TIMEOUT);
+	if (ret) {
+		dev_warn(dev, "NFI core read operation timed out\n");
+		return -ETIMEDOUT;
+	}
+
+	/* the sector counter runs ahead of the last AHB burst */
+	ret = readw_poll_timeout(nfc->nfi_regs + NFI_MASTER_STA, val,
+				 !(val & MASTER_STA_MASK), 10,
+				 NFI_CORE_TIMEOUT);
+	if (ret) {
+		dev_warn(dev, "NFI master timed out finishing DMA\n");
+		return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+/*
+ * Move a whole page between memory and the NFI through its AHB master.
+ * Buffers which can not be mapped directly (vmalloc, unaligned to the
+ * cache line or no buffer at all) go through the bounce buffer.
+ *
+ * The bounce copy is left to the CPU. It is a single page, and a vmalloc
+ * buffer is not physically contiguous, so mapping it page by page for a
+ * memcpy DMA channel and waiting for the completion costs more than the
+ * copy itself.
+ *
+ * Returns -EAGAIN if the buffer could not be mapped, in which case the
+ * caller has to fall back to PIO.
+ */
+static int mt7621_nfc_dma_xfer(struct mt7621_nfc *nfc, u8 *buf, bool read)
+{
+	struct nand_chip *nand = &nfc->nand;
+	struct mtd_info *mtd = nand_to_mtd(nand);
+	enum dma_data_direction dir = read ? DMA_FROM_DEVICE : DMA_TO_DEVICE;
+	u32 len = mtd->writesize;
+	dma_addr_t addr;
+	bool bounce;
+	u8 *xbuf;
+	int ret;
+
+	bounce = !buf || !virt_addr_valid(buf) ||
+		 !IS_ALIGNED((uintptr_t)buf, dma_get_cache_alignment());
+	xbuf = bounce ? nfc->dma_buf : buf;
+
+	if (bounce && !read) {
+		if (buf)
+			memcpy(xbuf, buf, len);
+		else
+			memset(xbuf, 0xff, len);
+	}
+
+	addr = dma_map_single(nfc->dev, xbuf, len, dir);
+	if (dma_mapping_error(nfc->dev, addr))
+		return -EAGAIN;
+
+	nfi_write16(nfc, NFI_CNFG, nfi_read16(nfc, NFI_CNFG) | CNFG_AHB |
+		    CNFG_DMA_BURST_EN);
+	nfi_write32(nfc, NFI_STRADDR, addr);
+	nfi_write16(nfc, NFI_CON, (read ? CON_NFI_BRD : CON_NFI_BWR) |
+		    (nand->ecc.steps << CON_NFI_SEC_S));
+
+	/* trigger the transfer */
+	nfi_write16(nfc, NFI_STRDATA, STR_DATA);
+
+	if (read)
+		ret = mt7621_nfc_wait_read_completion(nfc, nand);
+	else
+		ret = mt7621_nfc_wait_write_completion(nfc, nand);
+
+	if (ret)
+		mt7621_nfc_hw_reset(nfc);
+
+	dma_unmap_single(nfc->dev, addr, len, dir);
+
+	if (!ret && read && buf && bounce)
+		memcpy(buf, xbuf, len);
+
+	return ret;
+}
+
+static void mt7621_nfc_account(struct mt7621_nfc *nfc,
+			       enum mt7621_nfc_xfer xfer, ktime_t start)
+{
+	struct mt7621_nfc_stats *st = &nfc->stats[xfer];
+
+	st->pages++;
+	st->bytes += nand_to_mtd(&nfc->nand)->writesize;
+	st->time_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
 static int mt7621_nfc_dev_ready(struct mt7621_nfc *nfc,
 				unsigned int timeout_ms)
 {
@@ -918,6 +1057,14 @@ static int mt7621_nfc_attach_chip(struct nand_chip *nand)
 	if (ret)
 		return ret;
 
+	if (nfc->use_dma) {
+		nfc->dma_buf = devm_kmalloc(nfc->dev,
+					    nand_to_mtd(nand)->writesize,
+					    GFP_KERNEL);
+		if (!nfc->dma_buf)
+			return -ENOMEM;
+	}
+
 	return mt7621_nfc_set_page_format(nfc);
 }
 
@@ -1007,23 +1154,35 @@ static int mt7621_nfc_read_page_hwecc(struct nand_chip *nand, uint8_t *buf,
 	struct mt7621_nfc *nfc = nand_get_controller_data(nand);
 	struct mtd_info *mtd = nand_to_mtd(nand);
 	int bitflips = 0, ret = 0;
+	ktime_t start;
+	bool pio;
 	int rc, i;
 
 	nand_read_page_op(nand, page, 0, NULL, 0);
 
+	start = ktime_get();
+
 	nfi_write16(nfc, NFI_CNFG, (CNFG_OP_CUSTOM << CNFG_OP_MODE_S) |
 		    CNFG_READ_MODE | CNFG_AUTO_FMT_EN | CNFG_HW_ECC_EN);
 
 	mt7621_ecc_decoder_op(nfc, true);
 
-	nfi_write16(nfc, NFI_CON,
-		    CON_NFI_BRD | (nand->ecc.steps << CON_NFI_SEC_S));
+	rc = nfc->use_dma ? mt7621_nfc_dma_xfer(nfc, buf, true) : -EAGAIN;
+	if (rc && rc != -EAGAIN) {
+		ret = -EIO;
+		goto out;
+	}
+
+	pio = rc == -EAGAIN;
+	if (pio)
+		nfi_write16(nfc, NFI_CON,
+			    CON_NFI_BRD | (nand->ecc.steps << CON_NFI_SEC_S));
 
 	for (i = 0; i < nand->ecc.steps; i++) {
-		if (buf)
+		if (pio && buf)
 			mt7621_nfc_read_data(nfc, page_data_ptr(nand, buf, i),
 					     nand->ecc.size);
-		else
+		else if (pio)
 			mt7621_nfc_read_data_discard(nfc, nand->ecc.size);
 
 		rc = mt7621_ecc_decoder_wait_done(nfc, i);
@@ -1052,6 +1211,9 @@ static int mt7621_nfc_read_page_hwecc(struct nand_chip *nand, uint8_t *buf,
 		}
 	}
 
+	mt7621_nfc_account(nfc, pio ? XFER_PIO_READ : XFER_DMA_READ, start);
+
+out:
 	mt7621_ecc_decoder_op(nfc, false);
 
 	nfi_write16(nfc, NFI_CON, 0);
@@ -1135,6 +1297,8 @@ static int mt7621_nfc_write_page_hwecc(struct nand_chip *nand,
 {
 	struct mt7621_nfc *nfc = nand_get_controller_data(nand);
 	struct mtd_info *mtd = nand_to_mtd(nand);
+	ktime_t start;
+	int ret;
 
 	if (mt7621_nfc_check_empty_page(nand, buf)) {
 		/*
@@ -1158,20 +1322,33 @@ static int mt7621_nfc_write_page_hwecc(struct nand_chip *nand,
 
 	mt7621_nfc_write_fdm(nfc);
 
-	nfi_write16(nfc, NFI_CON,
-		    CON_NFI_BWR | (nand->ecc.steps << CON_NFI_SEC_S));
+	start = ktime_get();
 
-	if (buf)
-		mt7621_nfc_write_data(nfc, buf, mtd->writesize);
-	else
-		mt7621_nfc_write_data_empty(nfc, mtd->writesize);
+	ret = nfc->use_dma ? mt7621_nfc_dma_xfer(nfc, (u8 *)buf, false) :
+			     -EAGAIN;
+	if (ret == -EAGAIN) {
+		nfi_write16(nfc, NFI_CON,
+			    CON_NFI_BWR | (nand->ecc.steps << CON_NFI_SEC_S));
 
-	mt7621_nfc_wait_write_completion(nfc, nand);
+		if (buf)
+			mt7621_nfc_write_data(nfc, buf, mtd->writesize);
+		else
+			mt7621_nfc_write_data_empty(nfc, mtd->writesize);
+
+		mt7621_nfc_wait_write_completion(nfc, nand);
+		mt7621_nfc_account(nfc, XFER_PIO_WRITE, start);
+		ret = 0;
+	} else if (!ret) {
+		mt7621_nfc_account(nfc, XFER_DMA_WRITE, start);
+	}
 
 	mt7621_ecc_encoder_op(nfc, false);
 
 	nfi_write16(nfc, NFI_CON, 0);
 
+	if (ret)
+		return -EIO;
+
 	return nand_prog_page_end_op(nand);
 }
 
@@ -1223,6 +1400,31 @@ static int mt7621_nfc_write_oob_raw(struct nand_chip *nand, int page)
 	return mt7621_nfc_write_page_raw(nand, NULL, 1, page);
 }
 
+static int mt7621_nfc_stats_show(struct seq_file *s, void *data)
+{
+	struct mt7621_nfc *nfc = s->private;
+	struct mt7621_nfc_stats *st;
+	u64 msecs;
+	int i;
+
+	seq_printf(s, "dma: %s\n", nfc->use_dma ? "enabled" : "disabled");
+
+	for (i = 0; i < __XFER_MAX; i++) {
+		st = &nfc->stats[i];
+		msecs = div_u64(st->time_ns, NSEC_PER_MSEC);
+
+		seq_printf(s, "%-10s pages %llu bytes %llu time %llu ms",
+			   mt7621_nfc_xfer_names[i], st->pages, st->bytes,
+			   msecs);
+		if (msecs)
+			seq_printf(s, " (%llu KB/s)", div64_u64(st->bytes, msecs));
+		seq_putc(s, '\n');
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(mt7621_nfc_stats);
+
 static int mt7621_nfc_init_chip(struct mt7621_nfc *nfc)
 {
 	struct nand_chip *nand = &nfc->nand;
@@ -1268,6 +1470,10 @@ static int mt7621_nfc_init_chip(struct mt7621_nfc *nfc)
 		return ret;
 	}
 
+	nfc->debugfs = debugfs_create_dir(MT7621_NFC_NAME, NULL);
+	debugfs_create_file("stats", 0444, nfc->debugfs, nfc,
+			    &mt7621_nfc_stats_fops);
+
 	return 0;
 }
 
@@ -1303,6 +1509,10 @@ static int mt7621_nfc_probe(struct platform_device *pdev)
 	if (!nfc->nfi_clk)
 		dev_warn(dev, "nfi clk not provided\n");
 
+	nfc->use_dma = !dma_set_mask_and_coherent(dev, DMA_BIT_MASK(32));
+	if (!nfc->use_dma)
+		dev_warn(dev, "DMA not available, using PIO\n");
+
 	platform_set_drvdata(pdev, nfc);
 
 	ret = mt7621_nfc_init_chip(nfc);
@@ -1318,6 +1528,7 @@ static void mt7621_nfc_remove(struct platform_device *pdev)
 	struct nand_chip *nand = &nfc->nand;
 	struct mtd_info *mtd = nand_to_mtd(nand);
 
+	debugfs_remove_recursive(nfc->debugfs);
 	mtk_bmt_detach(mtd);
 	mtd_device_unregister(mtd);
 	nand_cleanup(nand);
@@ -110,7 +110,9 @@ void *decompress(void *out, void *in, int len)
 		ret = unlzma(in, len, 0, 0, out, &outlen, 0, decompress_error);
 		break;
 	case UIMAGE_COMP_NONE:
-		memcpy(out, in, len);
+		/* the image might already sit at its load address */
+		if (out != in)
+			memmove(out, in, len);
 		outlen = len;
 		ret = 0;
 		break;
@@ -162,6 +164,13 @@ void load_uimage_from_flash(void *flash_start)
 		board_panic();
 	}
 
+	/*
+	 * Uncompressed images need no intermediate buffer. Copy them from flash
+	 * straight to their load address and boot them in place.
+	 */
+	if (_kernel_comp_type == UIMAGE_COMP_NONE)
+		_kernel_data_addr = _kernel_load_addr;
+
 	printf("uImage '%s' found at 0x%08x with load address 0x%08x\n",
 	       (char *)(flash_addr + 32), flash_addr, _kernel_load_addr);
 	printf("Copy %d bytes of image data to 0x%08x ...\n",
@@ -3,7 +3,8 @@
  * (c) 2025 Markus Stockhausen
  *
  * This is a small function collection to get some rudimentary memory management working when
- * running bare metal. None of these functions is optimized but works well for current needs.
+ * running bare metal. Copy and set work on 32 bit words where the alignment allows it, as the
+ * loader moves several megabytes around before the kernel starts.
  */
 
 #include "board.h"
@@ -63,17 +64,74 @@ int memcmp(const void *s1, const void *s2, size_t count)
 	return 0;
 }
 
+#define WORD_SIZE	sizeof(unsigned int)
+#define WORD_MASK	(WORD_SIZE - 1)
+
 void *memmove(void *dst, const void *src, size_t count)
 {
-	volatile char *d = (volatile char *)dst;
-	volatile char *s = (volatile char *)src;
+	unsigned char *d = dst;
+	const unsigned char *s = src;
+	unsigned int *dw;
+	const unsigned int *sw;
+	/* word copy is only possible if both pointers can be aligned together */
+	int words = !(((unsigned long)d ^ (unsigned long)s) & WORD_MASK);
+
+	if (d == s || !count)
+		return dst;
+
+	if (d < s || d >= s + count) {
+		if (words) {
+			while (count && ((unsigned long)d & WORD_MASK)) {
+				*d++ = *s++;
+				count--;
+			}
+
+			dw = (unsigned int *)d;
+			sw = (const unsigned int *)s;
+			for (; count >= 4 * WORD_SIZE; count -= 4 * WORD_SIZE) {
+				dw[0] = sw[0];
+				dw[1] = sw[1];
+				dw[2] = sw[2];
+				dw[3] = sw[3];
+				dw += 4;
+				sw += 4;
+			}
+			for (; count >= WORD_SIZE; count -= WORD_SIZE)
+				*dw++ = *sw++;
+
+			d = (unsigned char *)dw;
+			s = (const unsigned char *)sw;
+		}
 
-	if (d < s) {
 		while (count--)
 			*d++ = *s++;
-	} else if (d > s) {
+	} else {
 		d += count;
 		s += count;
+
+		if (words) {
+			while (count && ((unsigned long)d & WORD_MASK)) {
+				*--d = *--s;
+				count--;
+			}
+
+			dw = (unsigned int *)d;
+			sw = (const unsigned int *)s;
+			for (; count >= 4 * WORD_SIZE; count -= 4 * WORD_SIZE) {
+				dw -= 4;
+				sw -= 4;
+				dw[3] = sw[3];
+				dw[2] = sw[2];
+				dw[1] = sw[1];
+				dw[0] = sw[0];
+			}
+			for (; count >= WORD_SIZE; count -= WORD_SIZE)
+				*--dw = *--sw;
+
+			d = (unsigned char *)dw;
+			s = (const unsigned char *)sw;
+		}
+
 		while (count--)
 			*--d = *--s;
 	}
@@ -83,24 +141,47 @@ void *memmove(void *dst, const void *src, size_t count)
 
 void *memcpy(void *dst, const void *src, size_t count)
 {
-	memmove(dst, src, count);
+	return memmove(dst, src, count);
 }
 
 void *memset(void *dst, int c, size_t count)
 {
-	volatile char *d = (volatile char *)dst;
+	unsigned char *d = dst;
+	unsigned int *dw;
+	unsigned int w;
+
+	while (count && ((unsigned long)d & WORD_MASK)) {
+		*d++ = c;
+		count--;
+	}
 
+	w = (unsigned char)c;
+	w |= w << 8;
+	w |= w << 16;
+
+	dw = (unsigned int *)d;
+	for (; count >= 4 * WORD_SIZE; count -= 4 * WORD_SIZE) {
+		dw[0] = w;
+		dw[1] = w;
+		dw[2] = w;
+		dw[3] = w;
+		dw += 4;
+	}
+	for (; count >= WORD_SIZE; count -= WORD_SIZE)
+		*dw++ = w;
+
+	d = (unsigned char *)dw;
 	while (count--)
 		*d++ = c;
 
-	return (void *)d;
+	return dst;
 }
 
 void *malloc(size_t count)
 {
 	void *start;
 
-	start = (void *)(((unsigned int)_heap_addr + MEMORY_ALIGNMENT - 1) & ~(MEMORY_ALIGNMENT - 1));
+	start = (void *)(((unsigned long)_heap_addr + MEMORY_ALIGNMENT - 1) & ~(MEMORY_ALIGNMENT - 1));
 	if ((start + count) > _heap_addr_max) {
 		printf("malloc(%d) failed. Only %dkB of %dkB heap left.\n",
 		       count, (_heap_addr_max - start) >> 10, HEAP_SIZE >> 10);
@@ -121,19 +202,34 @@ size_t strlen(const char *s)
 	return len;
 }
 
-unsigned int crc32(void *m, size_t count)
+static unsigned int crc32_table[256];
+
+static void crc32_init(void)
 {
-	unsigned int crc = 0xffffffff;
-	unsigned char *data = m;
+	unsigned int crc;
 
-	for (size_t i = 0; i < count; i++) {
-		crc ^= data[i];
+	for (int i = 0; i < 256; i++) {
+		crc = i;
 		for (int j = 0; j < 8; j++)
 			if (crc & 1)
 				crc = (crc >> 1) ^ 0xEDB88320;
 			else
 				crc >>= 1;
+		crc32_table[i] = crc;
 	}
+}
+
+unsigned int crc32(void *m, size_t count)
+{
+	unsigned int crc = 0xffffffff;
+	unsigned char *data = m;
+
+	/* entry 0 is 0 for any polynomial, entry 128 is the polynomial itself */
+	if (!crc32_table[128])
+		crc32_init();
+
+	for (size_t i = 0; i < count; i++)
+		crc = (crc >> 8) ^ crc32_table[(crc ^ data[i]) & 0xff];
 
 	return ~crc;
 }
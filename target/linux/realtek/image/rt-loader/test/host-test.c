@@ -0,0 +1,312 @@
+/*
+ * rt-loader host test
+ * (c) 2025 Markus Stockhausen
+ *
+ * Builds the loader memory functions and the LZMA decompressor for the host. The copy, set
+ * and CRC routines are checked against libc and zlib with random offsets, lengths and
+ * overlaps and are timed against the plain byte loops and the bitwise CRC. If an LZMA file
+ * and its uncompressed original are given, the decompressor is checked and timed as well.
+ *
+ * usage: host-test [<file.lzma> <file>]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+/* keep the loader functions apart from libc and zlib */
+#define free			rt_free
+#define malloc			rt_malloc
+#define memcmp			rt_memcmp
+#define memcpy			rt_memcpy
+#define memmove			rt_memmove
+#define memset			rt_memset
+#define strlen			rt_strlen
+#define crc32			rt_crc32
+#define flush_cache		rt_flush_cache
+#define __asm__
+#define __volatile__(...)
+
+#define NANOPRINTF_USE_FIELD_WIDTH_FORMAT_SPECIFIERS	1
+#define NANOPRINTF_USE_LARGE_FORMAT_SPECIFIERS		0
+#define NANOPRINTF_USE_SMALL_FORMAT_SPECIFIERS		0
+#define NANOPRINTF_USE_BINARY_FORMAT_SPECIFIERS		0
+#define NANOPRINTF_USE_WRITEBACK_FORMAT_SPECIFIERS	0
+#define NANOPRINTF_USE_PRECISION_FORMAT_SPECIFIERS	0
+#define NANOPRINTF_USE_FLOAT_FORMAT_SPECIFIERS		0
+#define NANOPRINTF_IMPLEMENTATION
+
+#include "../src/memory.c"
+#include "../src/unlzma.c"
+
+#undef free
+#undef malloc
+#undef memcmp
+#undef memcpy
+#undef memmove
+#undef memset
+#undef strlen
+#undef crc32
+#undef printf
+#undef snprintf
+
+#define TEST_SIZE		(256 * 1024)
+#define TEST_RUNS		20000
+#define BENCH_SIZE		(4 * 1024 * 1024)
+#define BENCH_RUNS		16
+
+static unsigned char heap[HEAP_SIZE];
+void *_heap_addr;
+void *_heap_addr_max;
+
+void board_putchar(int ch, void *ctx)
+{
+	putchar(ch);
+}
+
+void board_panic(void)
+{
+	exit(1);
+}
+
+static void decompress_error(char *msg)
+{
+	fprintf(stderr, "unlzma: %s\n", msg);
+}
+
+static double elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* the functions as they were before the word-wise versions */
+static void *byte_memmove(void *dst, const void *src, size_t count)
+{
+	volatile unsigned char *d = dst;
+	volatile const unsigned char *s = src;
+
+	if (d < s) {
+		while (count--)
+			*d++ = *s++;
+	} else {
+		d += count;
+		s += count;
+		while (count--)
+			*--d = *--s;
+	}
+
+	return dst;
+}
+
+static void *byte_memset(void *dst, int c, size_t count)
+{
+	volatile unsigned char *d = dst;
+
+	while (count--)
+		*d++ = c;
+
+	return dst;
+}
+
+static unsigned int bit_crc32(void *m, size_t count)
+{
+	unsigned int crc = 0xffffffff;
+	unsigned char *data = m;
+
+	while (count--) {
+		crc ^= *data++;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static size_t rand_len(void)
+{
+	/* mostly short copies, where the head and tail handling matters */
+	switch (rand() % 4) {
+	case 0:
+		return rand() % 16;
+	case 1:
+		return rand() % 256;
+	default:
+		return rand() % (TEST_SIZE / 2);
+	}
+}
+
+static int test_memory(void)
+{
+	unsigned char *src = malloc(TEST_SIZE), *a = malloc(TEST_SIZE), *b = malloc(TEST_SIZE);
+	size_t dofs, sofs, len;
+	int i, err = 0;
+
+	for (i = 0; i < TEST_SIZE; i++)
+		src[i] = rand();
+
+	for (i = 0; i < TEST_RUNS && !err; i++) {
+		len = rand_len();
+		dofs = rand() % (TEST_SIZE - len + 1);
+		sofs = rand() % (TEST_SIZE - len + 1);
+
+		/* memmove within one buffer, so that source and destination may overlap */
+		memcpy(a, src, TEST_SIZE);
+		memcpy(b, src, TEST_SIZE);
+		memmove(b + dofs, b + sofs, len);
+		if (rt_memmove(a + dofs, a + sofs, len) != a + dofs || memcmp(a, b, TEST_SIZE)) {
+			fprintf(stderr, "memmove(+%zu, +%zu, %zu) failed\n", dofs, sofs, len);
+			err = 1;
+		}
+
+		memcpy(b + dofs, src + sofs, len);
+		if (rt_memcpy(a + dofs, src + sofs, len) != a + dofs || memcmp(a, b, TEST_SIZE)) {
+			fprintf(stderr, "memcpy(+%zu, +%zu, %zu) failed\n", dofs, sofs, len);
+			err = 1;
+		}
+
+		memset(b + dofs, sofs, len);
+		if (rt_memset(a + dofs, sofs, len) != a + dofs || memcmp(a, b, TEST_SIZE)) {
+			fprintf(stderr, "memset(+%zu, 0x%02zx, %zu) failed\n", dofs, sofs & 0xff, len);
+			err = 1;
+		}
+
+		if (!rt_memcmp(a, b, TEST_SIZE) != !memcmp(a, b, TEST_SIZE)) {
+			fprintf(stderr, "memcmp() failed\n");
+			err = 1;
+		}
+
+		if (rt_crc32(src + sofs, len) != crc32(0, src + sofs, len)) {
+			fprintf(stderr, "crc32(+%zu, %zu) failed\n", sofs, len);
+			err = 1;
+		}
+	}
+
+	if (!err)
+		printf("memmove/memcpy/memset/memcmp/crc32: %d random runs ok\n", TEST_RUNS);
+
+	free(src);
+	free(a);
+	free(b);
+
+	return err;
+}
+
+static void bench_memory(void)
+{
+	unsigned char *a = malloc(BENCH_SIZE + 1), *b = malloc(BENCH_SIZE + 1);
+	struct timespec start;
+	double mb = (double)BENCH_SIZE * BENCH_RUNS / (1024 * 1024);
+	volatile unsigned int crc;
+	int i;
+
+	memset(a, 0x5a, BENCH_SIZE + 1);
+
+#define BENCH(name, expr)							\
+	do {									\
+		clock_gettime(CLOCK_MONOTONIC, &start);				\
+		for (i = 0; i < BENCH_RUNS; i++)				\
+			expr;							\
+		printf("%-24s %8.1f MB/s\n", name, mb * 1000 / elapsed(&start));	\
+	} while (0)
+
+	BENCH("memcpy (bytes)", byte_memmove(b, a, BENCH_SIZE));
+	BENCH("memcpy (words)", rt_memcpy(b, a, BENCH_SIZE));
+	BENCH("memcpy unaligned (words)", rt_memcpy(b, a + 1, BENCH_SIZE));
+	BENCH("memset (bytes)", byte_memset(b, i, BENCH_SIZE));
+	BENCH("memset (words)", rt_memset(b, i, BENCH_SIZE));
+	BENCH("crc32 (bitwise)", crc = bit_crc32(a, BENCH_SIZE));
+	BENCH("crc32 (table)", crc = rt_crc32(a, BENCH_SIZE));
+
+#undef BENCH
+
+	(void)crc;
+	free(a);
+	free(b);
+}
+
+static unsigned char *read_file(const char *name, long *len)
+{
+	unsigned char *buf;
+	FILE *f;
+
+	f = fopen(name, "rb");
+	if (!f) {
+		perror(name);
+		return NULL;
+	}
+
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	rewind(f);
+
+	buf = malloc(*len + 1);
+	if (buf && fread(buf, 1, *len, f) != *len) {
+		free(buf);
+		buf = NULL;
+	}
+	fclose(f);
+
+	return buf;
+}
+
+static int test_unlzma(const char *lzma_name, const char *raw_name)
+{
+	unsigned char *in, *raw, *out;
+	long in_len, raw_len, out_len;
+	struct timespec start;
+	double ms;
+	int ret = 1;
+
+	in = read_file(lzma_name, &in_len);
+	raw = read_file(raw_name, &raw_len);
+	out = malloc(raw_len + 1);
+	if (!in || !raw || !out)
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	_heap_addr = heap;
+	_heap_addr_max = heap + sizeof(heap);
+	if (unlzma(in, in_len, 0, 0, out, &out_len, 0, decompress_error))
+		goto out;
+	ms = elapsed(&start);
+
+	if (out_len != raw_len || memcmp(out, raw, raw_len)) {
+		fprintf(stderr, "unlzma: %ld bytes, output differs from %s\n", out_len, raw_name);
+		goto out;
+	}
+
+	printf("unlzma: %ld -> %ld bytes in %.1f ms, %.1f MB/s\n",
+	       in_len, out_len, ms, out_len / 1024.0 / 1024.0 * 1000 / ms);
+	ret = 0;
+
+out:
+	free(in);
+	free(raw);
+	free(out);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int err;
+
+	if (argc != 1 && argc != 3) {
+		fprintf(stderr, "usage: %s [<file.lzma> <file>]\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	err = test_memory();
+	if (!err)
+		bench_memory();
+	if (!err && argc == 3)
+		err = test_unlzma(argv[1], argv[2]);
+
+	return err;
+}